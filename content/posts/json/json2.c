@@ -1,6 +1,20 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 
 #define keyoffset 8
 
@@ -23,22 +37,48 @@ enum value_type {
 typedef struct {
     int type;
     int line;
+    int start;      // source offset of the first character
+    int end;        // source offset past the last character
     char *lexeme;
 } token;
 
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_block;
+
+// bump allocator for tokens and values, the current block comes first
+typedef struct {
+    arena_block *blocks;
+} arena;
+
+typedef struct {
+    int line;
+    char msg[128];
+} json_error;
+
 typedef struct {
     int start;
     int current;
     int line;
+    int length;
     int capacity;
     int size;
     char *source;
     token *tokens;
+    arena *arena;       // NULL to allocate with malloc
+    json_error *error;  // where to report errors instead of exiting
+    jmp_buf *jump;
 } scanner;
 
 typedef struct {
     int current;
     token *tokens;
+    arena *arena;
+    json_error *error;
+    jmp_buf *jump;
 } parser;
 
 typedef struct value value;
@@ -62,9 +102,14 @@ typedef struct {
 
 struct value {
     int type;
+    int offset;     // source offset relative to the enclosing container
+    int length;     // length of the source text, including brackets and quotes
     union {
         char *string;
-        float number;
+        struct {
+            float number;
+            char *lexeme;   // source text of the number, NULL if it has none
+        };
         object object;
         array array;
     };
@@ -110,7 +155,7 @@ char scanner_advance(scanner *scanner) {
 
 // check if we are done parsing the source
 int scanner_is_at_end(scanner *scanner) {
-    return scanner->current >= strlen(scanner->source);
+    return scanner->current >= scanner->length;
 }
 
 // peek at the current character without advancing further
@@ -130,10 +175,88 @@ char *substring(char *s, int start, int end) {
     return t;
 }
 
+// allocate memory from the arena
+void *arena_alloc(arena *arena, size_t size) {
+    size = (size + 7) & ~(size_t) 7;
+    arena_block *block = arena->blocks;
+    if (!block || block->used + size > block->size) {
+        size_t bsize = block ? 2 * block->size : 4096;
+        if (bsize < size) {
+            bsize = size;
+        }
+        block = malloc(sizeof(arena_block) + bsize);
+        block->next = arena->blocks;
+        block->size = bsize;
+        block->used = 0;
+        arena->blocks = block;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+// free all blocks of the arena
+void arena_free(arena *arena) {
+    while (arena->blocks) {
+        arena_block *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+}
+
+// drop all allocations, merging blocks so the next document fits into one
+void arena_reset(arena *arena) {
+    arena_block *block = arena->blocks;
+    if (block && block->next) {
+        size_t size = 0;
+        for (; block; block = block->next) {
+            size += block->size;
+        }
+        arena_free(arena);
+        block = malloc(sizeof(arena_block) + size);
+        block->next = NULL;
+        block->size = size;
+        arena->blocks = block;
+    }
+    if (block) {
+        block->used = 0;
+    }
+}
+
+// allocate from the arena if there is one, from the heap otherwise
+void *json_alloc(arena *arena, size_t size) {
+    return arena ? arena_alloc(arena, size) : malloc(size);
+}
+
+// grow an allocation, arena memory is copied and the old copy is left behind
+void *json_realloc(arena *arena, void *ptr, size_t oldsize, size_t newsize) {
+    if (!arena) {
+        return realloc(ptr, newsize);
+    }
+    void *grown = arena_alloc(arena, newsize);
+    memcpy(grown, ptr, oldsize);
+    return grown;
+}
+
+// copy a lexeme into a value, arena lexemes live as long as the value
+char *json_strdup(arena *arena, char *s) {
+    return arena ? s : strdup(s);
+}
+
+// report an error: jump back to the context if there is one, exit otherwise
+void json_fail(json_error *error, jmp_buf *jump, int line, char *msg) {
+    if (!jump) {
+        fprintf(stderr, "[line %d]: %s\n", line, msg);
+        exit(1);
+    }
+    error->line = line;
+    snprintf(error->msg, sizeof(error->msg), "%s", msg);
+    longjmp(*jump, 1);
+}
+
 // report a scanner error
-void scanner_error(int line, char *msg) {
-    fprintf(stderr, "[line %d]: %s\n", line, msg);
-    exit(1);
+void scanner_error(scanner *scanner, char *msg) {
+    json_fail(scanner->error, scanner->jump, scanner->line, msg);
 }
 
 // check if c is a digit
@@ -155,7 +278,7 @@ int isalnum(char c) {
 
 // peek at one character after the next one
 char scanner_peeknext(scanner *scanner) {
-    if (scanner->current + 1 >= strlen(scanner->source)) {
+    if (scanner->current + 1 >= scanner->length) {
         return '\0';
     }
     return scanner->source[scanner->current + 1];
@@ -163,13 +286,16 @@ char scanner_peeknext(scanner *scanner) {
 
 // add the current token from the source string into scanner tokens
 void add_token(scanner *scanner, int type) {
-    char *text = substring(
-        scanner->source, scanner->start, scanner->current
-    );
+    int size = scanner->current - scanner->start;
+    char *text = json_alloc(scanner->arena, size + 1);
+    memcpy(text, scanner->source + scanner->start, size);
+    text[size] = 0;
     token token = {
         .type = type,
         .lexeme = text,
         .line = scanner->line,
+        .start = scanner->start,
+        .end = scanner->current,
     };
     if (scanner->size >= scanner->capacity) {
         scanner->capacity *= 2;
@@ -189,12 +315,14 @@ void scanner_string(scanner *scanner) {
         scanner_advance(scanner);
     }
     if (scanner_is_at_end(scanner)) {
-        scanner_error(scanner->line, "unterminated string");
+        scanner_error(scanner, "unterminated string");
     }
     scanner_advance(scanner);
     scanner->start++;
     scanner->current--;
     add_token(scanner, TOKEN_STRING);
+    scanner->tokens[scanner->size - 1].start--;
+    scanner->tokens[scanner->size - 1].end++;
     scanner->start--;
     scanner->current++;
 }
@@ -235,8 +363,9 @@ void identifier(scanner *scanner) {
     int type = key_type(text);
     if (type == -1) {
         char line[128];
-        sprintf(line, "unexpected identifier: %s", text);
-        scanner_error(scanner->line, line);
+        sprintf(line, "unexpected identifier: %.100s", text);
+        free(text);
+        scanner_error(scanner, line);
     }
     add_token(scanner, type);
     free(text);
@@ -288,7 +417,7 @@ void scan_token(scanner *scanner) {
         } else {
             char msg[128];
             sprintf(msg, "unexpected character: %c", c);
-            scanner_error(scanner->line, msg);
+            scanner_error(scanner, msg);
         }
         break;
     }
@@ -346,9 +475,14 @@ token parser_advance(parser *parser) {
 }
 
 // report a parser error
-void parser_error(token token, char *msg) {
-    fprintf(stderr, "[line %d] at '%s': %s\n", token.line, token.lexeme, msg);
-    exit(1);
+void parser_error(parser *parser, token token, char *msg) {
+    if (!parser->jump) {
+        fprintf(stderr, "[line %d] at '%s': %s\n", token.line, token.lexeme, msg);
+        exit(1);
+    }
+    char line[128];
+    snprintf(line, sizeof(line), "at '%s': %s", token.lexeme, msg);
+    json_fail(parser->error, parser->jump, token.line, line);
 }
 
 // consume the current token
@@ -356,27 +490,29 @@ token consume(parser *parser, int type, char *msg) {
     if (check(parser, type)) {
         return parser_advance(parser);
     }
-    parser_error(parser_peek(parser), msg);
+    parser_error(parser, parser_peek(parser), msg);
     return (token){0};
 }
 
 // add a value to an array
-void array_add_value(array *array, value *value) {
+void array_add_value(arena *arena, array *array, value *value) {
     if (array->size >= array->capacity) {
         array->capacity *= 2;
-        array->elements = realloc(
-            array->elements, array->capacity * sizeof(*value)
+        array->elements = json_realloc(
+            arena, array->elements, array->size * sizeof(*value),
+            array->capacity * sizeof(*value)
         );
     }
     array->elements[array->size++] = *value;
 }
 
 // add a member to an object
-void object_add_member(object *object, member *member) {
+void object_add_member(arena *arena, object *object, member *member) {
     if (object->size >= object->capacity) {
         object->capacity *= 2;
-        object->members = realloc(
-            object->members, object->capacity * sizeof(*member)
+        object->members = json_realloc(
+            arena, object->members, object->size * sizeof(*member),
+            object->capacity * sizeof(*member)
         );
     }
     object->members[object->size++] = *member;
@@ -391,20 +527,21 @@ void parse_elements(parser *parser, array *array) {
     }
     value value = {0};
     parse_value(parser, &value);
-    array_add_value(array, &value);
+    array_add_value(parser->arena, array, &value);
     while (parser_peek(parser).type == COMMA) {
         parser_advance(parser);
         parse_value(parser, &value);
-        array_add_value(array, &value);
+        array_add_value(parser->arena, array, &value);
     }
 }
 
 // parse member
 void parse_member(parser *parser, member *member) {
     token string = consume(parser, TOKEN_STRING, "expected string");
-    member->string = strdup(string.lexeme);
+    member->string = json_strdup(parser->arena, string.lexeme);
     consume(parser, COLON, "expected colon");
-    member->value = calloc(1, sizeof(value));
+    member->value = json_alloc(parser->arena, sizeof(value));
+    memset(member->value, 0, sizeof(value));
     parse_value(parser, member->value);
 }
 
@@ -415,11 +552,11 @@ void parse_members(parser *parser, object *object) {
     }
     member member = {0};
     parse_member(parser, &member);
-    object_add_member(object, &member);
+    object_add_member(parser->arena, object, &member);
     while (parser_peek(parser).type == COMMA) {
         parser_advance(parser);
         parse_member(parser, &member);
-        object_add_member(object, &member);
+        object_add_member(parser->arena, object, &member);
     }
 }
 
@@ -428,10 +565,13 @@ void parse_object(parser *parser, value *value) {
     value->type = OBJECT;
     value->object.capacity = 4;
     value->object.size = 0;
-    value->object.members = malloc(4 * sizeof(member));
+    value->object.members = json_alloc(parser->arena, 4 * sizeof(member));
     consume(parser, LEFT_BRACE, "expected left brace");
     parse_members(parser, &value->object);
     consume(parser, RIGHT_BRACE, "expected right brace");
+    for (int i = 0; i < value->object.size; i++) {
+        value->object.members[i].value->offset -= value->offset;
+    }
 }
 
 // parse array
@@ -439,16 +579,20 @@ void parse_array(parser *parser, value *value) {
     value->type = ARRAY;
     value->array.capacity = 4;
     value->array.size = 0;
-    value->array.elements = malloc(4 * sizeof(*value));
+    value->array.elements = json_alloc(parser->arena, 4 * sizeof(*value));
     consume(parser, LEFT_BRACKET, "expected left bracket");
     parse_elements(parser, &value->array);
     consume(parser, RIGHT_BRACKET, "expected right bracket");
+    for (int i = 0; i < value->array.size; i++) {
+        value->array.elements[i].offset -= value->offset;
+    }
 }
 
 // parse value
 void parse_value(parser *parser, value *value) {
     token token = parser_peek(parser);
     enum token_type type = token.type;
+    value->offset = token.start;
     switch (type) {
     case LEFT_BRACE:
         parse_object(parser, value);
@@ -459,12 +603,13 @@ void parse_value(parser *parser, value *value) {
     case TOKEN_STRING:
         parser_advance(parser);
         value->type = VALUE_STRING;
-        value->string = strdup(token.lexeme);
+        value->string = json_strdup(parser->arena, token.lexeme);
         break;
     case TOKEN_NUMBER:
         parser_advance(parser);
         value->type = VALUE_NUMBER;
         value->number = atof(token.lexeme);
+        value->lexeme = json_strdup(parser->arena, token.lexeme);
         break;
     case TOKEN_TRUE:
         parser_advance(parser);
@@ -479,9 +624,13 @@ void parse_value(parser *parser, value *value) {
         value->type = VALUE_NULL;
         break;
     default:
-        printf("unexpected token: %s\n", token.lexeme);
-        exit(1);
+        if (!parser->jump) {
+            printf("unexpected token: %s\n", token.lexeme);
+            exit(1);
+        }
+        parser_error(parser, token, "unexpected token");
     }
+    value->length = previous(parser).end - value->offset;
 }
 
 // free parser data
@@ -623,6 +772,9 @@ void free_value(value *value) {
     case VALUE_STRING:
         free(value->string);
         break;
+    case VALUE_NUMBER:
+        free(value->lexeme);
+        break;
     }
 }
 
@@ -631,6 +783,7 @@ void parse_json(const char *buffer, value *value) {
     scanner scanner = {
         .line = 1,
         .source = (char *) buffer,
+        .length = strlen(buffer),
         .capacity = 4,
         .tokens = malloc(4 * sizeof(token))
     };
@@ -640,9 +793,1445 @@ void parse_json(const char *buffer, value *value) {
     free_parser(&parser);
 }
 
+// reusable parser state: tokens and arena keep their grown size between documents
+typedef struct {
+    scanner scanner;
+    parser parser;
+    arena arena;
+    json_error error;
+    jmp_buf jump;
+} json_ctx;
+
+// initialize a parser context, keep one per thread
+void json_ctx_init(json_ctx *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->scanner.capacity = 4;
+    ctx->scanner.tokens = malloc(4 * sizeof(token));
+}
+
+// parse json string with a context, the value lives until the next call
+// return -1 and fill ctx->error on a syntax error
+int json_ctx_parse(json_ctx *ctx, const char *buffer, value *value) {
+    arena_reset(&ctx->arena);
+    scanner *scanner = &ctx->scanner;
+    scanner->start = 0;
+    scanner->current = 0;
+    scanner->line = 1;
+    scanner->size = 0;
+    scanner->source = (char *) buffer;
+    scanner->length = strlen(buffer);
+    scanner->arena = &ctx->arena;
+    scanner->error = &ctx->error;
+    scanner->jump = &ctx->jump;
+    ctx->parser = (parser){
+        .tokens = scanner->tokens,
+        .arena = &ctx->arena,
+        .error = &ctx->error,
+        .jump = &ctx->jump
+    };
+    if (setjmp(ctx->jump)) {
+        *value = (struct value){0};
+        return -1;
+    }
+    scan_tokens(scanner);
+    ctx->parser.tokens = scanner->tokens;
+    parse_value(&ctx->parser, value);
+    return 0;
+}
+
+// free a parser context and every value it produced
+void json_ctx_free(json_ctx *ctx) {
+    free(ctx->scanner.tokens);
+    arena_free(&ctx->arena);
+}
+
+// copy a value into malloc'd memory so it outlives the arena it was parsed into
+void value_clone(value *copy, value *value) {
+    *copy = *value;
+    switch (value->type) {
+    case ARRAY:
+        copy->array.capacity = value->array.size;
+        copy->array.elements = malloc((value->array.size ? value->array.size : 1) * sizeof(struct value));
+        for (int i = 0; i < value->array.size; i++) {
+            value_clone(&copy->array.elements[i], &value->array.elements[i]);
+        }
+        break;
+    case OBJECT:
+        copy->object.capacity = value->object.size;
+        copy->object.members = malloc((value->object.size ? value->object.size : 1) * sizeof(member));
+        for (int i = 0; i < value->object.size; i++) {
+            copy->object.members[i].string = strdup(value->object.members[i].string);
+            copy->object.members[i].value = malloc(sizeof(struct value));
+            value_clone(copy->object.members[i].value, value->object.members[i].value);
+        }
+        break;
+    case VALUE_STRING:
+        copy->string = strdup(value->string);
+        break;
+    case VALUE_NUMBER:
+        copy->lexeme = value->lexeme ? strdup(value->lexeme) : NULL;
+        break;
+    }
+}
+
+// parse source[0, size) as exactly one value with a context
+// return -1 and fill ctx->error on a syntax error or if tokens are left over
+int parse_region(json_ctx *ctx, const char *source, int size, value *value) {
+    char *region = substring((char *) source, 0, size);
+    struct value parsed;
+    int status = json_ctx_parse(ctx, region, &parsed);
+    if (!status && !parser_is_at_end(&ctx->parser)) {
+        token token = parser_peek(&ctx->parser);
+        ctx->error.line = token.line;
+        snprintf(ctx->error.msg, sizeof(ctx->error.msg), "at '%s': expect end of input", token.lexeme);
+        status = -1;
+    }
+    if (!status) {
+        value_clone(value, &parsed);
+    }
+    free(region);
+    return status;
+}
+
+// check that a container in source[start, end) closes exactly at its last character
+int region_balanced(const char *source, int start, int end) {
+    if (source[start] != '{' && source[start] != '[') {
+        return 1;
+    }
+    int depth = 0;
+    for (int i = start; i < end; i++) {
+        switch (source[i]) {
+        case '"':
+            while (++i < end && source[i] != '"');
+            if (i >= end) {
+                return 0;
+            }
+            break;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (--depth == 0 && i != end - 1) {
+                return 0;
+            }
+            break;
+        }
+    }
+    return depth == 0;
+}
+
+// number of children of a container
+int value_children(value *value) {
+    switch (value->type) {
+    case ARRAY:
+        return value->array.size;
+    case OBJECT:
+        return value->object.size;
+    default:
+        return 0;
+    }
+}
+
+// get a child of a container by index
+value *value_child(value *value, int i) {
+    if (value->type == ARRAY) {
+        return value->array.elements + i;
+    }
+    return value->object.members[i].value;
+}
+
+typedef struct {
+    value *node;
+    int start;      // absolute source offset of the node
+    int index;      // index of the node in its parent
+} reparse_frame;
+
+// re-parse the document after old bytes [start, end) were replaced by size bytes of source
+// reuses every subtree outside the smallest balanced container around the edit,
+// returns the number of bytes that were scanned again, or -1 with ctx->error filled
+// and root untouched if the edited document does not parse
+int reparse_json(json_ctx *ctx, value *root, const char *source, int start, int end, int size) {
+    int delta = size - (end - start);
+    int depth = 0;
+    int capacity = 16;
+    reparse_frame *path = malloc(capacity * sizeof(reparse_frame));
+    value *node = root;
+    int base = root->offset;
+    int index = 0;
+    // descend to the deepest node that strictly contains the edit
+    while (base < start && end < base + node->length) {
+        if (depth >= capacity) {
+            capacity *= 2;
+            path = realloc(path, capacity * sizeof(reparse_frame));
+        }
+        path[depth++] = (reparse_frame){ node, base, index };
+        int lo = 0;
+        int hi = value_children(node) - 1;
+        index = -1;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            if (base + value_child(node, mid)->offset <= start) {
+                index = mid;
+                lo = mid + 1;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        if (index < 0) {
+            break;
+        }
+        base += value_child(node, index)->offset;
+        node = value_child(node, index);
+    }
+    // re-scan from the innermost candidate outwards
+    for (int d = depth - 1; d >= 0; d--) {
+        value *node = path[d].node;
+        int nstart = path[d].start;
+        int nend = nstart + node->length + delta;
+        if (!region_balanced(source, nstart, nend)) {
+            continue;
+        }
+        value parsed = {0};
+        if (parse_region(ctx, source + nstart, nend - nstart, &parsed)) {
+            continue;
+        }
+        parsed.offset = node->offset;
+        free_value(node);
+        *node = parsed;
+        for (int k = d - 1; k >= 0; k--) {
+            value *parent = path[k].node;
+            int nchildren = value_children(parent);
+            for (int i = path[k + 1].index + 1; i < nchildren; i++) {
+                value_child(parent, i)->offset += delta;
+            }
+            parent->length += delta;
+        }
+        free(path);
+        return nend - nstart;
+    }
+    free(path);
+    value parsed = {0};
+    if (parse_region(ctx, source, strlen(source), &parsed)) {
+        return -1;
+    }
+    free_value(root);
+    *root = parsed;
+    return strlen(source);
+}
+
+/* sha-256 functions, see sha256/sha.c */
+#define ROTR(x, n) ((x >> n) | (x << (32 - n)))
+#define CH(x, y, z) ((x & y) ^ (~x & z))
+#define MAJ(x, y, z) ((x & y) ^ (x & z) ^ (y & z))
+#define S0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define s0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ (x >> 3))
+#define s1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ (x >> 10))
+
+// incremental sha-256 context: input is consumed one 64 byte block at a time
+typedef struct {
+    uint32_t H[8];
+    uint8_t block[64];
+    size_t used;
+    uint64_t length;
+} sha256_ctx;
+
+const uint32_t K[] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const uint32_t H0[] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+// initialize context
+void sha256_init(sha256_ctx *ctx) {
+    memcpy(ctx->H, H0, sizeof(H0));
+    ctx->used = 0;
+    ctx->length = 0;
+}
+
+// process one 64 byte block
+void sha256_block(sha256_ctx *ctx, const uint8_t *block) {
+    uint32_t W[64];
+    uint32_t a, b, c, d, e, f, g, h, T1, T2;
+    for (int t = 0; t < 16; t++) {
+        const uint8_t *p = block + 4 * t;
+        W[t] = (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    }
+    for (int t = 16; t < 64; t++) {
+        W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16];
+    }
+    a = ctx->H[0];
+    b = ctx->H[1];
+    c = ctx->H[2];
+    d = ctx->H[3];
+    e = ctx->H[4];
+    f = ctx->H[5];
+    g = ctx->H[6];
+    h = ctx->H[7];
+    for (int t = 0; t < 64; t++) {
+        T1 = h + S1(e) + CH(e, f, g) + K[t] + W[t];
+        T2 = S0(a) + MAJ(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + T1;
+        d = c;
+        c = b;
+        b = a;
+        a = T1 + T2;
+    }
+    ctx->H[0] += a;
+    ctx->H[1] += b;
+    ctx->H[2] += c;
+    ctx->H[3] += d;
+    ctx->H[4] += e;
+    ctx->H[5] += f;
+    ctx->H[6] += g;
+    ctx->H[7] += h;
+}
+
+// feed bytes into the context
+void sha256_update(sha256_ctx *ctx, const void *data, size_t size) {
+    const uint8_t *p = data;
+    ctx->length += size;
+    if (ctx->used) {
+        size_t n = 64 - ctx->used < size ? 64 - ctx->used : size;
+        memcpy(ctx->block + ctx->used, p, n);
+        ctx->used += n;
+        p += n;
+        size -= n;
+        if (ctx->used < 64) {
+            return;
+        }
+        sha256_block(ctx, ctx->block);
+        ctx->used = 0;
+    }
+    for (; size >= 64; p += 64, size -= 64) {
+        sha256_block(ctx, p);
+    }
+    memcpy(ctx->block, p, size);
+    ctx->used = size;
+}
+
+// pad the message and copy hash value into digest buffer
+void sha256_final(sha256_ctx *ctx, uint8_t *digest) {
+    uint64_t l = ctx->length * 8;
+    uint8_t pad[72] = { 0x80 };
+    size_t k = (ctx->used < 56 ? 56 : 120) - ctx->used;
+    for (int i = 0; i < 8; i++) {
+        pad[k + i] = l >> (56 - 8 * i);
+    }
+    sha256_update(ctx, pad, k + 8);
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 4; j++) {
+            digest[4 * i + j] = ctx->H[i] >> (24 - 8 * j);
+        }
+    }
+}
+
+// output of the canonical serializer: either a hash or a stream
+typedef struct {
+    sha256_ctx *sha;
+    FILE *file;
+} sink;
+
+// write bytes to the sink
+void sink_write(sink *sink, const char *s, size_t size) {
+    if (sink->sha) {
+        sha256_update(sink->sha, s, size);
+    }
+    if (sink->file) {
+        fwrite(s, 1, size, sink->file);
+    }
+}
+
+// write a string literal in quotes, escapes are kept as written in the source
+void canonical_string(sink *sink, const char *s) {
+    sink_write(sink, "\"", 1);
+    sink_write(sink, s, strlen(s));
+    sink_write(sink, "\"", 1);
+}
+
+// write a number from its source text, so numbers a float can't tell apart
+// still hash differently: the digits without leading or trailing zeros, no
+// sign on zero, and the exponent folded in the way javascript prints numbers
+void canonical_lexeme(sink *sink, const char *s) {
+    int negative = *s == '-';
+    s += *s == '-' || *s == '+';
+    char *digits = malloc(strlen(s) + 1);
+    int n = 0;
+    long point = 0;         // the number is 0.digits times 10 to the point
+    for (; isdigit(*s); s++) {
+        if (n || *s != '0') {
+            digits[n++] = *s;
+            point++;
+        }
+    }
+    if (*s == '.') {
+        for (s++; isdigit(*s); s++) {
+            if (n || *s != '0') {
+                digits[n++] = *s;
+            } else {
+                point--;
+            }
+        }
+    }
+    if (*s == 'e' || *s == 'E') {
+        s++;
+        int eneg = *s == '-';
+        s += *s == '-' || *s == '+';
+        long exponent = 0;
+        for (; isdigit(*s); s++) {
+            if (exponent < 1000000000) {
+                exponent = exponent * 10 + *s - '0';
+            }
+        }
+        point += eneg ? -exponent : exponent;
+    }
+    while (n && digits[n - 1] == '0') {
+        n--;
+    }
+    char *out = malloc(n + 48);
+    int size = 0;
+    if (!n) {
+        out[size++] = '0';
+    } else {
+        if (negative) {
+            out[size++] = '-';
+        }
+        if (n <= point && point <= 21) {            // integer
+            memcpy(out + size, digits, n);
+            size += n;
+            for (long i = n; i < point; i++) {
+                out[size++] = '0';
+            }
+        } else if (0 < point && point < n) {        // point inside the digits
+            memcpy(out + size, digits, point);
+            size += point;
+            out[size++] = '.';
+            memcpy(out + size, digits + point, n - point);
+            size += n - point;
+        } else if (-6 < point && point <= 0) {      // zeros after the point
+            out[size++] = '0';
+            out[size++] = '.';
+            for (long i = point; i < 0; i++) {
+                out[size++] = '0';
+            }
+            memcpy(out + size, digits, n);
+            size += n;
+        } else {
+            out[size++] = digits[0];
+            if (n > 1) {
+                out[size++] = '.';
+                memcpy(out + size, digits + 1, n - 1);
+                size += n - 1;
+            }
+            size += sprintf(out + size, "e%+ld", point - 1);
+        }
+    }
+    sink_write(sink, out, size);
+    free(out);
+    free(digits);
+}
+
+// write a number: from its source text when it has one, otherwise integers
+// without fraction and the rest with enough digits to round trip
+void canonical_number(sink *sink, value *value) {
+    if (value->lexeme) {
+        canonical_lexeme(sink, value->lexeme);
+        return;
+    }
+    float number = value->number;
+    char numstr[32];
+    int size;
+    if (number == 0) {
+        size = sprintf(numstr, "0");
+    } else if (number > -1e18 && number < 1e18 && number == (long long) number) {
+        size = sprintf(numstr, "%lld", (long long) number);
+    } else {
+        size = sprintf(numstr, "%.9g", number);
+    }
+    sink_write(sink, numstr, size);
+}
+
+// compare members by key bytes, equal keys keep their source order
+int member_compare(const void *a, const void *b) {
+    const member *ma = *(const member **) a;
+    const member *mb = *(const member **) b;
+    int cmp = strcmp(ma->string, mb->string);
+    if (cmp) {
+        return cmp;
+    }
+    return (ma > mb) - (ma < mb);
+}
+
+// write value in canonical form: no whitespace, sorted keys, normalized numbers
+void canonical_value(sink *sink, value *value) {
+    switch (value->type) {
+    case ARRAY:
+        sink_write(sink, "[", 1);
+        for (int i = 0; i < value->array.size; i++) {
+            if (i > 0) {
+                sink_write(sink, ",", 1);
+            }
+            canonical_value(sink, value->array.elements + i);
+        }
+        sink_write(sink, "]", 1);
+        break;
+    case OBJECT:
+        object *object = &value->object;
+        member **sorted = malloc(object->size * sizeof(member *));
+        for (int i = 0; i < object->size; i++) {
+            sorted[i] = object->members + i;
+        }
+        qsort(sorted, object->size, sizeof(member *), member_compare);
+        sink_write(sink, "{", 1);
+        for (int i = 0; i < object->size; i++) {
+            if (i > 0) {
+                sink_write(sink, ",", 1);
+            }
+            canonical_string(sink, sorted[i]->string);
+            sink_write(sink, ":", 1);
+            canonical_value(sink, sorted[i]->value);
+        }
+        sink_write(sink, "}", 1);
+        free(sorted);
+        break;
+    case VALUE_NUMBER:
+        canonical_number(sink, value);
+        break;
+    case VALUE_STRING:
+        canonical_string(sink, value->string);
+        break;
+    case VALUE_FALSE:
+        sink_write(sink, "false", 5);
+        break;
+    case VALUE_TRUE:
+        sink_write(sink, "true", 4);
+        break;
+    case VALUE_NULL:
+        sink_write(sink, "null", 4);
+        break;
+    }
+}
+
+// compute the fingerprint of a document: sha-256 of its canonical form
+void value_hash(value *value, uint8_t *digest) {
+    sha256_ctx sha;
+    sha256_init(&sha);
+    sink sink = { .sha = &sha };
+    canonical_value(&sink, value);
+    sha256_final(&sha, digest);
+}
+
+// print digest value
+void digest_print(uint8_t *digest) {
+    for (int i = 0; i < 32; i++) {
+        printf("%02x", digest[i]);
+    }
+    putchar('\n');
+}
+
+enum column_type {
+    COLUMN_NULL, COLUMN_INT,
+    COLUMN_DOUBLE, COLUMN_STRING,
+    COLUMN_BOOL
+};
+
+const char *column_types[] = { "null", "int64", "double", "string", "bool" };
+
+// one field of a record array stored as a contiguous column
+typedef struct {
+    int type;
+    char *name;
+    uint8_t *validity;  // bit per row, set when the row has a value
+    int64_t *ints;
+    double *doubles;
+    uint8_t *bools;     // bit per row
+    int32_t *offsets;   // string i is data[offsets[i], offsets[i + 1])
+    char *data;
+    int datasize;
+    int datacapacity;
+} column;
+
+// struct of arrays view of a homogeneous record array
+typedef struct {
+    int nrows;
+    int capacity;       // rows allocated in every column
+    int ncolumns;
+    int columncapacity;
+    column *columns;
+} table;
+
+// grow an array to a new number of elements and zero the new part
+void *grow_zeroed(void *ptr, size_t oldsize, size_t newsize) {
+    ptr = realloc(ptr, newsize);
+    memset((char *) ptr + oldsize, 0, newsize - oldsize);
+    return ptr;
+}
+
+// resize the row storage of a column
+void column_resize(column *column, int oldcap, int newcap) {
+    column->validity = grow_zeroed(column->validity, (oldcap + 7) / 8, (newcap + 7) / 8);
+    switch (column->type) {
+    case COLUMN_INT:
+        column->ints = grow_zeroed(
+            column->ints, oldcap * sizeof(int64_t), newcap * sizeof(int64_t)
+        );
+        break;
+    case COLUMN_DOUBLE:
+        column->doubles = grow_zeroed(
+            column->doubles, oldcap * sizeof(double), newcap * sizeof(double)
+        );
+        break;
+    case COLUMN_STRING:
+        column->offsets = grow_zeroed(
+            column->offsets, (oldcap + 1) * sizeof(int32_t),
+            (newcap + 1) * sizeof(int32_t)
+        );
+        break;
+    case COLUMN_BOOL:
+        column->bools = grow_zeroed(column->bools, (oldcap + 7) / 8, (newcap + 7) / 8);
+        break;
+    }
+}
+
+// give a column of nulls its first type
+void column_set_type(column *column, int type, int nrows, int capacity) {
+    column->type = type;
+    column_resize(column, 0, capacity);
+    if (type == COLUMN_STRING) {
+        for (int i = 0; i <= nrows; i++) {
+            column->offsets[i] = column->datasize;
+        }
+    }
+}
+
+// find or create the column for a member name, hint is its expected position
+column *table_column(table *table, const char *name, int hint) {
+    if (hint < table->ncolumns && !strcmp(table->columns[hint].name, name)) {
+        return table->columns + hint;
+    }
+    for (int i = 0; i < table->ncolumns; i++) {
+        if (!strcmp(table->columns[i].name, name)) {
+            return table->columns + i;
+        }
+    }
+    if (table->ncolumns >= table->columncapacity) {
+        table->columncapacity = table->columncapacity ? 2 * table->columncapacity : 4;
+        table->columns = realloc(
+            table->columns, table->columncapacity * sizeof(column)
+        );
+    }
+    column *column = table->columns + table->ncolumns++;
+    memset(column, 0, sizeof(*column));
+    column->name = strdup(name);
+    column_resize(column, 0, table->capacity);
+    return column;
+}
+
+// start a new row, return its index
+int table_row(table *table) {
+    if (table->nrows >= table->capacity) {
+        int capacity = table->capacity ? 2 * table->capacity : 64;
+        for (int i = 0; i < table->ncolumns; i++) {
+            column_resize(table->columns + i, table->capacity, capacity);
+        }
+        table->capacity = capacity;
+    }
+    return table->nrows++;
+}
+
+// close a row: rows without a string get an empty range
+void table_end_row(table *table, int row) {
+    for (int i = 0; i < table->ncolumns; i++) {
+        column *column = table->columns + i;
+        if (column->type == COLUMN_STRING) {
+            column->offsets[row + 1] = column->datasize;
+        }
+    }
+}
+
+// report a column type conflict
+int column_error(column *column, const char *type) {
+    fprintf(stderr, "column %s: expected %s, got %s\n",
+        column->name, column_types[column->type], type);
+    return -1;
+}
+
+// store a number, integers are promoted to doubles on the first fraction
+int column_number(table *table, column *column, int row, double number, int integral) {
+    if (column->type == COLUMN_NULL) {
+        int type = integral ? COLUMN_INT : COLUMN_DOUBLE;
+        column_set_type(column, type, table->nrows, table->capacity);
+    }
+    if (column->type == COLUMN_INT && !integral) {
+        column->doubles = malloc(table->capacity * sizeof(double));
+        for (int i = 0; i < table->capacity; i++) {
+            column->doubles[i] = column->ints[i];
+        }
+        free(column->ints);
+        column->ints = NULL;
+        column->type = COLUMN_DOUBLE;
+    }
+    if (column->type == COLUMN_INT) {
+        column->ints[row] = number;
+    } else if (column->type == COLUMN_DOUBLE) {
+        column->doubles[row] = number;
+    } else {
+        return column_error(column, "number");
+    }
+    column->validity[row >> 3] |= 1 << (row & 7);
+    return 0;
+}
+
+// append a string to the data buffer of the column
+int column_string(table *table, column *column, int row, const char *s) {
+    if (column->type == COLUMN_NULL) {
+        column_set_type(column, COLUMN_STRING, table->nrows, table->capacity);
+    }
+    if (column->type != COLUMN_STRING) {
+        return column_error(column, "string");
+    }
+    int size = strlen(s);
+    if (column->datasize + size > column->datacapacity) {
+        column->datacapacity = 2 * (column->datasize + size);
+        column->data = realloc(column->data, column->datacapacity);
+    }
+    memcpy(column->data + column->datasize, s, size);
+    column->datasize += size;
+    column->validity[row >> 3] |= 1 << (row & 7);
+    return 0;
+}
+
+// store a boolean as a bit
+int column_bool(table *table, column *column, int row, int b) {
+    if (column->type == COLUMN_NULL) {
+        column_set_type(column, COLUMN_BOOL, table->nrows, table->capacity);
+    }
+    if (column->type != COLUMN_BOOL) {
+        return column_error(column, "bool");
+    }
+    if (b) {
+        column->bools[row >> 3] |= 1 << (row & 7);
+    }
+    column->validity[row >> 3] |= 1 << (row & 7);
+    return 0;
+}
+
+// store a parsed value in a column
+int column_value(table *table, column *column, int row, value *value) {
+    switch (value->type) {
+    case VALUE_NUMBER:
+        double number = value->number;
+        return column_number(table, column, row, number, number == (int64_t) number);
+    case VALUE_STRING:
+        return column_string(table, column, row, value->string);
+    case VALUE_TRUE:
+    case VALUE_FALSE:
+        return column_bool(table, column, row, value->type == VALUE_TRUE);
+    case VALUE_NULL:
+        return 0;
+    default:
+        return column_error(column, "nested value");
+    }
+}
+
+// store a token in a column without building a value
+int column_token(table *table, column *column, int row, token token) {
+    switch (token.type) {
+    case TOKEN_NUMBER:
+        if (strchr(token.lexeme, '.')) {
+            return column_number(table, column, row, strtod(token.lexeme, NULL), 0);
+        }
+        return column_number(table, column, row, strtoll(token.lexeme, NULL, 10), 1);
+    case TOKEN_STRING:
+        return column_string(table, column, row, token.lexeme);
+    case TOKEN_TRUE:
+    case TOKEN_FALSE:
+        return column_bool(table, column, row, token.type == TOKEN_TRUE);
+    case TOKEN_NULL:
+        return 0;
+    default:
+        return column_error(column, "nested value");
+    }
+}
+
+// extract columns from an array of objects
+int table_from_array(array *array, table *table) {
+    for (int i = 0; i < array->size; i++) {
+        value *record = array->elements + i;
+        if (record->type != OBJECT) {
+            fprintf(stderr, "element %d is not an object\n", i);
+            return -1;
+        }
+        int row = table_row(table);
+        for (int j = 0; j < record->object.size; j++) {
+            member *member = record->object.members + j;
+            column *column = table_column(table, member->string, j);
+            if (column_value(table, column, row, member->value)) {
+                return -1;
+            }
+        }
+        table_end_row(table, row);
+    }
+    return 0;
+}
+
+// extract columns straight from the tokens of a record array
+int table_from_source(const char *buffer, table *table) {
+    scanner scanner = {
+        .line = 1,
+        .source = (char *) buffer,
+        .length = strlen(buffer),
+        .capacity = 4,
+        .tokens = malloc(4 * sizeof(token))
+    };
+    scan_tokens(&scanner);
+    parser parser = {.tokens = scanner.tokens};
+    int status = 0;
+    consume(&parser, LEFT_BRACKET, "expected left bracket");
+    while (!status && parser_peek(&parser).type != RIGHT_BRACKET) {
+        if (table->nrows > 0) {
+            consume(&parser, COMMA, "expected comma");
+        }
+        consume(&parser, LEFT_BRACE, "expected left brace");
+        int row = table_row(table);
+        for (int i = 0; !status && parser_peek(&parser).type != RIGHT_BRACE; i++) {
+            if (i > 0) {
+                consume(&parser, COMMA, "expected comma");
+            }
+            token key = consume(&parser, TOKEN_STRING, "expected string");
+            consume(&parser, COLON, "expected colon");
+            column *column = table_column(table, key.lexeme, i);
+            status = column_token(table, column, row, parser_advance(&parser));
+        }
+        if (!status) {
+            consume(&parser, RIGHT_BRACE, "expected right brace");
+            table_end_row(table, row);
+        }
+    }
+    if (!status) {
+        consume(&parser, RIGHT_BRACKET, "expected right bracket");
+    }
+    for (int i = 0; i < scanner.size; i++) {
+        free(scanner.tokens[i].lexeme);
+    }
+    free(scanner.tokens);
+    return status;
+}
+
+// print column types with a null count and a plain aggregate per column
+void table_print(table *table) {
+    printf("%d rows\n", table->nrows);
+    for (int i = 0; i < table->ncolumns; i++) {
+        column *column = table->columns + i;
+        int valid = 0;
+        for (int j = 0; j < table->nrows; j++) {
+            valid += (column->validity[j >> 3] >> (j & 7)) & 1;
+        }
+        printf("%-16s %-8s %8d valid", column->name, column_types[column->type], valid);
+        if (column->type == COLUMN_INT) {
+            int64_t sum = 0;
+            for (int j = 0; j < table->nrows; j++) {
+                sum += column->ints[j];
+            }
+            printf("  sum %lld", (long long) sum);
+        } else if (column->type == COLUMN_DOUBLE) {
+            double sum = 0;
+            for (int j = 0; j < table->nrows; j++) {
+                sum += column->doubles[j];
+            }
+            printf("  sum %g", sum);
+        } else if (column->type == COLUMN_STRING) {
+            printf("  %d bytes", column->datasize);
+        }
+        putchar('\n');
+    }
+}
+
+// free column data
+void free_table(table *table) {
+    for (int i = 0; i < table->ncolumns; i++) {
+        column *column = table->columns + i;
+        free(column->name);
+        free(column->validity);
+        free(column->ints);
+        free(column->doubles);
+        free(column->bools);
+        free(column->offsets);
+        free(column->data);
+    }
+    free(table->columns);
+}
+
+#define batch_depth 64  // files kept in flight by the io_uring reader
+
+enum batch_stage { BATCH_OPEN, BATCH_STATX, BATCH_READ, BATCH_CLOSE };
+
+typedef struct {
+    const char *path;
+    char *buffer;
+    int fd;
+    int size;
+    int done;       // bytes read so far
+    int pending;    // open and statx completions still outstanding
+    int status;     // errno of the failed step, -1 on a syntax error, 0 on success
+    json_error error;
+    struct statx stx;
+} batch_file;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int head;
+    int tail;
+    int closed;
+    int *items;
+} batch_queue;
+
+typedef struct {
+    int nfiles;
+    int next;       // next file to be picked up by a fallback worker
+    int inflight;
+    int finished;
+    pthread_mutex_t lock;
+    batch_file *files;
+    batch_queue queue;  // files that are read and ready to be parsed
+} batch;
+
+// get wall clock time in seconds
+double batch_time(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// push a file index into the queue and wake up a worker
+void queue_push(batch_queue *queue, int item) {
+    pthread_mutex_lock(&queue->lock);
+    queue->items[queue->tail++] = item;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// pop a file index from the queue, return -1 when the queue is drained
+int queue_pop(batch_queue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->head == queue->tail && !queue->closed) {
+        pthread_cond_wait(&queue->cond, &queue->lock);
+    }
+    int item = -1;
+    if (queue->head < queue->tail) {
+        item = queue->items[queue->head++];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return item;
+}
+
+// tell workers that no more items are coming
+void queue_close(batch_queue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// parse a file that has been read into memory
+void batch_parse(batch_file *file, json_ctx *ctx) {
+    value value;
+    if (json_ctx_parse(ctx, file->buffer, &value)) {
+        file->status = -1;
+        file->error = ctx->error;
+    }
+    free(file->buffer);
+    file->buffer = NULL;
+}
+
+// parse worker: parse buffers as soon as their reads complete
+void *batch_parser(void *arg) {
+    batch *batch = arg;
+    json_ctx ctx;
+    json_ctx_init(&ctx);
+    int i;
+    while ((i = queue_pop(&batch->queue)) != -1) {
+        batch_parse(batch->files + i, &ctx);
+    }
+    json_ctx_free(&ctx);
+    return NULL;
+}
+
+// read the whole file with plain syscalls, return -1 and set errno on failure
+int batch_read(batch_file *file) {
+    struct stat st;
+    int fd = open(file->path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+    file->size = st.st_size;
+    file->buffer = malloc(file->size + 1);
+    while (file->done < file->size) {
+        ssize_t n = read(fd, file->buffer + file->done, file->size - file->done);
+        if (n < 0) {
+            int error = errno;
+            free(file->buffer);
+            file->buffer = NULL;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        if (!n) {
+            break;
+        }
+        file->done += n;
+    }
+    file->buffer[file->done] = 0;
+    close(fd);
+    return 0;
+}
+
+// fallback worker: read and parse files with regular syscalls
+void *batch_worker(void *arg) {
+    batch *batch = arg;
+    json_ctx ctx;
+    json_ctx_init(&ctx);
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        int i = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+        if (i >= batch->nfiles) {
+            break;
+        }
+        batch_file *file = batch->files + i;
+        if (batch_read(file)) {
+            file->status = errno;
+            continue;
+        }
+        batch_parse(file, &ctx);
+    }
+    json_ctx_free(&ctx);
+    return NULL;
+}
+
+#ifdef __linux__
+typedef struct {
+    int fd;
+    unsigned queued;    // entries filled but not submitted yet
+    unsigned *sqhead;
+    unsigned *sqtail;
+    unsigned *sqmask;
+    unsigned *sqarray;
+    unsigned *cqhead;
+    unsigned *cqtail;
+    unsigned *cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqmap;
+    void *cqmap;
+    size_t sqmapsize;
+    size_t cqmapsize;
+    size_t sqesize;
+} uring;
+
+// set up an io_uring instance, return -1 if the kernel can't do it
+int uring_init(uring *ring, unsigned entries) {
+    struct io_uring_params params = {0};
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+    // openat, statx and close need 5.6, which is also when this feature appeared
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring->fd);
+        return -1;
+    }
+    ring->queued = 0;
+    ring->sqmapsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqmapsize = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cqmapsize > ring->sqmapsize) {
+        ring->sqmapsize = ring->cqmapsize;
+    }
+    ring->sqmap = mmap(NULL, ring->sqmapsize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cqmap = single ? ring->sqmap : mmap(NULL, ring->cqmapsize,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_CQ_RING);
+    ring->sqesize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqmap == MAP_FAILED || ring->cqmap == MAP_FAILED ||
+        ring->sqes == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    char *sq = ring->sqmap;
+    char *cq = ring->cqmap;
+    ring->sqhead = (unsigned *) (sq + params.sq_off.head);
+    ring->sqtail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sqmask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sqarray = (unsigned *) (sq + params.sq_off.array);
+    ring->cqhead = (unsigned *) (cq + params.cq_off.head);
+    ring->cqtail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cqmask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return 0;
+}
+
+// get the next free submission queue entry
+struct io_uring_sqe *uring_sqe(uring *ring, int opcode, int fd, __u64 key) {
+    unsigned index = (*ring->sqtail + ring->queued++) & *ring->sqmask;
+    struct io_uring_sqe *sqe = ring->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = key;
+    ring->sqarray[index] = index;
+    return sqe;
+}
+
+// submit queued entries and wait for at least one completion
+int uring_submit(uring *ring) {
+    __atomic_store_n(ring->sqtail, *ring->sqtail + ring->queued, __ATOMIC_RELEASE);
+    int n = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1,
+        IORING_ENTER_GETEVENTS, NULL, 0);
+    ring->queued = 0;
+    return n;
+}
+
+// take the next completion, return 0 if there is none
+int uring_cqe(uring *ring, struct io_uring_cqe *cqe) {
+    unsigned head = *ring->cqhead;
+    if (head == __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    *cqe = ring->cqes[head & *ring->cqmask];
+    __atomic_store_n(ring->cqhead, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// release the io_uring instance
+void uring_free(uring *ring) {
+    munmap(ring->sqes, ring->sqesize);
+    if (ring->cqmap != ring->sqmap) {
+        munmap(ring->cqmap, ring->cqmapsize);
+    }
+    munmap(ring->sqmap, ring->sqmapsize);
+    close(ring->fd);
+}
+
+#define uring_key(i, stage) ((__u64) (i) << 2 | (stage))
+
+// queue a read of the rest of the file
+void uring_read(uring *ring, batch_file *file, int i) {
+    struct io_uring_sqe *sqe = uring_sqe(
+        ring, IORING_OP_READ, file->fd, uring_key(i, BATCH_READ)
+    );
+    sqe->addr = (unsigned long) (file->buffer + file->done);
+    sqe->len = file->size - file->done;
+    sqe->off = file->done;
+}
+
+// queue closing of the file, or retire it if it was never opened
+void uring_close(uring *ring, batch *batch, batch_file *file, int i) {
+    if (file->fd < 0) {
+        batch->inflight--;
+        batch->finished++;
+        return;
+    }
+    uring_sqe(ring, IORING_OP_CLOSE, file->fd, uring_key(i, BATCH_CLOSE));
+}
+
+// advance the file to its next stage after a completion
+void uring_complete(uring *ring, batch *batch, struct io_uring_cqe *cqe) {
+    int i = cqe->user_data >> 2;
+    batch_file *file = batch->files + i;
+    int res = cqe->res;
+    switch (cqe->user_data & 3) {
+    case BATCH_OPEN:
+    case BATCH_STATX:
+        if (res < 0) {
+            file->status = -res;
+        } else if ((cqe->user_data & 3) == BATCH_OPEN) {
+            file->fd = res;
+        }
+        if (--file->pending) {
+            break;
+        }
+        if (file->status) {
+            uring_close(ring, batch, file, i);
+            break;
+        }
+        file->size = file->stx.stx_size;
+        file->buffer = malloc(file->size + 1);
+        uring_read(ring, file, i);
+        break;
+    case BATCH_READ:
+        if (res < 0) {
+            file->status = -res;
+            free(file->buffer);
+            file->buffer = NULL;
+            uring_close(ring, batch, file, i);
+            break;
+        }
+        file->done += res;
+        if (res > 0 && file->done < file->size) {
+            uring_read(ring, file, i);
+            break;
+        }
+        file->buffer[file->done] = 0;
+        queue_push(&batch->queue, i);
+        uring_close(ring, batch, file, i);
+        break;
+    case BATCH_CLOSE:
+        file->fd = -1;
+        batch->inflight--;
+        batch->finished++;
+        break;
+    }
+}
+
+// read files through io_uring and hand finished buffers to the parse workers
+void batch_uring(batch *batch, uring *ring) {
+    int next = 0;
+    while (batch->finished < batch->nfiles) {
+        while (batch->inflight < batch_depth && next < batch->nfiles) {
+            batch_file *file = batch->files + next;
+            struct io_uring_sqe *sqe = uring_sqe(
+                ring, IORING_OP_OPENAT, AT_FDCWD, uring_key(next, BATCH_OPEN)
+            );
+            sqe->addr = (unsigned long) file->path;
+            sqe->open_flags = O_RDONLY;
+            sqe = uring_sqe(
+                ring, IORING_OP_STATX, AT_FDCWD, uring_key(next, BATCH_STATX)
+            );
+            sqe->addr = (unsigned long) file->path;
+            sqe->len = STATX_SIZE;
+            sqe->off = (unsigned long) &file->stx;
+            file->pending = 2;
+            batch->inflight++;
+            next++;
+        }
+        if (uring_submit(ring) < 0) {
+            perror("io_uring_enter");
+            exit(1);
+        }
+        struct io_uring_cqe cqe;
+        while (uring_cqe(ring, &cqe)) {
+            uring_complete(ring, batch, &cqe);
+        }
+    }
+}
+#endif
+
+// validate a batch of json files, overlapping reads with parsing
+int batch_validate(int nfiles, char **paths) {
+    batch batch = {
+        .nfiles = nfiles,
+        .files = calloc(nfiles, sizeof(batch_file)),
+        .queue = { .items = malloc(nfiles * sizeof(int)) }
+    };
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_mutex_init(&batch.queue.lock, NULL);
+    pthread_cond_init(&batch.queue.cond, NULL);
+    for (int i = 0; i < nfiles; i++) {
+        batch.files[i].path = paths[i];
+        batch.files[i].fd = -1;
+    }
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    const char *mode = "threads";
+    double start = batch_time();
+#ifdef __linux__
+    uring ring;
+    if (!uring_init(&ring, 2 * batch_depth)) {
+        mode = "io_uring";
+        for (int i = 0; i < nthreads; i++) {
+            pthread_create(threads + i, NULL, batch_parser, &batch);
+        }
+        batch_uring(&batch, &ring);
+        queue_close(&batch.queue);
+        for (int i = 0; i < nthreads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        uring_free(&ring);
+    } else
+#endif
+    {
+        for (int i = 0; i < nthreads; i++) {
+            pthread_create(threads + i, NULL, batch_worker, &batch);
+        }
+        for (int i = 0; i < nthreads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    double elapsed = batch_time() - start;
+    int failed = 0;
+    double bytes = 0;
+    for (int i = 0; i < nfiles; i++) {
+        batch_file *file = batch.files + i;
+        if (file->status < 0) {
+            fprintf(stderr, "%s: [line %d]: %s\n",
+                file->path, file->error.line, file->error.msg);
+            failed++;
+        } else if (file->status) {
+            fprintf(stderr, "%s: %s\n", file->path, strerror(file->status));
+            failed++;
+        } else {
+            bytes += file->size;
+        }
+    }
+    printf("%d files, %d failed, %.2f MB in %.3f s (%s)\n",
+        nfiles, failed, bytes / (1 << 20), elapsed, mode);
+    free(threads);
+    free(batch.queue.items);
+    free(batch.files);
+    return failed > 0;
+}
+
+// read newline separated paths from the standard input
+char **batch_paths(int *npaths) {
+    int capacity = 64;
+    char **paths = malloc(capacity * sizeof(char *));
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t n;
+    *npaths = 0;
+    while ((n = getline(&line, &size, stdin)) > 0) {
+        if (line[n - 1] == '\n') {
+            line[--n] = 0;
+        }
+        if (!n) {
+            continue;
+        }
+        if (*npaths >= capacity) {
+            capacity *= 2;
+            paths = realloc(paths, capacity * sizeof(char *));
+        }
+        paths[(*npaths)++] = strdup(line);
+    }
+    free(line);
+    return paths;
+}
+
 int main(int argc, char **argv) {
+    if (argc >= 3 && !strcmp(argv[1], "-batch")) {
+        if (!strcmp(argv[2], "-")) {
+            int npaths = 0;
+            char **paths = batch_paths(&npaths);
+            int status = batch_validate(npaths, paths);
+            for (int i = 0; i < npaths; i++) {
+                free(paths[i]);
+            }
+            free(paths);
+            return status;
+        }
+        return batch_validate(argc - 2, argv + 2);
+    }
+    if (argc == 3 && (!strcmp(argv[1], "-hash") || !strcmp(argv[1], "-canon"))) {
+        char *source = file_read(argv[2]);
+        if (!source) {
+            return 1;
+        }
+        value value = {0};
+        parse_json(source, &value);
+        if (!strcmp(argv[1], "-hash")) {
+            uint8_t digest[32];
+            value_hash(&value, digest);
+            digest_print(digest);
+        } else {
+            sink sink = { .file = stdout };
+            canonical_value(&sink, &value);
+            putchar('\n');
+        }
+        free_value(&value);
+        free(source);
+        return 0;
+    }
+    if (argc == 6 && !strcmp(argv[1], "-edit")) {
+        char *source = file_read(argv[2]);
+        if (!source) {
+            return 1;
+        }
+        int start = atoi(argv[3]);
+        int end = atoi(argv[4]);
+        int length = strlen(source);
+        if (start < 0 || end < start || end > length) {
+            fprintf(stderr, "invalid edit range\n");
+            return 1;
+        }
+        value value = {0};
+        parse_json(source, &value);
+        int size = strlen(argv[5]);
+        char *edited = malloc(length - (end - start) + size + 1);
+        memcpy(edited, source, start);
+        memcpy(edited + start, argv[5], size);
+        strcpy(edited + start + size, source + end);
+        json_ctx ctx;
+        json_ctx_init(&ctx);
+        int scanned = reparse_json(&ctx, &value, edited, start, end, size);
+        if (scanned < 0) {
+            fprintf(stderr, "[line %d]: %s, keeping the previous tree\n", ctx.error.line, ctx.error.msg);
+        } else {
+            fprintf(stderr, "re-scanned %d of %d bytes\n", scanned, (int) strlen(edited));
+        }
+        json_ctx_free(&ctx);
+        sink sink = { .file = stdout };
+        canonical_value(&sink, &value);
+        putchar('\n');
+        free_value(&value);
+        free(edited);
+        free(source);
+        return 0;
+    }
+    if (argc == 3 && !strcmp(argv[1], "-columns")) {
+        char *source = file_read(argv[2]);
+        if (!source) {
+            return 1;
+        }
+        table table = {0};
+        int status = table_from_source(source, &table);
+        if (!status) {
+            table_print(&table);
+        }
+        free_table(&table);
+        free(source);
+        return status ? 1 : 0;
+    }
     if (argc != 2) {
         printf("usage: %s [file.json]\n", argv[0]);
+        printf("       %s -batch [file.json ...] (or - to read paths from stdin)\n", argv[0]);
+        printf("       %s -hash|-canon [file.json]\n", argv[0]);
+        printf("       %s -edit [file.json] [start] [end] [text]\n", argv[0]);
+        printf("       %s -columns [file.json]\n", argv[0]);
         return 1;
     }
     char *source = file_read(argv[1]);
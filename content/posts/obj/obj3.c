@@ -1,12 +1,31 @@
 #include <stdio.h>
+#include <stdint.h>
+#include <float.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#if defined(__SHA__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
 
-const char *objkeys[] = {
-    "f", "mtllib", "o", "usemtl", "v", "vn", "vt"
-};
+enum objkeysenum { F, MTLLIB, O, S, USEMTL, V, VN, VT };
+
+enum qformatenum { QNONE, QHALF, QSNORM };
 
-enum objkeysenum { F, MTLLIB, O, USEMTL, V, VN, VT };
+enum formatenum { FBIN, FGLTF };
+
+const char *qformats[] = { "float", "half", "snorm16" };
 
 const char *mtlkeys[] = {
     "Ka", "Kd", "Ke", "Ks", 
@@ -46,10 +65,52 @@ typedef struct {
 
 typedef struct {
     int  nmaterials;
+    int  capmaterials;
     mtl  *materials;
     char *filename;
+    int  nlibraries;    // paths of every mtl file read, in order
+    char **libraries;
+    int  nhashed;       // materials already in the name lookup table
+    int  capbuckets;
+    int  *buckets;      // open addressing, material index or -1
+    int  *textures;     // texture handles of the maps of each material, 0 for none
 } mtlctx;
 
+// the vertex buffer as one plane per component, each 64 byte aligned
+typedef struct {
+    int    count;
+    size_t stride;      // floats from one plane to the next, a multiple of 16
+    float  *data;
+    float  *x, *y, *z;
+    float  *u, *v;
+    float  *nx, *ny, *nz;
+} objsoa;
+
+// a cluster of at most meshlet_vertices vertices and meshlet_triangles triangles
+// for culling: a bounding sphere, and a normal cone that has every triangle
+// facing away from an eye where dot(normalize(apex - eye), axis) >= cutoff
+typedef struct {
+    uint32_t vertexoffset;      // first entry in meshletvertices
+    uint32_t triangleoffset;    // first byte in meshlettriangles
+    uint32_t nvertices;
+    uint32_t ntriangles;
+    float    center[3];
+    float    radius;
+    float    axis[3];
+    float    cutoff;
+    float    apex[3];
+    int32_t  mesh;              // -1 for the faces before the first o
+} objmeshlet;
+
+// one material bound for a contiguous range of face vertices
+typedef struct {
+    int material;       // index into the materials, -1 for none
+    int offset;         // first face vertex
+    int count;
+    int mesh;           // first of the meshes drawn by the range
+    int nmeshes;
+} objdraw;
+
 typedef struct {
     int nmeshes;
     int nvertices;
@@ -57,6 +118,13 @@ typedef struct {
     int ntexcoords;
     int nfaces;
     int nfaceverts;
+    int capmeshes;      // capacities of the growable arrays below
+    int capvertices;
+    int capnormals;
+    int captexcoords;
+    int capfaceverts;
+    int nunique;        // welded vertices of the indexed buffer
+    int indexsize;      // 2 or 4 bytes per index, 0 for the expanded buffer
     int *faces;
     int *meshoffsets;
     int *mtlindices;
@@ -64,363 +132,4001 @@ typedef struct {
     float *normals;
     float *texcoords;
     float *buffer;
+    float acmr[2];      // vertex cache stats before and after optimizing, 0 if not done
+    float atvr[2];
+    float *vbuffer;     // unique interleaved vertices, indexed by indices
+    void  *indices;
+    int   qformat;      // position format of qbuffer, QNONE if not quantized
+    uint16_t *qbuffer;  // 8 shorts per vertex: position and w, unorm16 uv, octahedral normal
+    float qscale[3];    // position = q * qscale + qoffset, q in [-1, 1] for snorm16
+    float qoffset[3];
+    float uvscale[2];   // uv = q / 65535 * uvscale + uvoffset
+    float uvoffset[2];
+    float qerror[4];    // max position, uv and normal angle error, position bound
+    int   nmeshlets;
+    int   nmeshletvertices;
+    int   nmeshlettriangles;
+    objmeshlet *meshlets;
+    uint32_t *meshletvertices;  // vbuffer or buffer vertex of each meshlet vertex
+    uint8_t  *meshlettriangles; // 3 meshlet local vertices per triangle
+    int   nlods;        // simplified index lists into vbuffer, levels of lod_ratios
+    int   *lodoffsets;  // start of each level and mesh range, the faces before the first o first
+    uint32_t *lodindices;
+    objsoa soa;         // replaces buffer or vbuffer when loaded as structure of arrays
     char  *filename;
+    int   nsmooth;      // face vertex offset and group of every s line, group 0 is off
+    int   *smooth;
+    int   nswitches;    // face vertex offset and material of every usemtl, -1 if unknown
+    int   *switches;
+    int   ndraws;       // one range per material once the faces are batched
+    objdraw *draws;
+    char  *cache;       // mapped cache file the arrays point into, if loaded from one
+    size_t cachesize;
     mtlctx materials;
 } objctx;
 
+typedef struct {
+    int  mesh;          // chunk local mesh index, -1 before the first o of the chunk
+    int  offset;        // chunk local face vertex offset
+    char *name;
+} objref;
+
+// scratch for triangulating one polygon, grown to the largest face and reused
+typedef struct {
+    int   cap;
+    float *pos;         // corner positions, filled by the caller
+    float *xy;          // corners projected onto the polygon plane
+    int   *prev;        // remaining polygon while ears are clipped
+    int   *next;
+    int   *corners;     // face vertices while they are rewritten
+    int   *tris;        // corner indices of the triangles
+} objscratch;
+
+// a range of whole lines parsed by one worker into its own arrays
+typedef struct {
+    const char *begin;
+    const char *end;
+    objctx ctx;
+    int    nusemtl;
+    int    capusemtl;
+    objref *usemtl;     // material names are resolved once all chunks are done
+    int    nmtllibs;    // every mtllib of the chunk in file order
+    char   **mtllibs;
+    int    vertexbase;  // prefix sums over the previous chunks
+    int    normalbase;
+    int    texcoordbase;
+    int    facevertbase;
+    int    meshbase;
+    int    nsmooth;     // chunk local face vertex offset and group of each s line
+    int    capsmooth;
+    int    *smooth;
+    int    nngons;      // chunk local face vertex offset and corner count of each n-gon
+    int    capngons;
+    int    *ngons;
+    objscratch scratch;
+    objctx *out;
+    pthread_t thread;
+} objchunk;
+
+typedef struct {
+    int nthreads;
+    int scale;          // run the thread scaling benchmark instead of printing
+    int indexed;        // weld vertices into an indexed buffer
+    int optimize;       // reorder the indexed buffer for the vertex cache, overdraw and fetch
+    int cache;          // load from and save to a binary cache next to the obj file
+    int quantize;       // qformatenum of the quantized vertex buffer
+    int soa;            // keep the vertex buffer as structure of arrays
+    int transform;      // run the aos and soa transform benchmark instead of printing
+    int stream;         // stream batches instead of loading, -1 if not streaming
+    int spill;          // keep the streamed vertex pools in temporary files
+    int normals;        // generate smooth normals for face vertices without vn
+    float crease;       // faces bent further than this many degrees don't share normals
+    int bvh;            // benchmark bvh builds and this many queries of each kind
+    int lod;            // build simplified index lists for every mesh
+    int meshlets;       // split every mesh into meshlets with culling bounds
+    int textures;       // threads decoding the texture maps, 0 to leave them alone
+    int sort;           // split meshes at usemtl and batch the faces by material
+    int watch;          // reload whenever the sources change instead of printing
+    char *convert;      // convert the obj files of a directory into this one
+    int format;         // formatenum of the converted files
+    int bench;          // time each load phase over this many runs instead of printing
+} objopts;
+
 int strcomp(const void *key, const void *elem) {
     const char *skey = *(const char **) key;
     const char *selem = *(const char **) elem;
     return strcmp(skey, selem);
 }
 
-int find_objkey(char *s) {
-    char *key = strtok(s, " ");
-    size_t nkeys = sizeof(objkeys) / sizeof(char *);
-    char **kptr = (char **) bsearch(&key, objkeys, nkeys, sizeof(char *), strcomp);
-    if (!kptr) {
+typedef struct {
+    char   *data;
+    size_t size;
+    int    mapped;
+} filemap;
+
+// map a file into memory, read it instead if it can't be mapped (pipes, "-" for stdin)
+int file_map(filemap *map, const char *filename) {
+    int fd = strcmp(filename, "-") ? open(filename, O_RDONLY) : STDIN_FILENO;
+    if (fd < 0) {
         return -1;
     }
-    return kptr - objkeys;
-}
-
-void mtl_filename(objctx *ctx, char *filename) {
-    char *directory = strdup(ctx->filename);
-    for (char *c = directory; *c; c++) {
-        if (*c == '\\') {
-            *c = '/';
+    struct stat st;
+    map->data = NULL;
+    map->size = 0;
+    map->mapped = 0;
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map->data != MAP_FAILED) {
+            madvise(map->data, st.st_size, MADV_SEQUENTIAL);
+            map->size = st.st_size;
+            map->mapped = 1;
+            close(fd);
+            return 0;
         }
+        map->data = NULL;
     }
-    if (!strchr(directory, '/')) {
-        char **path = &(ctx->materials.filename);
-        *path = strdup(filename);
-        free(directory);
-        return;
+    size_t capacity = 1 << 16;
+    map->data = malloc(capacity);
+    ssize_t n;
+    while ((n = read(fd, map->data + map->size, capacity - map->size)) > 0) {
+        map->size += n;
+        if (map->size == capacity) {
+            capacity *= 2;
+            map->data = realloc(map->data, capacity);
+        }
     }
-    *(strrchr(directory, '/') + 1) = 0;
-    char **path = &(ctx->materials.filename);
-    *path = calloc(strlen(directory) + strlen(filename) + 1, sizeof(char));
-    strcat(*path, directory);
-    strcat(*path, filename);
-    free(directory);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    return n < 0 ? -1 : 0;
 }
 
-void count_materials(objctx *ctx, char *filename) {
-    mtl_filename(ctx, filename);
-    FILE *f = fopen(ctx->materials.filename, "r");
-    if (!f) {
-        fprintf(stderr, "failed to open %s\n", ctx->materials.filename);
-        exit(1);
+void file_unmap(filemap *map) {
+    if (map->mapped) {
+        munmap(map->data, map->size);
+    } else {
+        free(map->data);
+    }
+}
+
+// skip spaces and tabs
+const char *skip_space(const char *p) {
+    while (*p == ' ' || *p == '\t') {
+        p++;
     }
+    return p;
+}
+
+typedef void (*line_parser)(void *arg, const char *p, const char *eol);
+
+// call parse for every line, each line ends with a newline the parsers stop at
+// so they don't need bounds checks; a last line without one is copied first
+void parse_lines(const char *p, const char *end, line_parser parse, void *arg) {
     char s[512];
-    while (fgets(s, 512, f)) {
-        char *key = strtok(s, " ");
-        if (!strcmp(key, "newmtl")) {
-            ctx->materials.nmaterials++;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol) {
+            int n = end - p < 511 ? end - p : 511;
+            memcpy(s, p, n);
+            s[n] = '\n';
+            parse(arg, skip_space(s), s + n);
+            break;
         }
+        parse(arg, skip_space(p), eol);
+        p = eol + 1;
     }
-    fclose(f);
 }
 
-void count_key(objctx *ctx, char *s) {
-    int key = find_objkey(s);   // check the type of a string key
-    switch (key) {
-    case F:
-        int nverts = 0;
-        ctx->nfaces++;
-        while (strtok(NULL, " ")) {
-            nverts++;
+// exact powers of ten, a double holds them without rounding up to 1e22
+const double powers10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// parse a decimal number in one forward pass, return the position after it
+// up to 19 significant digits are kept, which rounds exactly like atof for
+// values with at most 15 digits and a small exponent
+const char *parse_float(const char *p, float *out) {
+    p = skip_space(p);
+    int neg = *p == '-';
+    p += neg || *p == '+';
+    unsigned long long mant = 0;
+    int digits = 0;
+    int exp = 0;
+    unsigned d;
+    for (; (d = *p - '0') < 10; p++) {
+        if (digits < 19) {
+            mant = mant * 10 + d;
+            digits += mant > 0;
+        } else {
+            exp++;
+        }
+    }
+    if (*p == '.') {
+        for (p++; (d = *p - '0') < 10; p++) {
+            if (digits < 19) {
+                mant = mant * 10 + d;
+                digits += mant > 0;
+                exp--;
+            }
         }
-        if (nverts > 3) {
-            nverts = (nverts - 2) * 3;
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        int eneg = *p == '-';
+        p += eneg || *p == '+';
+        int e = 0;
+        for (; (d = *p - '0') < 10; p++) {
+            if (e < 1000) {
+                e = e * 10 + d;
+            }
+        }
+        exp += eneg ? -e : e;
+    }
+    double value = mant;
+    for (; exp > 22; exp -= 22) {
+        value *= 1e22;
+    }
+    for (; exp < -22; exp += 22) {
+        value /= 1e22;
+    }
+    value = exp < 0 ? value / powers10[-exp] : value * powers10[exp];
+    *out = neg ? -value : value;
+    return p;
+}
+
+// parse a decimal integer, return the position after it
+const char *parse_int(const char *p, int *out) {
+    int neg = *p == '-';
+    p += neg || *p == '+';
+    int value = 0;
+    unsigned d;
+    for (; (d = *p - '0') < 10; p++) {
+        value = value * 10 + d;
+    }
+    *out = neg ? -value : value;
+    return p;
+}
+
+// parse a v, v/vt, v//vn or v/vt/vn face vertex, missing indices are zero
+const char *parse_face(const char *p, int *fptr) {
+    fptr[1] = fptr[2] = 0;
+    p = parse_int(p, fptr);
+    if (*p == '/') {
+        p++;
+        if (*p != '/') {
+            p = parse_int(p, fptr + 1);
+        }
+        if (*p == '/') {
+            p = parse_int(p + 1, fptr + 2);
+        }
+    }
+    while (*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+// copy the next word, or the rest of the line if rest is set, into s
+const char *parse_word(const char *p, const char *eol, char *s, int size, int rest) {
+    p = skip_space(p);
+    const char *q = p;
+    while (q < eol && (rest || (*q != ' ' && *q != '\t' && *q != '\r'))) {
+        q++;
+    }
+    const char *e = q;
+    while (e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) {
+        e--;
+    }
+    int n = e - p < size - 1 ? e - p : size - 1;
+    memcpy(s, p, n);
+    s[n] = 0;
+    return q;
+}
+
+// check that the line continues with a key followed by whitespace
+int match_key(const char *p, const char *eol, const char *key, int size) {
+    return eol - p > size && !memcmp(p, key, size) && (p[size] == ' ' || p[size] == '\t');
+}
+
+// get the key of an obj line from its first bytes and move past it
+int objline_key(const char **pp, const char *eol) {
+    const char *p = *pp;
+    int key = -1;
+    int size = 0;
+    switch (*p) {
+    case 'v':
+        if (match_key(p, eol, "v", 1)) {
+            key = V, size = 1;
+        } else if (match_key(p, eol, "vn", 2)) {
+            key = VN, size = 2;
+        } else if (match_key(p, eol, "vt", 2)) {
+            key = VT, size = 2;
         }
-        ctx->nfaceverts += nverts;
-        break;
-    case MTLLIB:
-        s = strchr(s, '\0') + 1;
-        *strchr(s, '\n') = 0;
-        count_materials(ctx, s);
         break;
-    case O:                 // new mesh found
-        ctx->nmeshes++;     // increase the number of meshes
+    case 'f':
+        if (match_key(p, eol, "f", 1)) {
+            key = F, size = 1;
+        }
         break;
-    case V:                 // new vertex found
-        ctx->nvertices++;   // increase the number of vertices
+    case 'o':
+        if (match_key(p, eol, "o", 1)) {
+            key = O, size = 1;
+        }
         break;
-    case VN:                // new normal found
-        ctx->nnormals++;    // increase the number of normals
+    case 's':
+        if (match_key(p, eol, "s", 1)) {
+            key = S, size = 1;
+        }
         break;
-    case VT:                // new texture coordinate found
-        ctx->ntexcoords++;  // increase number of tex. coordinates
+    case 'u':
+        if (match_key(p, eol, "usemtl", 6)) {
+            key = USEMTL, size = 6;
+        }
         break;
-    default:                // ignore unknown keys (like comments or empty lines)
+    case 'm':
+        if (match_key(p, eol, "mtllib", 6)) {
+            key = MTLLIB, size = 6;
+        }
         break;
     }
+    *pp = p + size;
+    return key;
 }
 
-void objctx_malloc(objctx *ctx) {
-    ctx->vertices = malloc(3 * ctx->nvertices * sizeof(float));
-    ctx->normals = malloc(3 * ctx->nnormals * sizeof(float));
-    ctx->texcoords = malloc(2 * ctx->ntexcoords * sizeof(float));
-    ctx->faces = malloc(3 * ctx->nfaceverts * sizeof(int));
-    ctx->buffer = calloc(8 * ctx->nfaceverts, sizeof(float));
-    ctx->meshoffsets = malloc((ctx->nmeshes + 1) * sizeof(int));
-    ctx->mtlindices = malloc(ctx->nmeshes * sizeof(int));
-    ctx->materials.materials = calloc(ctx->materials.nmaterials, sizeof(mtl));
+// make room for n elements, doubling the capacity
+void *reserve(void *ptr, int *capacity, int n, size_t size) {
+    if (n <= *capacity) {
+        return ptr;
+    }
+    int cap = *capacity ? *capacity : 64;
+    while (cap < n) {
+        cap *= 2;
+    }
+    *capacity = cap;
+    return realloc(ptr, cap * size);
 }
 
-void objctx_reset(objctx *ctx) {
-    ctx->nvertices = 0;
-    ctx->nnormals = 0;
-    ctx->ntexcoords = 0;
-    ctx->nfaces = 0;
-    ctx->nfaceverts = 0;
-    ctx->nmeshes = 0;
-    ctx->materials.nmaterials = 0;
+void mtl_filename(objctx *ctx, char *filename) {
+    char *directory = strdup(ctx->filename);
+    for (char *c = directory; *c; c++) {
+        if (*c == '\\') {
+            *c = '/';
+        }
+    }
+    free(ctx->materials.filename);
+    if (!strchr(directory, '/')) {
+        char **path = &(ctx->materials.filename);
+        *path = strdup(filename);
+        free(directory);
+        return;
+    }
+    *(strrchr(directory, '/') + 1) = 0;
+    char **path = &(ctx->materials.filename);
+    *path = calloc(strlen(directory) + strlen(filename) + 1, sizeof(char));
+    strcat(*path, directory);
+    strcat(*path, filename);
+    free(directory);
 }
 
-int find_mtlkey(char *s) {
+int find_mtlkey(const char **pp, const char *eol) {
+    char key[16];
+    char *kptr = key;
+    *pp = parse_word(*pp, eol, key, sizeof(key), 0);
     size_t nkeys = sizeof(mtlkeys) / sizeof(char *);
-    char *key = strtok(s, " ");
-    char **kptr = (char **) bsearch(&key, mtlkeys, nkeys, sizeof(char *), strcomp);
-    if (!kptr) {
+    const char **found = bsearch(&kptr, mtlkeys, nkeys, sizeof(char *), strcomp);
+    if (!found) {
         return -1;
     }
-    return kptr - mtlkeys;
+    return found - mtlkeys;
+}
+
+// parse n floats into dst
+const char *parse_floats(const char *p, float *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        p = parse_float(p, dst + i);
+    }
+    return p;
 }
 
-void parse_mtlline(objctx *ctx, char *s) {
-    char *mapstr = NULL;
-    int key = find_mtlkey(s);
+void parse_mtlline(void *arg, const char *p, const char *eol) {
+    objctx *ctx = arg;
+    char s[512];
+    int key = find_mtlkey(&p, eol);
+    if (key != NEWMTL && !ctx->materials.nmaterials) {
+        return;
+    }
     mtl *mtl = ctx->materials.materials + ctx->materials.nmaterials - 1;
+    char **map = NULL;
     switch (key) {
     case KA:
-        for (int i = 0; i < 3; i++) {
-            char *astr = strtok(NULL, " ");
-            mtl->ambient[i] = atof(astr);
-        }
+        parse_floats(p, mtl->ambient, 3);
         break;
     case KD:
-        for (int i = 0; i < 3; i++) {
-            char *dstr = strtok(NULL, " ");
-            mtl->diffuse[i] = atof(dstr);
-        }
+        parse_floats(p, mtl->diffuse, 3);
         break;
     case KE:
-        for (int i = 0; i < 3; i++) {
-            char *estr = strtok(NULL, " ");
-            mtl->emissive[i] = atof(estr);
-        }
+        parse_floats(p, mtl->emissive, 3);
         break;
     case KS:
-        for (int i = 0; i < 3; i++) {
-            char *sstr = strtok(NULL, " ");
-            mtl->specular[i] = atof(sstr);
-        }
+        parse_floats(p, mtl->specular, 3);
         break;
     case NI:
-        char *rstr = strtok(NULL, " ");
-        mtl->refraction = atof(rstr);
+        parse_float(p, &mtl->refraction);
         break;
     case NS:
-        char *sstr = strtok(NULL, " ");
-        mtl->shininess = atof(sstr);
+        parse_float(p, &mtl->shininess);
         break;
     case D:
-        char *tstr = strtok(NULL, " ");
-        mtl->transparency = atof(tstr);
+        parse_float(p, &mtl->transparency);
         break;
     case ILLUM:
-        char *istr = strtok(NULL, " ");
-        mtl->illum = atoi(istr);
+        parse_int(skip_space(p), &mtl->illum);
         break;
     case MAP_KA:
-        char *mapstr = strtok(NULL, " ");
-        mtl->map_ambient = strdup(mapstr);
+        map = &mtl->map_ambient;
         break;
     case MAP_KD:
-        mapstr = strtok(NULL, " ");
-        mtl->map_diffuse = strdup(mapstr);
+        map = &mtl->map_diffuse;
         break;
     case MAP_KS:
-        mapstr = strtok(NULL, " ");
-        mtl->map_specular = strdup(mapstr);
+        map = &mtl->map_specular;
         break;
     case MAP_NS:
-        mapstr = strtok(NULL, " ");
-        mtl->map_highlight = strdup(mapstr);
+        map = &mtl->map_highlight;
         break;
     case MAP_BUMP:
-        mapstr = strtok(NULL, " ");
-        mtl->map_bump = strdup(mapstr);
+        map = &mtl->map_bump;
+        break;
     case MAP_D:
-        mapstr = strtok(NULL, " ");
-        mtl->map_alpha = strdup(mapstr);
+        map = &mtl->map_alpha;
         break;
     case NEWMTL:
-        mtl++;
-        ctx->materials.nmaterials++;
-        char *name = strtok(NULL, " ");
-        *strchr(name, '\n') = 0;
-        mtl->name = strdup(name);
+        ctx->materials.materials = reserve(
+            ctx->materials.materials, &ctx->materials.capmaterials,
+            ctx->materials.nmaterials + 1, sizeof(*mtl)
+        );
+        mtl = ctx->materials.materials + ctx->materials.nmaterials++;
+        memset(mtl, 0, sizeof(*mtl));
+        parse_word(p, eol, s, sizeof(s), 0);
+        mtl->name = strdup(s);
         break;
     default:
         break;
     }
-}
-
-void parse_materials(objctx *ctx) {
-    FILE *f = fopen(ctx->materials.filename, "r");
-    char s[512];
-    while (fgets(s, 512, f)) {
-        parse_mtlline(ctx, s);
+    if (map) {
+        parse_word(p, eol, s, sizeof(s), 1);
+        free(*map);
+        *map = strdup(s);
     }
-    fclose(f);
 }
 
-void parse_face(char *s, int *fptr) {
-    int i = 0;
-    char *t = NULL;
-    while (t = strchr(s, '/')) {
-        fptr[i++] = atoi(s);
-        s = t + 1;
-    }
-    fptr[i++] = atoi(s);
+#define mtl_nstrings 7
+
+char **mtl_string(mtl *mtl, int i) {
+    char **strings[] = {
+        &mtl->name, &mtl->map_ambient, &mtl->map_diffuse, &mtl->map_specular,
+        &mtl->map_highlight, &mtl->map_alpha, &mtl->map_bump
+    };
+    return strings[i];
 }
 
-void parse_objline(objctx *ctx, char *s) {
-    int key = find_objkey(s);       // check the type of a string key
-    switch (key) {
-    case F:
-        int nvert = 0;
-        char *fverts = NULL;
-        int *fptr = ctx->faces + 3 * ctx->nfaceverts;
-        int *fvptr = fptr;
-        while(fverts = strtok(NULL, " ")) {
-            parse_face(fverts, fvptr);
-            fvptr += 3;
-            nvert++;
+void mtlctx_free(mtlctx *ctx) {
+    free(ctx->filename);
+    for (int i = 0; i < ctx->nmaterials; i++) {
+        mtl *mtl = ctx->materials + i;
+        if (mtl->map_ambient) {
+            free(mtl->map_ambient);
         }
-        if (nvert > 3) {
-            int *fcptr = malloc(3 * nvert * sizeof(int));
-            memcpy(fcptr, fptr, 3 * nvert * sizeof(int));
-            for (int i = 0; i < nvert - 2; i++) {
-                memcpy(fptr + 9 * i + 0, fcptr + 3 * 0, 3 * sizeof(int));
-                memcpy(fptr + 9 * i + 3, fcptr + 3 * (i + 1), 3 * sizeof(int));
-                memcpy(fptr + 9 * i + 6, fcptr + 3 * (i + 2), 3 * sizeof(int));
-            }
-            free(fcptr);
-            nvert = (nvert - 2) * 3;
+        if (mtl->map_diffuse) {
+            free(mtl->map_diffuse);
         }
-        ctx->nfaceverts += nvert;
-        ctx->nfaces++;
-        break;
-    case O:
-        ctx->meshoffsets[ctx->nmeshes++] = ctx->nfaceverts;
-        break;
-    case USEMTL:
-        char *mtlname = strtok(NULL, " ");
-        *strchr(mtlname, '\n') = 0;
-        for (int i = 0; i < ctx->materials.nmaterials; i++) {
-            if (!strcmp(mtlname, ctx->materials.materials[i].name)) {
-                ctx->mtlindices[ctx->nmeshes - 1] = i;
-            }
+        if (mtl->map_specular) {
+            free(mtl->map_specular);
         }
-        break;
-    case V:
-        float *vptr = ctx->vertices + 3 * ctx->nvertices++;
-        for (int i = 0; i < 3; i++) {
-            char *verts = strtok(NULL, " ");
-            float vert = atof(verts);
-            vptr[i] = vert;
+        if (mtl->map_highlight) {
+            free(mtl->map_highlight);
         }
-        break;
-    case VN:
-        float *nptr = ctx->normals + 3 * ctx->nnormals++;
-        for (int i = 0; i < 3; i++) {
-            char *norms = strtok(NULL, " ");
-            float norm = atof(norms);
-            nptr[i] = norm;
+        if (mtl->map_alpha) {
+            free(mtl->map_alpha);
         }
-        break;
-    case VT:
-        float *tptr = ctx->texcoords + 2 * ctx->ntexcoords++;
-        for (int i = 0; i < 2; i++) {
-            char *texs = strtok(NULL, " ");
-            float tex = atof(texs);
-            tptr[i] = tex;
+        if (mtl->map_bump) {
+            free(mtl->map_bump);
         }
-        break;
-    default:
-        break;
+        free(mtl->name);
+    }
+    free(ctx->materials);
+    for (int i = 0; i < ctx->nlibraries; i++) {
+        free(ctx->libraries[i]);
     }
+    free(ctx->libraries);
+    free(ctx->buckets);
+    free(ctx->textures);
 }
 
-void build_buffer(objctx *ctx) {
-    for (int i = 0; i < ctx->nfaceverts; i++) {
-        float *bptr = ctx->buffer + 8 * i;
-        int *fptr = ctx->faces + 3 * i;
-        int vert = fptr[0];
-        int texc = fptr[1];
-        int norm = fptr[2];
-        if (vert) {
-            memcpy(bptr, ctx->vertices + 3 * (vert - 1), 3 * sizeof(float));
-        }
-        if (texc) {
-            memcpy(bptr + 3, ctx->texcoords + 2 * (texc - 1), 2 * sizeof(float));
-        }
-        if (norm) {
-            memcpy(bptr + 5, ctx->normals + 3 * (norm - 1), 3 * sizeof(float));
-        }
+// a parsed mtl file shared by every load in the process
+typedef struct {
+    char   *path;       // resolved with realpath
+    struct timespec mtime;
+    off_t  size;
+    mtlctx materials;
+} mtlentry;
+
+struct {
+    pthread_mutex_t lock;
+    int      nentries;
+    int      capentries;
+    mtlentry *entries;
+} mtlcache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void mtlcache_free(void) {
+    for (int i = 0; i < mtlcache.nentries; i++) {
+        free(mtlcache.entries[i].path);
+        mtlctx_free(&mtlcache.entries[i].materials);
     }
+    free(mtlcache.entries);
+    mtlcache.nentries = mtlcache.capentries = 0;
+    mtlcache.entries = NULL;
 }
 
-void mtl_print(objctx *ctx) {
-    printf("materials:\n");
-    for (int i = 0; i < ctx->materials.nmaterials; i++) {
-        mtl *mtl = ctx->materials.materials + i;
-        printf("name:\t\t%s\n", mtl->name);
-        printf("ambient:\t[ ");
-        for (int j = 0; j < 3; j++) {
-            printf("%8.4f ", mtl->ambient[j]);
-        }
-        printf("]\n");
-        printf("diffuse:\t[ ");
-        for (int j = 0; j < 3; j++) {
-            printf("%8.4f ", mtl->diffuse[j]);
+// append copies of the materials in src
+void mtl_append(mtlctx *dst, const mtlctx *src) {
+    dst->materials = reserve(
+        dst->materials, &dst->capmaterials, dst->nmaterials + src->nmaterials, sizeof(mtl)
+    );
+    for (int i = 0; i < src->nmaterials; i++) {
+        mtl *mtl = dst->materials + dst->nmaterials++;
+        *mtl = src->materials[i];
+        for (int j = 0; j < mtl_nstrings; j++) {
+            char **str = mtl_string(mtl, j);
+            *str = *str ? strdup(*str) : NULL;
         }
-        printf("]\n");
-        printf("specular:\t[ ");
-        for (int j = 0; j < 3; j++) {
-            printf("%8.4f ", mtl->specular[j]);
-        }
-        printf("]\n");
-        printf("emissive:\t[ ");
-        for (int j = 0; j < 3; j++) {
-            printf("%8.4f ", mtl->emissive[j]);
+    }
+}
+
+// append the materials of an mtl file, which is parsed again only when its
+// modification time or size changed since the last time it was read
+int mtlcache_load(mtlctx *dst, const char *filename) {
+    struct stat st;
+    char *path = realpath(filename, NULL);
+    if (!path || stat(path, &st)) {
+        free(path);
+        return -1;
+    }
+    pthread_mutex_lock(&mtlcache.lock);
+    mtlentry *entry = NULL;
+    for (int i = 0; i < mtlcache.nentries && !entry; i++) {
+        entry = strcmp(mtlcache.entries[i].path, path) ? NULL : mtlcache.entries + i;
+    }
+    if (entry && (entry->size != st.st_size || entry->mtime.tv_sec != st.st_mtim.tv_sec
+        || entry->mtime.tv_nsec != st.st_mtim.tv_nsec)) {
+        mtlctx_free(&entry->materials);     // stale, parse it again below
+        entry->materials = (mtlctx){0};
+        free(path);
+        path = NULL;
+    } else if (entry) {
+        free(path);
+        mtl_append(dst, &entry->materials);
+        pthread_mutex_unlock(&mtlcache.lock);
+        return 0;
+    } else {
+        mtlcache.entries = reserve(
+            mtlcache.entries, &mtlcache.capentries, mtlcache.nentries + 1, sizeof(mtlentry)
+        );
+        entry = mtlcache.entries + mtlcache.nentries++;
+        *entry = (mtlentry){ .path = path };
+    }
+    filemap map;
+    if (file_map(&map, entry->path)) {
+        pthread_mutex_unlock(&mtlcache.lock);
+        return -1;
+    }
+    objctx tmp = {0};                       // a library is parsed on its own
+    parse_lines(map.data, map.data + map.size, parse_mtlline, &tmp);
+    file_unmap(&map);
+    entry->materials = tmp.materials;
+    entry->mtime = st.st_mtim;
+    entry->size = st.st_size;
+    mtl_append(dst, &entry->materials);
+    pthread_mutex_unlock(&mtlcache.lock);
+    return 0;
+}
+
+enum texstateenum { TEXPENDING, TEXREADY, TEXFAILED };
+
+#define tex_maxlevels 32
+
+// an image decoded to rgba8 with its box filtered mip chain, level i is
+// max(width >> i, 1) by max(height >> i, 1) at pixels + offsets[i]
+typedef struct {
+    char    *path;          // resolved with realpath, as given if that fails
+    int     state;          // texstateenum, changes under the pool lock
+    int     width;
+    int     height;
+    int     nlevels;
+    size_t  offsets[tex_maxlevels];
+    uint8_t *pixels;
+    const char *error;
+} objtexture;
+
+// every texture requested in the process, decoded by the worker threads in
+// request order. a handle is the index of its texture plus one
+struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;    // new work, a finished texture or shutdown
+    int        ntextures;
+    int        captextures;
+    objtexture **textures;      // pointers, so a texture stays put while the array grows
+    int        next;            // first texture no worker has taken
+    int        nthreads;        // 0 until texpool_start, requests are ignored until then
+    pthread_t  threads[64];
+    int        quit;
+} texpool = { .lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER };
+
+// binary or ascii pnm: p2 and p5 grey, p3 and p6 rgb
+const char *decode_pnm(const uint8_t *p, size_t size, objtexture *tex) {
+    const uint8_t *end = p + size;
+    int kind = p[1] - '0', values[3] = {0};
+    p += 2;
+    for (int i = 0; i < 3; i++) {           // width, height and maxval, skipping comments
+        while (p < end && (*p == '#' || *p <= ' ')) {
+            if (*p == '#') {
+                while (p < end && *p != '\n') {
+                    p++;
+                }
+            } else {
+                p++;
+            }
         }
-        printf("]\n");
-        printf("shininess:\t%10.4f\n", mtl->shininess);
-        printf("refraction:\t%10.4f\n", mtl->refraction);
-        printf("transparency:\t%10.4f\n", mtl->transparency);
-        printf("illum:\t\t%5d\n", mtl->illum);
-        if (mtl->map_ambient) {
-            printf("ambient map: %s\n", mtl->map_ambient);
+        while (p < end && *p >= '0' && *p <= '9') {
+            values[i] = values[i] * 10 + *p++ - '0';
+            if (values[i] > 1 << 16) {
+                return "bad pnm header";
+            }
         }
-        if (mtl->map_diffuse) {
-            printf("diffuse map: %s\n", mtl->map_diffuse);
+    }
+    int width = values[0], height = values[1], maxval = values[2];
+    int channels = kind == 2 || kind == 5 ? 1 : 3;
+    int wide = maxval > 255;
+    if (!width || !height || !maxval || p == end) {
+        return "bad pnm header";
+    }
+    p++;                                    // one whitespace ends the header
+    size_t n = (size_t) width * height * channels;
+    if ((kind == 5 || kind == 6) && (size_t) (end - p) < n << wide) {
+        return "truncated pnm";
+    }
+    tex->width = width, tex->height = height;
+    tex->pixels = malloc(4 * (size_t) width * height * 2);  // room for the mip chain
+    if (!tex->pixels) {
+        return "out of memory";
+    }
+    uint8_t *out = tex->pixels;
+    for (size_t i = 0; i < n; i++) {
+        unsigned v = 0;
+        if (kind == 5 || kind == 6) {
+            v = wide ? p[0] << 8 | p[1] : p[0];
+            p += 1 + wide;
+        } else {
+            while (p < end && (*p < '0' || *p > '9')) {
+                p++;
+            }
+            if (p == end) {
+                return "truncated pnm";
+            }
+            while (p < end && *p >= '0' && *p <= '9') {
+                v = v * 10 + *p++ - '0';
+            }
         }
-        if (mtl->map_specular) {
-            printf("specular map: %s\n", mtl->map_specular);
+        uint8_t c = v >= (unsigned) maxval ? 255 : v * 255 / maxval;
+        if (channels == 1) {
+            out[4 * i] = out[4 * i + 1] = out[4 * i + 2] = c;
+            out[4 * i + 3] = 255;
+        } else {
+            out[4 * (i / 3) + i % 3] = c;
+            out[4 * (i / 3) + 3] = 255;
         }
-        if (mtl->map_highlight) {
-            printf("highlight map: %s\n", mtl->map_highlight);
+    }
+    return NULL;
+}
+
+// truevision tga: types 2, 3 and their run length versions 10, 11 at 8, 24 or 32 bits
+const char *decode_tga(const uint8_t *p, size_t size, objtexture *tex) {
+    if (size < 18) {
+        return "truncated tga";
+    }
+    int type = p[2], width = p[12] | p[13] << 8, height = p[14] | p[15] << 8;
+    int bytes = p[16] / 8, top = p[17] & 0x20;
+    int grey = type == 3 || type == 11, rle = type >= 10;
+    if ((type != 2 && type != 3 && type != 10 && type != 11) || p[1]
+        || (grey ? bytes != 1 : bytes != 3 && bytes != 4) || !width || !height) {
+        return "unsupported tga";
+    }
+    const uint8_t *src = p + 18 + p[0], *end = p + size;
+    tex->width = width, tex->height = height;
+    tex->pixels = malloc(4 * (size_t) width * height * 2);
+    if (!tex->pixels) {
+        return "out of memory";
+    }
+    size_t n = (size_t) width * height;
+    for (size_t i = 0; i < n;) {
+        size_t count = 1;
+        int repeat = 0;
+        if (rle) {
+            if (src >= end) {
+                return "truncated tga";
+            }
+            count = (*src & 0x7f) + 1;
+            repeat = *src++ & 0x80;
         }
-        if (mtl->map_alpha) {
-            printf("alpha map: %s\n", mtl->map_alpha);
+        for (size_t j = 0; j < count && i < n; j++, i++) {
+            if (src + bytes > end) {
+                return "truncated tga";
+            }
+            size_t row = i / width, col = i % width;    // rows run bottom up unless top is set
+            uint8_t *out = tex->pixels + 4 * ((top ? row : height - 1 - row) * width + col);
+            out[0] = src[grey ? 0 : 2];
+            out[1] = src[grey ? 0 : 1];
+            out[2] = src[0];
+            out[3] = bytes == 4 ? src[3] : 255;
+            src += repeat && j + 1 < count ? 0 : bytes;
         }
-        if (mtl->map_bump) {
-            printf("bump map: %s\n", mtl->map_bump);
+    }
+    return NULL;
+}
+
+// each level averages 2x2 texels of the one above, the last row or column
+// of an odd size is used twice
+void texture_mips(objtexture *tex) {
+    int w = tex->width, h = tex->height;
+    tex->nlevels = 1;
+    tex->offsets[0] = 0;
+    size_t offset = 4 * (size_t) w * h;
+    while ((w > 1 || h > 1) && tex->nlevels < tex_maxlevels) {
+        int nw = w > 1 ? w / 2 : 1, nh = h > 1 ? h / 2 : 1;
+        const uint8_t *src = tex->pixels + tex->offsets[tex->nlevels - 1];
+        uint8_t *dst = tex->pixels + offset;
+        for (int y = 0; y < nh; y++) {
+            int y0 = 2 * y < h ? 2 * y : h - 1, y1 = 2 * y + 1 < h ? 2 * y + 1 : h - 1;
+            for (int x = 0; x < nw; x++) {
+                int x0 = 2 * x < w ? 2 * x : w - 1, x1 = 2 * x + 1 < w ? 2 * x + 1 : w - 1;
+                for (int c = 0; c < 4; c++) {
+                    dst[4 * (y * nw + x) + c] = (src[4 * (y0 * w + x0) + c] + src[4 * (y0 * w + x1) + c]
+                        + src[4 * (y1 * w + x0) + c] + src[4 * (y1 * w + x1) + c] + 2) / 4;
+                }
+            }
+        }
+        tex->offsets[tex->nlevels++] = offset;
+        offset += 4 * (size_t) nw * nh;
+        w = nw, h = nh;
+    }
+}
+
+const char *texture_decode(objtexture *tex) {
+    filemap map;
+    if (file_map(&map, tex->path)) {
+        return "can't open file";
+    }
+    const uint8_t *p = (const uint8_t *) map.data;
+    const char *ext = strrchr(tex->path, '.');
+    const char *error = "unsupported format";
+    if (map.size > 2 && p[0] == 'P' && strchr("2356", p[1])) {
+        error = decode_pnm(p, map.size, tex);
+    } else if (ext && !strcasecmp(ext, ".tga")) {
+        error = decode_tga(p, map.size, tex);
+    }
+    file_unmap(&map);
+    if (!error) {
+        texture_mips(tex);
+    }
+    return error;
+}
+
+void *texture_worker(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&texpool.lock);
+    for (;;) {
+        while (texpool.next == texpool.ntextures && !texpool.quit) {
+            pthread_cond_wait(&texpool.changed, &texpool.lock);
+        }
+        if (texpool.next == texpool.ntextures) {
+            break;
+        }
+        objtexture *tex = texpool.textures[texpool.next++];
+        pthread_mutex_unlock(&texpool.lock);
+        const char *error = texture_decode(tex);
+        pthread_mutex_lock(&texpool.lock);
+        tex->error = error;
+        tex->state = error ? TEXFAILED : TEXREADY;
+        if (error) {
+            free(tex->pixels);
+            tex->pixels = NULL;
+        }
+        pthread_cond_broadcast(&texpool.changed);
+    }
+    pthread_mutex_unlock(&texpool.lock);
+    return NULL;
+}
+
+void texpool_start(int nthreads) {
+    nthreads = nthreads < 1 ? 1 : nthreads > 64 ? 64 : nthreads;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_create(texpool.threads + i, NULL, texture_worker, NULL);
+    }
+    texpool.nthreads = nthreads;
+}
+
+// finish the queued work, stop the workers and free every texture
+void texpool_free(void) {
+    pthread_mutex_lock(&texpool.lock);
+    texpool.quit = 1;
+    pthread_cond_broadcast(&texpool.changed);
+    pthread_mutex_unlock(&texpool.lock);
+    for (int i = 0; i < texpool.nthreads; i++) {
+        pthread_join(texpool.threads[i], NULL);
+    }
+    for (int i = 0; i < texpool.ntextures; i++) {
+        free(texpool.textures[i]->path);
+        free(texpool.textures[i]->pixels);
+        free(texpool.textures[i]);
+    }
+    free(texpool.textures);
+    texpool.textures = NULL;
+    texpool.ntextures = texpool.captextures = texpool.next = texpool.nthreads = 0;
+}
+
+// handle of the texture at path, queued for decoding unless an earlier request
+// already resolved to the same file
+int texture_request(const char *path) {
+    char *resolved = realpath(path, NULL);
+    resolved = resolved ? resolved : strdup(path);
+    pthread_mutex_lock(&texpool.lock);
+    for (int i = 0; i < texpool.ntextures; i++) {
+        if (!strcmp(texpool.textures[i]->path, resolved)) {
+            pthread_mutex_unlock(&texpool.lock);
+            free(resolved);
+            return i + 1;
+        }
+    }
+    texpool.textures = reserve(
+        texpool.textures, &texpool.captextures, texpool.ntextures + 1, sizeof(objtexture *)
+    );
+    objtexture *tex = calloc(1, sizeof(objtexture));
+    tex->path = resolved;
+    texpool.textures[texpool.ntextures++] = tex;
+    pthread_cond_broadcast(&texpool.changed);
+    pthread_mutex_unlock(&texpool.lock);
+    return texpool.ntextures;
+}
+
+// texstateenum of a handle without waiting
+int texture_poll(int handle) {
+    pthread_mutex_lock(&texpool.lock);
+    int state = texpool.textures[handle - 1]->state;
+    pthread_mutex_unlock(&texpool.lock);
+    return state;
+}
+
+// the texture of a handle once it's decoded or has failed
+objtexture *texture_wait(int handle) {
+    pthread_mutex_lock(&texpool.lock);
+    objtexture *tex = texpool.textures[handle - 1];
+    while (tex->state == TEXPENDING) {
+        pthread_cond_wait(&texpool.changed, &texpool.lock);
+    }
+    pthread_mutex_unlock(&texpool.lock);
+    return tex;
+}
+
+// request the maps of materials from first on, paths are relative to the mtl
+// file and the file name is the last word, after any options
+void mtl_textures(mtlctx *materials, int first) {
+    if (!texpool.nthreads) {
+        return;
+    }
+    int nmaps = mtl_nstrings - 1;
+    materials->textures = realloc(materials->textures, (materials->nmaterials * nmaps + 1) * sizeof(int));
+    const char *slash = materials->filename ? strrchr(materials->filename, '/') : NULL;
+    int dirlength = slash ? slash - materials->filename + 1 : 0;
+    for (int i = first; i < materials->nmaterials; i++) {
+        for (int j = 0; j < nmaps; j++) {
+            char *map = *mtl_string(materials->materials + i, j + 1);
+            materials->textures[i * nmaps + j] = 0;
+            if (!map || !*map) {
+                continue;
+            }
+            const char *name = strrchr(map, ' ');
+            name = name ? name + 1 : map;
+            int prefix = name[0] == '/' ? 0 : dirlength;
+            char *path = malloc(prefix + strlen(name) + 1);
+            memcpy(path, materials->filename, prefix);
+            strcpy(path + prefix, name);
+            materials->textures[i * nmaps + j] = texture_request(path);
+            free(path);
+        }
+    }
+}
+
+// append the materials of the mtl file at materials->filename, the library is
+// listed even when it can't be read
+int mtl_library(mtlctx *materials) {
+    int first = materials->nmaterials;
+    materials->libraries = realloc(
+        materials->libraries, (materials->nlibraries + 1) * sizeof(char *)
+    );
+    materials->libraries[materials->nlibraries++] = strdup(materials->filename);
+    if (mtlcache_load(materials, materials->filename)) {
+        return -1;
+    }
+    mtl_textures(materials, first);         // decoding overlaps the rest of the load
+    return 0;
+}
+
+// return -1 if the mtl file can't be read
+int parse_materials(objctx *ctx, char *filename) {
+    mtl_filename(ctx, filename);
+    if (mtl_library(&ctx->materials)) {
+        fprintf(stderr, "failed to open %s\n", ctx->materials.filename);
+        return -1;
+    }
+    return 0;
+}
+
+void scratch_reserve(objscratch *scratch, int n) {
+    if (n <= scratch->cap) {
+        return;
+    }
+    int cap = scratch->cap ? scratch->cap : 16;
+    while (cap < n) {
+        cap *= 2;
+    }
+    scratch->pos = realloc(scratch->pos, 3 * cap * sizeof(float));
+    scratch->xy = realloc(scratch->xy, 2 * cap * sizeof(float));
+    scratch->prev = realloc(scratch->prev, cap * sizeof(int));
+    scratch->next = realloc(scratch->next, cap * sizeof(int));
+    scratch->corners = realloc(scratch->corners, 3 * cap * sizeof(int));
+    scratch->tris = realloc(scratch->tris, 3 * cap * sizeof(int));
+    scratch->cap = cap;
+}
+
+void scratch_free(objscratch *scratch) {
+    free(scratch->pos);
+    free(scratch->xy);
+    free(scratch->prev);
+    free(scratch->next);
+    free(scratch->corners);
+    free(scratch->tris);
+}
+
+// twice the signed area of the projected triangle a b c
+float cross2(const float *xy, int a, int b, int c) {
+    return (xy[2 * b] - xy[2 * a]) * (xy[2 * c + 1] - xy[2 * a + 1])
+        - (xy[2 * b + 1] - xy[2 * a + 1]) * (xy[2 * c] - xy[2 * a]);
+}
+
+// no other remaining corner lies in the convex corner b between a and c
+int is_ear(objscratch *scratch, int a, int b, int c) {
+    const float *xy = scratch->xy;
+    if (cross2(xy, a, b, c) <= 0) {
+        return 0;
+    }
+    for (int r = scratch->next[c]; r != a; r = scratch->next[r]) {
+        if (cross2(xy, a, b, r) >= 0 && cross2(xy, b, c, r) >= 0 && cross2(xy, c, a, r) >= 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// triangulate a polygon of n corners with positions in scratch->pos: project it
+// onto the plane of its newell normal and keep the fan if no corner turns the
+// wrong way, else clip ears. returns 0 for a fan, otherwise scratch->tris holds
+// the 3 * (n - 2) corner indices of the triangles
+int triangulate(objscratch *scratch, int n) {
+    const float *pos = scratch->pos;
+    if (n == 4) {
+        // a quad's fan fails only when corner 0 or 2 is reflex, which flips one
+        // of its two triangles; the other diagonal is then inside
+        float e1[3], e2[3], e3[3];
+        for (int k = 0; k < 3; k++) {
+            e1[k] = pos[3 + k] - pos[k];
+            e2[k] = pos[6 + k] - pos[k];
+            e3[k] = pos[9 + k] - pos[k];
+        }
+        float a[3] = {
+            e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]
+        };
+        float b[3] = {
+            e2[1] * e3[2] - e2[2] * e3[1], e2[2] * e3[0] - e2[0] * e3[2], e2[0] * e3[1] - e2[1] * e3[0]
+        };
+        if (a[0] * b[0] + a[1] * b[1] + a[2] * b[2] >= 0) {
+            return 0;
+        }
+        int tris[] = {1, 2, 3, 1, 3, 0};
+        memcpy(scratch->tris, tris, sizeof(tris));
+        return 1;
+    }
+    float normal[3] = {0};
+    for (int i = 0; i < n; i++) {
+        const float *a = pos + 3 * i;
+        const float *b = pos + 3 * ((i + 1) % n);
+        normal[0] += (a[1] - b[1]) * (a[2] + b[2]);
+        normal[1] += (a[2] - b[2]) * (a[0] + b[0]);
+        normal[2] += (a[0] - b[0]) * (a[1] + b[1]);
+    }
+    int k = fabsf(normal[0]) > fabsf(normal[1]) ? 0 : 1;
+    k = fabsf(normal[2]) > fabsf(normal[k]) ? 2 : k;
+    if (normal[k] == 0) {                   // degenerate, nothing better than the fan
+        return 0;
+    }
+    int u = (k + 1) % 3;                    // drop the dominant axis, counterclockwise
+    int v = (k + 2) % 3;
+    if (normal[k] < 0) {
+        u = (k + 2) % 3;
+        v = (k + 1) % 3;
+    }
+    float *xy = scratch->xy;
+    for (int i = 0; i < n; i++) {
+        xy[2 * i] = pos[3 * i + u];
+        xy[2 * i + 1] = pos[3 * i + v];
+    }
+    float total = 0;
+    float worst = 0;
+    for (int i = 0; i < n; i++) {
+        float turn = cross2(xy, (i + n - 1) % n, i, (i + 1) % n);
+        total += fabsf(turn);
+        worst = turn < worst ? turn : worst;
+    }
+    if (worst >= -1e-6f * total) {
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        scratch->prev[i] = (i + n - 1) % n;
+        scratch->next[i] = (i + 1) % n;
+    }
+    int *tris = scratch->tris;
+    int i = 0;
+    int misses = 0;
+    for (int remaining = n; remaining > 3; remaining--) {
+        while (!is_ear(scratch, scratch->prev[i], i, scratch->next[i]) && misses++ < remaining) {
+            i = scratch->next[i];
+        }
+        if (misses > remaining) {           // self intersecting, fan what is left
+            for (int j = scratch->next[i]; scratch->next[j] != i; j = scratch->next[j]) {
+                *tris++ = i;
+                *tris++ = j;
+                *tris++ = scratch->next[j];
+            }
+            return 1;
+        }
+        int a = scratch->prev[i];
+        int c = scratch->next[i];
+        *tris++ = a;
+        *tris++ = i;
+        *tris++ = c;
+        scratch->next[a] = c;
+        scratch->prev[c] = a;
+        i = c;
+        misses = 0;
+    }
+    *tris++ = scratch->prev[i];
+    *tris++ = i;
+    *tris++ = scratch->next[i];
+    return 1;
+}
+
+// worker: triangulate the concave n-gons of a chunk again now that every
+// position is known, in place since the triangle count stays n - 2
+void *triangulate_chunk(void *arg) {
+    objchunk *chunk = arg;
+    objctx *ctx = chunk->out;
+    objscratch *scratch = &chunk->scratch;
+    for (int i = 0; i < chunk->nngons; i++) {
+        int *fptr = ctx->faces + 3 * (chunk->facevertbase + chunk->ngons[2 * i]);
+        int n = chunk->ngons[2 * i + 1];
+        scratch_reserve(scratch, n);
+        // the fan holds corner 0 and 1 once, then one new corner per triangle
+        memcpy(scratch->corners, fptr, 6 * sizeof(int));
+        for (int t = 0; t < n - 2; t++) {
+            memcpy(scratch->corners + 3 * (t + 2), fptr + 9 * t + 6, 3 * sizeof(int));
+        }
+        int valid = 1;
+        for (int c = 0; c < n; c++) {
+            int vert = scratch->corners[3 * c];
+            valid &= vert > 0 && vert <= ctx->nvertices;
+            if (valid) {
+                memcpy(scratch->pos + 3 * c, ctx->vertices + 3 * (vert - 1), 3 * sizeof(float));
+            }
+        }
+        if (!valid || !triangulate(scratch, n)) {
+            continue;
+        }
+        for (int t = 0; t < 3 * (n - 2); t++) {
+            memcpy(fptr + 3 * t, scratch->corners + 3 * scratch->tris[t], 3 * sizeof(int));
+        }
+    }
+    return NULL;
+}
+
+// parse one line of a chunk
+void parse_objline(void *arg, const char *p, const char *eol) {
+    objchunk *chunk = arg;
+    objctx *ctx = &chunk->ctx;
+    char s[512];
+    int key = objline_key(&p, eol);     // check the type of a line from its first bytes
+    switch (key) {
+    case F:
+        int nvert = 0;
+        for (p = skip_space(p); *p != '\n' && *p != '\r'; p = skip_space(p)) {
+            if (ctx->nfaceverts + nvert >= ctx->capfaceverts) {
+                ctx->faces = reserve(
+                    ctx->faces, &ctx->capfaceverts,
+                    ctx->nfaceverts + nvert + 1, 3 * sizeof(int)
+                );
+            }
+            p = parse_face(p, ctx->faces + 3 * (ctx->nfaceverts + nvert));
+            nvert++;
+        }
+        if (nvert > 3) {
+            ctx->faces = reserve(
+                ctx->faces, &ctx->capfaceverts,
+                ctx->nfaceverts + (nvert - 2) * 3, 3 * sizeof(int)
+            );
+        }
+        int *fptr = ctx->faces + 3 * ctx->nfaceverts;
+        if (nvert > 3) {
+            // concave faces are found once all positions are known
+            chunk->ngons = reserve(chunk->ngons, &chunk->capngons, chunk->nngons + 1, 2 * sizeof(int));
+            chunk->ngons[2 * chunk->nngons] = ctx->nfaceverts;
+            chunk->ngons[2 * chunk->nngons++ + 1] = nvert;
+            // fan in place from the last triangle, which never overwrites
+            // a vertex an earlier triangle still needs
+            for (int i = nvert - 3; i > 0; i--) {
+                memcpy(fptr + 9 * i + 6, fptr + 3 * (i + 2), 3 * sizeof(int));
+                memcpy(fptr + 9 * i + 3, fptr + 3 * (i + 1), 3 * sizeof(int));
+                memcpy(fptr + 9 * i + 0, fptr, 3 * sizeof(int));
+            }
+            nvert = (nvert - 2) * 3;
+        }
+        ctx->nfaceverts += nvert;
+        ctx->nfaces++;
+        break;
+    case MTLLIB:
+        parse_word(p, eol, s, sizeof(s), 1);
+        chunk->mtllibs = realloc(chunk->mtllibs, (chunk->nmtllibs + 1) * sizeof(char *));
+        chunk->mtllibs[chunk->nmtllibs++] = strdup(s);
+        break;
+    case O:
+        ctx->meshoffsets = reserve(
+            ctx->meshoffsets, &ctx->capmeshes, ctx->nmeshes + 2, sizeof(int)
+        );
+        ctx->mtlindices = realloc(ctx->mtlindices, ctx->capmeshes * sizeof(int));
+        ctx->mtlindices[ctx->nmeshes] = -1;
+        ctx->meshoffsets[ctx->nmeshes++] = ctx->nfaceverts;
+        break;
+    case S:
+        parse_word(p, eol, s, sizeof(s), 0);
+        chunk->smooth = reserve(chunk->smooth, &chunk->capsmooth, chunk->nsmooth + 1, 2 * sizeof(int));
+        chunk->smooth[2 * chunk->nsmooth] = ctx->nfaceverts;
+        chunk->smooth[2 * chunk->nsmooth++ + 1] = strcmp(s, "off") ? atoi(s) : 0;
+        break;
+    case USEMTL:
+        parse_word(p, eol, s, sizeof(s), 0);
+        chunk->usemtl = reserve(
+            chunk->usemtl, &chunk->capusemtl, chunk->nusemtl + 1, sizeof(objref)
+        );
+        chunk->usemtl[chunk->nusemtl++] = (objref){
+            .mesh = ctx->nmeshes - 1,
+            .offset = ctx->nfaceverts,
+            .name = strdup(s)
+        };
+        break;
+    case V:
+        ctx->vertices = reserve(
+            ctx->vertices, &ctx->capvertices, ctx->nvertices + 1, 3 * sizeof(float)
+        );
+        parse_floats(p, ctx->vertices + 3 * ctx->nvertices++, 3);
+        break;
+    case VN:
+        ctx->normals = reserve(
+            ctx->normals, &ctx->capnormals, ctx->nnormals + 1, 3 * sizeof(float)
+        );
+        parse_floats(p, ctx->normals + 3 * ctx->nnormals++, 3);
+        break;
+    case VT:
+        ctx->texcoords = reserve(
+            ctx->texcoords, &ctx->captexcoords, ctx->ntexcoords + 1, 2 * sizeof(float)
+        );
+        parse_floats(p, ctx->texcoords + 2 * ctx->ntexcoords++, 2);
+        break;
+    default:
+        break;
+    }
+}
+
+// worker: parse the lines of one chunk
+void *parse_chunk(void *arg) {
+    objchunk *chunk = arg;
+    parse_lines(chunk->begin, chunk->end, parse_objline, chunk);
+    return NULL;
+}
+
+// worker: copy chunk arrays to their final place, shifting mesh offsets
+void *merge_chunk(void *arg) {
+    objchunk *chunk = arg;
+    objctx *src = &chunk->ctx;
+    objctx *dst = chunk->out;
+    memcpy(dst->vertices + 3 * chunk->vertexbase,
+        src->vertices, 3 * src->nvertices * sizeof(float));
+    memcpy(dst->normals + 3 * chunk->normalbase,
+        src->normals, 3 * src->nnormals * sizeof(float));
+    memcpy(dst->texcoords + 2 * chunk->texcoordbase,
+        src->texcoords, 2 * src->ntexcoords * sizeof(float));
+    memcpy(dst->faces + 3 * chunk->facevertbase,
+        src->faces, 3 * src->nfaceverts * sizeof(int));
+    for (int i = 0; i < src->nmeshes; i++) {
+        dst->meshoffsets[chunk->meshbase + i] = src->meshoffsets[i] + chunk->facevertbase;
+        dst->mtlindices[chunk->meshbase + i] = -1;
+    }
+    return NULL;
+}
+
+// run a function on every chunk, the calling thread takes the first one
+void run_chunks(objchunk *chunks, int nchunks, void *(*func)(void *)) {
+    for (int i = 1; i < nchunks; i++) {
+        pthread_create(&chunks[i].thread, NULL, func, chunks + i);
+    }
+    func(chunks);
+    for (int i = 1; i < nchunks; i++) {
+        pthread_join(chunks[i].thread, NULL);
+    }
+}
+
+// set the material of a mesh by name
+unsigned hash_name(const char *s) {
+    unsigned h = 2166136261u;               // fnv-1a
+    for (; *s; s++) {
+        h = (h ^ (unsigned char) *s) * 16777619u;
+    }
+    return h;
+}
+
+const char *mtl_name(mtlctx *materials, int i) {
+    return materials->materials[i].name ? materials->materials[i].name : "";
+}
+
+// slot of name in the lookup table, either holding it or empty
+int material_slot(mtlctx *materials, const char *name) {
+    int mask = materials->capbuckets - 1;
+    int h = hash_name(name) & mask;
+    while (materials->buckets[h] >= 0 && strcmp(mtl_name(materials, materials->buckets[h]), name)) {
+        h = (h + 1) & mask;
+    }
+    return h;
+}
+
+// index of the last material with this name, -1 if there is none. the lookup
+// table catches up with materials added since the previous call
+int find_material(mtlctx *materials, const char *name) {
+    if (materials->nhashed < materials->nmaterials) {
+        if (2 * materials->nmaterials > materials->capbuckets) {
+            int cap = 16;
+            while (cap < 2 * materials->nmaterials) {
+                cap *= 2;
+            }
+            materials->buckets = realloc(materials->buckets, cap * sizeof(int));
+            memset(materials->buckets, -1, cap * sizeof(int));
+            materials->capbuckets = cap;
+            materials->nhashed = 0;
+        }
+        for (; materials->nhashed < materials->nmaterials; materials->nhashed++) {
+            // a later material with the same name replaces the earlier one
+            int i = materials->nhashed;
+            materials->buckets[material_slot(materials, mtl_name(materials, i))] = i;
+        }
+    }
+    if (!materials->capbuckets) {
+        return -1;
+    }
+    return materials->buckets[material_slot(materials, name)];
+}
+
+void resolve_usemtl(objctx *ctx, int mesh, char *name) {
+    if (mesh < 0) {
+        return;
+    }
+    int index = find_material(&ctx->materials, name);
+    if (index >= 0) {
+        ctx->mtlindices[mesh] = index;
+    }
+}
+
+// parse obj data split at line boundaries into one chunk per thread, the
+// elements are appended to whatever ctx already holds. return -1 if an mtl
+// file can't be read, the rest is parsed anyway
+int obj_parse(objctx *ctx, const char *data, size_t size, int nthreads) {
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    objchunk *chunks = calloc(nthreads, sizeof(objchunk));
+    const char *end = data + size;
+    const char *p = data;
+    int nchunks = 0;
+    for (int i = 0; i < nthreads && p < end; i++) {
+        const char *q = data + size / nthreads * (i + 1);
+        if (q < p) {
+            q = p;
+        }
+        q = i == nthreads - 1 || q >= end ? end : memchr(q, '\n', end - q);
+        q = q ? (q < end ? q + 1 : end) : end;
+        chunks[nchunks++] = (objchunk){ .begin = p, .end = q, .out = ctx };
+        p = q;
+    }
+    run_chunks(chunks, nchunks, parse_chunk);
+    int status = 0;
+    for (int i = 0; i < nchunks; i++) {         // prefix sums over chunk counts
+        objchunk *chunk = chunks + i;
+        chunk->vertexbase = ctx->nvertices;
+        chunk->normalbase = ctx->nnormals;
+        chunk->texcoordbase = ctx->ntexcoords;
+        chunk->facevertbase = ctx->nfaceverts;
+        chunk->meshbase = ctx->nmeshes;
+        ctx->nvertices += chunk->ctx.nvertices;
+        ctx->nnormals += chunk->ctx.nnormals;
+        ctx->ntexcoords += chunk->ctx.ntexcoords;
+        ctx->nfaceverts += chunk->ctx.nfaceverts;
+        ctx->nfaces += chunk->ctx.nfaces;
+        ctx->nmeshes += chunk->ctx.nmeshes;
+        for (int j = 0; j < chunk->nmtllibs; j++) {
+            status |= parse_materials(ctx, chunk->mtllibs[j]);
+        }
+    }
+    int empty = !ctx->vertices && !ctx->normals && !ctx->texcoords && !ctx->faces && !ctx->meshoffsets;
+    if (nchunks == 1 && empty) {                // a single chunk is moved, not copied
+        objctx *src = &chunks[0].ctx;
+        ctx->vertices = src->vertices;
+        ctx->normals = src->normals;
+        ctx->texcoords = src->texcoords;
+        ctx->faces = src->faces;
+        ctx->meshoffsets = src->meshoffsets;
+        ctx->mtlindices = src->mtlindices;
+        ctx->capmeshes = src->capmeshes;
+        *src = (objctx){0};
+    } else {
+        ctx->vertices = realloc(ctx->vertices, 3 * ctx->nvertices * sizeof(float) + 1);
+        ctx->normals = realloc(ctx->normals, 3 * ctx->nnormals * sizeof(float) + 1);
+        ctx->texcoords = realloc(ctx->texcoords, 2 * ctx->ntexcoords * sizeof(float) + 1);
+        ctx->faces = realloc(ctx->faces, 3 * ctx->nfaceverts * sizeof(int) + 1);
+        ctx->meshoffsets = realloc(ctx->meshoffsets, (ctx->nmeshes + 1) * sizeof(int));
+        ctx->mtlindices = realloc(ctx->mtlindices, (ctx->nmeshes + 1) * sizeof(int));
+        ctx->capmeshes = ctx->nmeshes + 1;
+        run_chunks(chunks, nchunks, merge_chunk);
+    }
+    run_chunks(chunks, nchunks, triangulate_chunk);
+    ctx->meshoffsets = reserve(ctx->meshoffsets, &ctx->capmeshes, ctx->nmeshes + 1, sizeof(int));
+    ctx->meshoffsets[ctx->nmeshes] = ctx->nfaceverts;
+    for (int i = 0; i < nchunks; i++) {
+        objchunk *chunk = chunks + i;
+        ctx->smooth = realloc(ctx->smooth, 2 * (ctx->nsmooth + chunk->nsmooth + 1) * sizeof(int));
+        for (int j = 0; j < chunk->nsmooth; j++) {
+            ctx->smooth[2 * ctx->nsmooth] = chunk->smooth[2 * j] + chunk->facevertbase;
+            ctx->smooth[2 * ctx->nsmooth++ + 1] = chunk->smooth[2 * j + 1];
+        }
+        free(chunk->smooth);
+        ctx->switches = realloc(ctx->switches, 2 * (ctx->nswitches + chunk->nusemtl + 1) * sizeof(int));
+        for (int j = 0; j < chunk->nusemtl; j++) {
+            // usemtl before the first o of a chunk belongs to the previous chunk's last mesh
+            resolve_usemtl(ctx, chunk->meshbase + chunk->usemtl[j].mesh, chunk->usemtl[j].name);
+            ctx->switches[2 * ctx->nswitches] = chunk->usemtl[j].offset + chunk->facevertbase;
+            ctx->switches[2 * ctx->nswitches++ + 1] = find_material(&ctx->materials, chunk->usemtl[j].name);
+            free(chunk->usemtl[j].name);
+        }
+        free(chunk->usemtl);
+        for (int j = 0; j < chunk->nmtllibs; j++) {
+            free(chunk->mtllibs[j]);
+        }
+        free(chunk->mtllibs);
+        free(chunk->ngons);
+        scratch_free(&chunk->scratch);
+        free(chunk->ctx.vertices);
+        free(chunk->ctx.normals);
+        free(chunk->ctx.texcoords);
+        free(chunk->ctx.faces);
+        free(chunk->ctx.meshoffsets);
+        free(chunk->ctx.mtlindices);
+    }
+    free(chunks);
+    return status;
+}
+
+typedef struct {
+    int       begin;
+    int       end;
+    void      *arg;
+    void      (*func)(void *arg, int begin, int end);
+    pthread_t thread;
+} objrange;
+
+void *range_worker(void *arg) {
+    objrange *range = arg;
+    range->func(range->arg, range->begin, range->end);
+    return NULL;
+}
+
+// split [0, n) into one range per thread, the calling thread takes the first
+void run_ranges(int n, int nthreads, void (*func)(void *, int, int), void *arg) {
+    nthreads = nthreads < 1 ? 1 : nthreads > 64 ? 64 : nthreads;
+    objrange ranges[64];
+    for (int i = 0; i < nthreads; i++) {
+        ranges[i] = (objrange){
+            .begin = (long) n * i / nthreads, .end = (long) n * (i + 1) / nthreads,
+            .arg = arg, .func = func
+        };
+    }
+    for (int i = 1; i < nthreads; i++) {
+        pthread_create(&ranges[i].thread, NULL, range_worker, ranges + i);
+    }
+    range_worker(ranges);
+    for (int i = 1; i < nthreads; i++) {
+        pthread_join(ranges[i].thread, NULL);
+    }
+}
+
+// state shared by the passes of the smooth normal generation
+typedef struct {
+    objctx *ctx;
+    float  cosangle;        // corners of faces bent further apart don't share normals
+    int    *groups;         // smoothing group of each triangle, 0 for flat
+    float  *facenormals;    // unit normal of each triangle
+    float  *weights;        // triangle area times corner angle, per face vertex
+    int    *starts;         // first entry of each position in corners
+    int    *cursors;
+    int    *corners;        // face vertices grouped by position
+    float  *normals;        // generated normal of each face vertex
+    int    *slots;          // distinct normal of each face vertex within its position
+    int    *distinct;       // distinct normals per position, then the first output index
+    int    base;            // first generated normal in ctx->normals
+    int    missing;
+} normalpass;
+
+int position_of(objctx *ctx, int corner) {
+    int vert = ctx->faces[3 * corner];
+    return vert > 0 && vert <= ctx->nvertices ? vert - 1 : -1;
+}
+
+// face normals and corner weights, and the number of face vertices per position
+void normals_faces(void *arg, int begin, int end) {
+    normalpass *pass = arg;
+    objctx *ctx = pass->ctx;
+    int missing = 0;
+    for (int t = begin; t < end; t++) {
+        int vert[3];
+        const float *p[3];
+        int valid = 1;
+        for (int k = 0; k < 3; k++) {
+            vert[k] = position_of(ctx, 3 * t + k);
+            valid &= vert[k] >= 0;
+            p[k] = valid ? ctx->vertices + 3 * vert[k] : NULL;
+            missing += !ctx->faces[9 * t + 3 * k + 2];
+        }
+        float *n = pass->facenormals + 3 * t;
+        n[0] = n[1] = n[2] = 0;
+        pass->weights[3 * t] = pass->weights[3 * t + 1] = pass->weights[3 * t + 2] = 0;
+        if (!valid) {
+            continue;
+        }
+        float e[3][3];
+        for (int k = 0; k < 3; k++) {
+            for (int j = 0; j < 3; j++) {
+                e[k][j] = p[(k + 1) % 3][j] - p[k][j];
+            }
+        }
+        n[0] = e[0][1] * e[1][2] - e[0][2] * e[1][1];
+        n[1] = e[0][2] * e[1][0] - e[0][0] * e[1][2];
+        n[2] = e[0][0] * e[1][1] - e[0][1] * e[1][0];
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length > 0) {
+            n[0] /= length, n[1] /= length, n[2] /= length;
+        }
+        for (int k = 0; k < 3; k++) {
+            // the angle between the edge out of the corner and the reversed edge into it
+            const float *a = e[k];
+            const float *b = e[(k + 2) % 3];
+            float dot = -(a[0] * b[0] + a[1] * b[1] + a[2] * b[2]);
+            float cross = sqrtf(fmaxf(0, (a[0] * a[0] + a[1] * a[1] + a[2] * a[2])
+                * (b[0] * b[0] + b[1] * b[1] + b[2] * b[2]) - dot * dot));
+            pass->weights[3 * t + k] = length / 2 * atan2f(cross, dot);
+            __atomic_fetch_add(pass->starts + vert[k], 1, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_fetch_add(&pass->missing, missing, __ATOMIC_RELAXED);
+}
+
+// place every face vertex in the list of its position
+void normals_lists(void *arg, int begin, int end) {
+    normalpass *pass = arg;
+    for (int c = begin; c < end; c++) {
+        int t = c / 3;
+        int vert = position_of(pass->ctx, c);
+        if (position_of(pass->ctx, 3 * t) >= 0 && position_of(pass->ctx, 3 * t + 1) >= 0
+            && position_of(pass->ctx, 3 * t + 2) >= 0) {
+            pass->corners[__atomic_fetch_add(pass->cursors + vert, 1, __ATOMIC_RELAXED)] = c;
+        }
+    }
+}
+
+// a face vertex of one position, sorted by smoothing group or by generated normal
+typedef struct {
+    int   group;
+    int   corner;
+    float normal[3];
+} cornerkey;
+
+int corner_compare(const void *a, const void *b) {
+    int ca = *(const int *) a;
+    int cb = *(const int *) b;
+    return (ca > cb) - (ca < cb);
+}
+
+int group_compare(const void *a, const void *b) {
+    const cornerkey *ka = a;
+    const cornerkey *kb = b;
+    if (ka->group != kb->group) {
+        return (ka->group > kb->group) - (ka->group < kb->group);
+    }
+    return (ka->corner > kb->corner) - (ka->corner < kb->corner);
+}
+
+int normal_compare(const void *a, const void *b) {
+    const cornerkey *ka = a;
+    const cornerkey *kb = b;
+    for (int k = 0; k < 3; k++) {
+        if (ka->normal[k] != kb->normal[k]) {
+            return (ka->normal[k] > kb->normal[k]) - (ka->normal[k] < kb->normal[k]);
+        }
+    }
+    return (ka->corner > kb->corner) - (ka->corner < kb->corner);
+}
+
+// normals of the face vertices in one run of a position and smoothing group,
+// sorted by face vertex so the sums don't depend on thread timing
+void normals_run(normalpass *pass, const cornerkey *keys, int n) {
+    objctx *ctx = pass->ctx;
+    if (!keys[0].group) {
+        for (int i = 0; i < n; i++) {
+            int c = keys[i].corner;
+            if (!ctx->faces[3 * c + 2]) {
+                memcpy(pass->normals + 3 * c, pass->facenormals + 3 * (c / 3), 3 * sizeof(float));
+            }
+        }
+        return;
+    }
+    // when the faces fit in a cone of half the crease angle every face is
+    // within the crease of every other, so all of them share one sum
+    int cone = pass->cosangle < -1;
+    if (!cone) {
+        float axis[3] = { 0, 0, 0 };
+        for (int i = 0; i < n; i++) {
+            const float *fn = pass->facenormals + 3 * (keys[i].corner / 3);
+            axis[0] += fn[0], axis[1] += fn[1], axis[2] += fn[2];
+        }
+        float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        float least = -1;
+        if (length > 0) {
+            least = 1;
+            for (int i = 0; i < n; i++) {
+                const float *fn = pass->facenormals + 3 * (keys[i].corner / 3);
+                least = fminf(least, (fn[0] * axis[0] + fn[1] * axis[1] + fn[2] * axis[2]) / length);
+            }
+        }
+        // leave a margin for the rounding of the dot products
+        float spread = 2 * acosf(fmaxf(-1, least)) + 1e-3f;
+        cone = spread < M_PI && cosf(spread) >= pass->cosangle;
+    }
+    float sum[3] = { 0, 0, 0 };
+    if (cone) {
+        for (int i = 0; i < n; i++) {
+            const float *on = pass->facenormals + 3 * (keys[i].corner / 3);
+            float w = pass->weights[keys[i].corner];
+            sum[0] += w * on[0], sum[1] += w * on[1], sum[2] += w * on[2];
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        int c = keys[i].corner;
+        if (ctx->faces[3 * c + 2]) {
+            continue;
+        }
+        const float *fn = pass->facenormals + 3 * (c / 3);
+        float *out = pass->normals + 3 * c;
+        if (cone) {
+            memcpy(out, sum, 3 * sizeof(float));
+        } else {
+            // a run wider than the crease angle falls back to comparing every pair
+            out[0] = out[1] = out[2] = 0;
+            for (int j = 0; j < n; j++) {
+                const float *on = pass->facenormals + 3 * (keys[j].corner / 3);
+                if (fn[0] * on[0] + fn[1] * on[1] + fn[2] * on[2] >= pass->cosangle) {
+                    float w = pass->weights[keys[j].corner];
+                    out[0] += w * on[0], out[1] += w * on[1], out[2] += w * on[2];
+                }
+            }
+        }
+        float length = sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+        if (length > 0) {
+            out[0] /= length, out[1] /= length, out[2] /= length;
+        } else {
+            memcpy(out, fn, 3 * sizeof(float));
+        }
+    }
+}
+
+// normal of every face vertex without vn: the weighted face normals of the
+// face vertices at the same position in the same smoothing group whose faces
+// are within the crease angle. each one is a gather, so there are no write
+// conflicts. the corners of a position are sorted once by smoothing group and
+// then by normal, which keeps high valence positions like fan centres linear
+// up to the sort
+void normals_corners(void *arg, int begin, int end) {
+    normalpass *pass = arg;
+    objctx *ctx = pass->ctx;
+    int most = 0;
+    for (int v = begin; v < end; v++) {
+        int n = pass->starts[v + 1] - pass->starts[v];
+        most = n > most ? n : most;
+    }
+    cornerkey *keys = malloc(most * sizeof(cornerkey) + 1);
+    for (int v = begin; v < end; v++) {
+        int *list = pass->corners + pass->starts[v];
+        int n = pass->starts[v + 1] - pass->starts[v];
+        qsort(list, n, sizeof(int), corner_compare);
+        for (int i = 0; i < n; i++) {
+            keys[i] = (cornerkey){ .group = pass->groups[list[i] / 3], .corner = list[i] };
+        }
+        qsort(keys, n, sizeof(cornerkey), group_compare);
+        for (int run = 0, next; run < n; run = next) {
+            for (next = run + 1; next < n && keys[next].group == keys[run].group; next++);
+            normals_run(pass, keys + run, next - run);
+        }
+        // equal normals share the slot of the first face vertex that has them
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            int c = list[i];
+            if (!ctx->faces[3 * c + 2]) {
+                keys[m] = (cornerkey){ .corner = c };
+                memcpy(keys[m++].normal, pass->normals + 3 * c, 3 * sizeof(float));
+            }
+        }
+        qsort(keys, m, sizeof(cornerkey), normal_compare);
+        for (int i = 0, first = 0; i < m; i++) {
+            const float *a = keys[first].normal;
+            const float *b = keys[i].normal;
+            if (a[0] != b[0] || a[1] != b[1] || a[2] != b[2]) {
+                first = i;
+            }
+            pass->slots[keys[i].corner] = keys[first].corner;
+        }
+        int distinct = 0;
+        for (int i = 0; i < n; i++) {
+            int c = list[i];
+            if (!ctx->faces[3 * c + 2]) {
+                int first = pass->slots[c];
+                pass->slots[c] = first == c ? distinct++ : pass->slots[first];
+            }
+        }
+        pass->distinct[v] = distinct;
+    }
+    free(keys);
+}
+
+// write the distinct normals of each position and point the face vertices at them
+void normals_write(void *arg, int begin, int end) {
+    normalpass *pass = arg;
+    objctx *ctx = pass->ctx;
+    for (int v = begin; v < end; v++) {
+        int *list = pass->corners + pass->starts[v];
+        int n = pass->starts[v + 1] - pass->starts[v];
+        for (int i = 0; i < n; i++) {
+            int c = list[i];
+            if (ctx->faces[3 * c + 2]) {
+                continue;
+            }
+            int index = pass->base + pass->distinct[v] + pass->slots[c];
+            memcpy(ctx->normals + 3 * index, pass->normals + 3 * c, 3 * sizeof(float));
+            ctx->faces[3 * c + 2] = index + 1;
+        }
+    }
+}
+
+// generate area and angle weighted smooth normals for the face vertices that
+// have no vn, respecting s groups and the crease angle, with nthreads threads
+void obj_normals(objctx *ctx, float crease, int nthreads) {
+    int ntris = ctx->nfaceverts / 3;
+    normalpass pass = {
+        .ctx = ctx,
+        .cosangle = crease >= 180 ? -2 : cosf(crease * M_PI / 180),
+        .groups = malloc(ntris * sizeof(int) + 1),
+        .facenormals = malloc(3 * ntris * sizeof(float) + 1),
+        .weights = malloc(ctx->nfaceverts * sizeof(float) + 1),
+        .starts = calloc(ctx->nvertices + 1, sizeof(int)),
+    };
+    // without s lines everything is one smooth group
+    int group = 1;
+    for (int t = 0, e = 0; t < ntris; t++) {
+        for (; e < ctx->nsmooth && ctx->smooth[2 * e] <= 3 * t; e++) {
+            group = ctx->smooth[2 * e + 1];
+        }
+        pass.groups[t] = group;
+    }
+    run_ranges(ntris, nthreads, normals_faces, &pass);
+    if (!pass.missing) {
+        free(pass.groups);
+        free(pass.facenormals);
+        free(pass.weights);
+        free(pass.starts);
+        return;
+    }
+    int sum = 0;
+    for (int v = 0; v <= ctx->nvertices; v++) {     // counts to list starts
+        int count = pass.starts[v];
+        pass.starts[v] = sum;
+        sum += v < ctx->nvertices ? count : 0;
+    }
+    pass.cursors = malloc((ctx->nvertices + 1) * sizeof(int));
+    memcpy(pass.cursors, pass.starts, (ctx->nvertices + 1) * sizeof(int));
+    pass.corners = malloc(sum * sizeof(int) + 1);
+    run_ranges(ntris * 3, nthreads, normals_lists, &pass);
+    pass.normals = malloc(3 * ctx->nfaceverts * sizeof(float) + 1);
+    pass.slots = malloc(ctx->nfaceverts * sizeof(int) + 1);
+    pass.distinct = malloc((ctx->nvertices + 1) * sizeof(int));
+    run_ranges(ctx->nvertices, nthreads, normals_corners, &pass);
+    sum = 0;
+    for (int v = 0; v < ctx->nvertices; v++) {
+        int count = pass.distinct[v];
+        pass.distinct[v] = sum;
+        sum += count;
+    }
+    pass.base = ctx->nnormals;
+    ctx->nnormals += sum;
+    ctx->normals = realloc(ctx->normals, 3 * ctx->nnormals * sizeof(float) + 1);
+    run_ranges(ctx->nvertices, nthreads, normals_write, &pass);
+    free(pass.groups);
+    free(pass.facenormals);
+    free(pass.weights);
+    free(pass.starts);
+    free(pass.cursors);
+    free(pass.corners);
+    free(pass.normals);
+    free(pass.slots);
+    free(pass.distinct);
+}
+
+// merge neighbouring meshes of the same material into draw ranges
+void obj_draws(objctx *ctx) {
+    free(ctx->draws);
+    ctx->draws = malloc((ctx->nmeshes + 1) * sizeof(objdraw));
+    ctx->ndraws = 0;
+    for (int m = -1; m < ctx->nmeshes; m++) {
+        // faces before the first o have no material
+        int begin = m < 0 ? 0 : ctx->meshoffsets[m];
+        int end = ctx->meshoffsets[m + 1];
+        int material = m < 0 ? -1 : ctx->mtlindices[m];
+        objdraw *last = ctx->ndraws ? ctx->draws + ctx->ndraws - 1 : NULL;
+        if (begin == end) {
+            continue;
+        }
+        if (last && last->material == material) {
+            last->count += end - begin;
+            last->nmeshes = m - last->mesh + 1;
+        } else {
+            ctx->draws[ctx->ndraws++] = (objdraw){ material, begin, end - begin, m, 1 };
+        }
+    }
+}
+
+// split the meshes at every usemtl and move the faces so each material is one
+// contiguous range, materials in order of first use and their ranges in file
+// order. the split ranges become the meshes, the s and usemtl offsets no longer
+// match the faces and are dropped
+void obj_batch(objctx *ctx) {
+    // offset, count, material and source mesh of each range
+    int *ranges = malloc(4 * (ctx->nmeshes + ctx->nswitches + 1) * sizeof(int));
+    int nranges = 0;
+    int material = -1;
+    for (int m = -1, e = 0; m < ctx->nmeshes; m++) {
+        int begin = m < 0 ? 0 : ctx->meshoffsets[m];
+        int end = ctx->meshoffsets[m + 1];
+        while (begin < end) {
+            for (; e < ctx->nswitches && ctx->switches[2 * e] <= begin; e++) {
+                material = ctx->switches[2 * e + 1];
+            }
+            int next = e < ctx->nswitches && ctx->switches[2 * e] < end ? ctx->switches[2 * e] : end;
+            int *last = nranges ? ranges + 4 * (nranges - 1) : NULL;
+            if (last && last[2] == material && last[3] == m) {     // repeated usemtl
+                last[1] += next - begin;
+            } else {
+                int *range = ranges + 4 * nranges++;
+                range[0] = begin;
+                range[1] = next - begin;
+                range[2] = material;
+                range[3] = m;
+            }
+            begin = next;
+        }
+    }
+    // stable counting sort of the ranges by the rank of their material
+    int nmaterials = ctx->materials.nmaterials;
+    int *ranks = malloc((nmaterials + 1) * sizeof(int));
+    int *starts = calloc(nmaterials + 2, sizeof(int));
+    memset(ranks, -1, (nmaterials + 1) * sizeof(int));
+    int nranks = 0;
+    for (int i = 0; i < nranges; i++) {
+        int *rank = ranks + ranges[4 * i + 2] + 1;
+        if (*rank < 0) {
+            *rank = nranks++;
+        }
+        starts[*rank + 1]++;
+    }
+    for (int i = 0; i < nranks; i++) {
+        starts[i + 1] += starts[i];
+    }
+    int *order = malloc(nranges * sizeof(int) + 1);
+    for (int i = 0; i < nranges; i++) {
+        order[starts[ranks[ranges[4 * i + 2] + 1]]++] = i;
+    }
+    int *faces = malloc(3 * ctx->nfaceverts * sizeof(int) + 1);
+    ctx->capmeshes = nranges + 1;
+    ctx->meshoffsets = realloc(ctx->meshoffsets, ctx->capmeshes * sizeof(int));
+    ctx->mtlindices = realloc(ctx->mtlindices, ctx->capmeshes * sizeof(int));
+    int offset = 0;
+    for (int i = 0; i < nranges; i++) {
+        int *range = ranges + 4 * order[i];
+        memcpy(faces + 3 * offset, ctx->faces + 3 * range[0], 3 * range[1] * sizeof(int));
+        ctx->meshoffsets[i] = offset;
+        ctx->mtlindices[i] = range[2];
+        offset += range[1];
+    }
+    ctx->nmeshes = nranges;
+    ctx->meshoffsets[nranges] = offset;
+    free(ctx->faces);
+    ctx->faces = faces;
+    free(ctx->smooth);
+    ctx->smooth = NULL;
+    ctx->nsmooth = 0;
+    free(ctx->switches);
+    ctx->switches = NULL;
+    ctx->nswitches = 0;
+    free(ranges);
+    free(ranks);
+    free(starts);
+    free(order);
+    obj_draws(ctx);
+}
+
+// write the position, texcoord and normal of a face vertex into 8 floats
+void fill_vertex(objctx *ctx, float *bptr, const int *fptr) {
+    int vert = fptr[0];
+    int texc = fptr[1];
+    int norm = fptr[2];
+    if (vert) {
+        memcpy(bptr, ctx->vertices + 3 * (vert - 1), 3 * sizeof(float));
+    }
+    if (texc) {
+        memcpy(bptr + 3, ctx->texcoords + 2 * (texc - 1), 2 * sizeof(float));
+    }
+    if (norm) {
+        memcpy(bptr + 5, ctx->normals + 3 * (norm - 1), 3 * sizeof(float));
+    }
+}
+
+void build_buffer(objctx *ctx) {
+    ctx->buffer = calloc(8 * ctx->nfaceverts, sizeof(float));
+    for (int i = 0; i < ctx->nfaceverts; i++) {
+        fill_vertex(ctx, ctx->buffer + 8 * i, ctx->faces + 3 * i);
+    }
+}
+
+unsigned hash_facevert(const int *fptr) {
+    unsigned h = fptr[0] * 0x9e3779b1u;
+    h = (h ^ fptr[1]) * 0x85ebca77u;
+    h = (h ^ fptr[2]) * 0xc2b2ae3du;
+    return h ^ h >> 16;
+}
+
+// weld identical (v, vt, vn) triples into a unique vertex buffer plus an index
+// buffer, indices are 16 bit whenever the unique vertex count allows it
+void build_indexed(objctx *ctx) {
+    int size = 64;
+    while (size < 2 * ctx->nfaceverts) {
+        size *= 2;
+    }
+    int *table = malloc(size * sizeof(int));    // open addressing, unique vertex or -1
+    memset(table, -1, size * sizeof(int));
+    int *first = malloc(ctx->nfaceverts * sizeof(int) + 1);  // first face vertex of each unique one
+    uint32_t *remap = malloc(ctx->nfaceverts * sizeof(uint32_t) + 1);
+    ctx->nunique = 0;
+    for (int i = 0; i < ctx->nfaceverts; i++) {
+        int *fptr = ctx->faces + 3 * i;
+        unsigned h = hash_facevert(fptr) & (size - 1);
+        while (table[h] >= 0 && memcmp(ctx->faces + 3 * first[table[h]], fptr, 3 * sizeof(int))) {
+            h = (h + 1) & (size - 1);
+        }
+        if (table[h] < 0) {
+            table[h] = ctx->nunique;
+            first[ctx->nunique++] = i;
+        }
+        remap[i] = table[h];
+    }
+    ctx->vbuffer = calloc(8 * ctx->nunique + 1, sizeof(float));
+    for (int i = 0; i < ctx->nunique; i++) {
+        fill_vertex(ctx, ctx->vbuffer + 8 * i, ctx->faces + 3 * first[i]);
+    }
+    ctx->indexsize = ctx->nunique <= UINT16_MAX ? 2 : 4;
+    if (ctx->indexsize == 2) {                  // narrow in place, writes never pass reads
+        uint16_t *narrow = (uint16_t *) remap;
+        for (int i = 0; i < ctx->nfaceverts; i++) {
+            narrow[i] = remap[i];
+        }
+        remap = realloc(remap, ctx->nfaceverts * sizeof(uint16_t) + 1);
+    }
+    ctx->indices = remap;
+    free(table);
+    free(first);
+}
+
+// index of face vertex i in the indexed buffer
+int obj_index(objctx *ctx, int i) {
+    if (ctx->indexsize == 2) {
+        return ((uint16_t *) ctx->indices)[i];
+    }
+    return ((uint32_t *) ctx->indices)[i];
+}
+
+#define cache_size 16        // fifo size for the cache statistics
+#define forsyth_size 32      // lru size the triangle scores are tuned for
+
+// average cache misses per triangle and per vertex for a fifo cache
+void cache_stats(const uint32_t *idx, int n, int nverts, float *acmr, float *atvr) {
+    unsigned *stamp = calloc(nverts + 1, sizeof(unsigned));
+    unsigned time = cache_size + 1;
+    int misses = 0;
+    int used = 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t v = idx[i];
+        used += !stamp[v];
+        if (time - stamp[v] > cache_size) {
+            stamp[v] = time++;
+            misses++;
+        }
+    }
+    *acmr = n ? 3.0f * misses / n : 0;
+    *atvr = used ? (float) misses / used : 0;
+    free(stamp);
+}
+
+float forsyth_cache[forsyth_size];
+float forsyth_valence[64];
+
+void forsyth_init(void) {
+    for (int i = 0; i < forsyth_size; i++) {
+        // the last triangle's vertices get a fixed score so it isn't repeated
+        forsyth_cache[i] = i < 3 ? 0.75f : powf(1 - (i - 3) / (float) (forsyth_size - 3), 1.5f);
+    }
+    for (int i = 1; i < 64; i++) {
+        forsyth_valence[i] = 2.0f / sqrtf(i);   // favour vertices with few triangles left
+    }
+}
+
+float forsyth_score(int pos, int live) {
+    if (!live) {
+        return -1;
+    }
+    return (pos < 0 ? 0 : forsyth_cache[pos]) + forsyth_valence[live < 64 ? live : 63];
+}
+
+// greedily emit the triangle with the best vertex scores, Tom Forsyth's
+// linear speed vertex cache optimisation, on triangles [0, ntris) of idx
+void optimize_cache(uint32_t *idx, int ntris, int nverts) {
+    int *live = calloc(nverts + 1, sizeof(int));
+    for (int i = 0; i < 3 * ntris; i++) {
+        live[idx[i]]++;
+    }
+    int *start = malloc((nverts + 1) * sizeof(int));   // triangles of each vertex
+    int sum = 0;
+    for (int v = 0; v < nverts; v++) {
+        start[v] = sum;
+        sum += live[v];
+    }
+    start[nverts] = sum;
+    int *adj = malloc(3 * ntris * sizeof(int) + 1);
+    int *fill = calloc(nverts + 1, sizeof(int));
+    for (int i = 0; i < 3 * ntris; i++) {
+        adj[start[idx[i]] + fill[idx[i]]++] = i / 3;
+    }
+    int *pos = malloc((nverts + 1) * sizeof(int));
+    float *vscore = malloc((nverts + 1) * sizeof(float));
+    for (int v = 0; v < nverts; v++) {
+        pos[v] = -1;
+        vscore[v] = forsyth_score(-1, live[v]);
+    }
+    float *tscore = malloc(ntris * sizeof(float) + 1);
+    char *emitted = calloc(ntris + 1, 1);
+    for (int t = 0; t < ntris; t++) {
+        tscore[t] = vscore[idx[3 * t]] + vscore[idx[3 * t + 1]] + vscore[idx[3 * t + 2]];
+    }
+    uint32_t *out = malloc(3 * ntris * sizeof(uint32_t) + 1);
+    int cache[forsyth_size + 3];
+    int ncache = 0;
+    int cursor = 0;
+    int best = ntris ? 0 : -1;
+    for (int t = 1; t < ntris; t++) {
+        best = tscore[t] > tscore[best] ? t : best;
+    }
+    for (int n = 0; n < ntris; n++) {
+        if (best < 0) {             // nothing adjacent to the cache, take the next one in order
+            while (emitted[cursor]) {
+                cursor++;
+            }
+            best = cursor;
+        }
+        memcpy(out + 3 * n, idx + 3 * best, 3 * sizeof(uint32_t));
+        emitted[best] = 1;
+        int next[forsyth_size + 3];
+        int nnext = 0;
+        for (int k = 0; k < 3; k++) {
+            int v = idx[3 * best + k];
+            for (int j = start[v]; j < start[v] + live[v]; j++) {
+                if (adj[j] == best) {   // drop the triangle from the vertex list
+                    adj[j] = adj[start[v] + --live[v]];
+                    break;
+                }
+            }
+            if (pos[v] != -2) {
+                next[nnext++] = v;
+                pos[v] = -2;        // marks vertices already in the new cache
+            }
+        }
+        for (int i = 0; i < ncache; i++) {
+            if (pos[cache[i]] != -2) {
+                next[nnext++] = cache[i];
+            }
+        }
+        for (int i = 0; i < nnext; i++) {
+            int v = next[i];
+            pos[v] = i < forsyth_size ? i : -1;
+            vscore[v] = forsyth_score(pos[v], live[v]);
+        }
+        best = -1;
+        float bestscore = 0;
+        for (int i = 0; i < nnext; i++) {
+            int v = next[i];
+            for (int j = start[v]; j < start[v] + live[v]; j++) {
+                int t = adj[j];
+                tscore[t] = vscore[idx[3 * t]] + vscore[idx[3 * t + 1]] + vscore[idx[3 * t + 2]];
+                if (tscore[t] > bestscore) {
+                    bestscore = tscore[t];
+                    best = t;
+                }
+            }
+        }
+        ncache = nnext < forsyth_size ? nnext : forsyth_size;
+        memcpy(cache, next, ncache * sizeof(int));
+    }
+    memcpy(idx, out, 3 * ntris * sizeof(uint32_t));
+    free(live);
+    free(start);
+    free(adj);
+    free(fill);
+    free(pos);
+    free(vscore);
+    free(tscore);
+    free(emitted);
+    free(out);
+}
+
+typedef struct {
+    int   start;        // first triangle and triangle count of the cluster
+    int   ntris;
+    float sort;
+} objcluster;
+
+int cluster_compare(const void *a, const void *b) {
+    float sa = ((const objcluster *) a)->sort;
+    float sb = ((const objcluster *) b)->sort;
+    return (sa < sb) - (sa > sb);
+}
+
+// split cache optimized triangles into clusters where the cache restarts and
+// draw clusters facing away from the mesh centre first, so they occlude the rest
+void optimize_overdraw(float *vbuffer, uint32_t *idx, int ntris, int nverts) {
+    if (ntris < 2) {
+        return;
+    }
+    objcluster *clusters = malloc(ntris * sizeof(objcluster));
+    int nclusters = 0;
+    unsigned *stamp = calloc(nverts + 1, sizeof(unsigned));
+    unsigned time = cache_size + 1;
+    for (int t = 0; t < ntris; t++) {
+        int misses = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = idx[3 * t + k];
+            if (time - stamp[v] > cache_size) {
+                stamp[v] = time++;
+                misses++;
+            }
+        }
+        if (!t || misses == 3) {
+            clusters[nclusters++] = (objcluster){ .start = t };
+        }
+        clusters[nclusters - 1].ntris++;
+    }
+    free(stamp);
+    float centre[3] = {0};
+    float (*normal)[3] = calloc(nclusters, sizeof(*normal));
+    float (*centroid)[3] = calloc(nclusters, sizeof(*centroid));
+    for (int c = 0; c < nclusters; c++) {
+        for (int t = clusters[c].start; t < clusters[c].start + clusters[c].ntris; t++) {
+            float *a = vbuffer + 8 * idx[3 * t];
+            float *b = vbuffer + 8 * idx[3 * t + 1];
+            float *d = vbuffer + 8 * idx[3 * t + 2];
+            float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+            float e2[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+            normal[c][0] += e1[1] * e2[2] - e1[2] * e2[1];     // area weighted
+            normal[c][1] += e1[2] * e2[0] - e1[0] * e2[2];
+            normal[c][2] += e1[0] * e2[1] - e1[1] * e2[0];
+            for (int k = 0; k < 3; k++) {
+                float mid = (a[k] + b[k] + d[k]) / 3;
+                centroid[c][k] += mid / clusters[c].ntris;
+                centre[k] += mid / ntris;
+            }
+        }
+    }
+    for (int c = 0; c < nclusters; c++) {
+        float length = sqrtf(normal[c][0] * normal[c][0] + normal[c][1] * normal[c][1]
+            + normal[c][2] * normal[c][2]);
+        float sort = 0;
+        for (int k = 0; k < 3; k++) {
+            sort += (centroid[c][k] - centre[k]) * normal[c][k];
+        }
+        clusters[c].sort = length > 0 ? sort / length : 0;
+    }
+    qsort(clusters, nclusters, sizeof(objcluster), cluster_compare);
+    uint32_t *out = malloc(3 * ntris * sizeof(uint32_t));
+    uint32_t *optr = out;
+    for (int c = 0; c < nclusters; c++) {
+        memcpy(optr, idx + 3 * clusters[c].start, 3 * clusters[c].ntris * sizeof(uint32_t));
+        optr += 3 * clusters[c].ntris;
+    }
+    memcpy(idx, out, 3 * ntris * sizeof(uint32_t));
+    free(out);
+    free(normal);
+    free(centroid);
+    free(clusters);
+}
+
+// renumber vertices in order of first use so fetches walk the buffer forward
+void optimize_fetch(objctx *ctx, uint32_t *idx) {
+    int *remap = malloc((ctx->nunique + 1) * sizeof(int));
+    memset(remap, -1, (ctx->nunique + 1) * sizeof(int));
+    float *vbuffer = calloc(8 * ctx->nunique + 1, sizeof(float));
+    int next = 0;
+    for (int i = 0; i < ctx->nfaceverts; i++) {
+        if (remap[idx[i]] < 0) {
+            memcpy(vbuffer + 8 * next, ctx->vbuffer + 8 * idx[i], 8 * sizeof(float));
+            remap[idx[i]] = next++;
+        }
+        idx[i] = remap[idx[i]];
+    }
+    free(ctx->vbuffer);
+    ctx->vbuffer = vbuffer;
+    free(remap);
+}
+
+// reorder the triangles of each mesh for the vertex cache and then for
+// overdraw, then the vertices for fetch locality; draw ranges stay intact
+void obj_optimize(objctx *ctx) {
+    uint32_t *idx = malloc(ctx->nfaceverts * sizeof(uint32_t) + 1);
+    for (int i = 0; i < ctx->nfaceverts; i++) {
+        idx[i] = obj_index(ctx, i);
+    }
+    cache_stats(idx, ctx->nfaceverts, ctx->nunique, &ctx->acmr[0], &ctx->atvr[0]);
+    forsyth_init();
+    // each mesh is renumbered to its own vertices first, so the passes cost
+    // what the mesh has and not what the whole buffer has
+    int *local = malloc(ctx->nunique * sizeof(int) + 1);    // mesh vertex of each buffer vertex
+    memset(local, -1, ctx->nunique * sizeof(int));
+    uint32_t *ids = malloc(ctx->nunique * sizeof(uint32_t) + 1);
+    for (int m = -1; m < ctx->nmeshes; m++) {
+        // faces before the first o are drawn as a range of their own
+        int begin = m < 0 ? 0 : ctx->meshoffsets[m];
+        int end = m < 0 ? (ctx->nmeshes ? ctx->meshoffsets[0] : ctx->nfaceverts) : ctx->meshoffsets[m + 1];
+        int ntris = (end - begin) / 3;
+        uint32_t *tris = idx + begin;
+        int nlocal = 0;
+        for (int i = 0; i < 3 * ntris; i++) {
+            if (local[tris[i]] < 0) {
+                local[tris[i]] = nlocal;
+                ids[nlocal++] = tris[i];
+            }
+            tris[i] = local[tris[i]];
+        }
+        float *vbuffer = malloc(8 * nlocal * sizeof(float) + 1);
+        for (int v = 0; v < nlocal; v++) {
+            memcpy(vbuffer + 8 * v, ctx->vbuffer + 8 * ids[v], 8 * sizeof(float));
+            local[ids[v]] = -1;
+        }
+        optimize_cache(tris, ntris, nlocal);
+        optimize_overdraw(vbuffer, tris, ntris, nlocal);
+        for (int i = 0; i < 3 * ntris; i++) {
+            tris[i] = ids[tris[i]];
+        }
+        free(vbuffer);
+    }
+    free(local);
+    free(ids);
+    optimize_fetch(ctx, idx);
+    cache_stats(idx, ctx->nfaceverts, ctx->nunique, &ctx->acmr[1], &ctx->atvr[1]);
+    if (ctx->indexsize == 2) {
+        for (int i = 0; i < ctx->nfaceverts; i++) {
+            ((uint16_t *) ctx->indices)[i] = idx[i];
+        }
+        free(idx);
+    } else {
+        free(ctx->indices);
+        ctx->indices = idx;
+    }
+}
+
+#define lod_levels 3
+const float lod_ratios[lod_levels] = { 0.5f, 0.25f, 0.1f };
+#define lod_attrweight 0.5f     // attribute error against squared distance with the mesh scaled to a unit box
+#define lod_border 10.0f        // weight of the planes that hold borders and attribute seams in place
+
+typedef struct {
+    float cost;
+    int   a;                // a collapses onto b
+    int   b;
+    int   stampa;           // stamps of a and b when pushed, the entry is stale once they change
+    int   stampb;
+} lodedge;
+
+// one mesh being simplified: triangles are made of wedges, the unique
+// vertices of the mesh, and wedges with the same position share a welded
+// position that the quadrics and collapses work on
+typedef struct {
+    const float *vbuffer;
+    int     nwedges;
+    int     *wverts;        // unique vertex of each wedge
+    int     *wpos;          // welded position of each wedge
+    int     npos;
+    float   *pos;           // positions scaled to the unit box
+    double  *quadrics;      // 10 per position, the upper half of a symmetric 4x4
+    float   *areas;         // triangle area around each position, weighs the attribute cost
+    int     *root;          // position each one was collapsed onto, itself while alive
+    int     *chain;         // ring of the positions collapsed into the same one
+    int     *stamps;
+    int     *tstart;        // triangles around each original position
+    int     *tlist;
+    int     ntris;
+    int     live;
+    int     *tris;          // wedges of each triangle, tris[3 * t] is -1 once it's gone
+    int     nheap;
+    int     capheap;
+    lodedge *heap;          // binary min heap on cost
+    int     nnear;
+    int     capnear;
+    int     *near;          // neighbour position, own wedge and neighbour wedge on the edge
+    int     nmap;
+    int     capmap;
+    int     *map;           // wedge pairs of the collapse being tried
+} lodmesh;
+
+int lod_find(lodmesh *m, int p) {
+    while (m->root[p] != p) {
+        m->root[p] = m->root[m->root[p]];
+        p = m->root[p];
+    }
+    return p;
+}
+
+void quadric_plane(double *q, const double *n, double d, double w) {
+    double a = n[0], b = n[1], c = n[2];
+    q[0] += w * a * a, q[1] += w * a * b, q[2] += w * a * c, q[3] += w * a * d;
+    q[4] += w * b * b, q[5] += w * b * c, q[6] += w * b * d;
+    q[7] += w * c * c, q[8] += w * c * d;
+    q[9] += w * d * d;
+}
+
+// squared plane distance sum of p under the two quadrics added together
+double quadric_error(const double *q, const double *r, const float *p) {
+    double x = p[0], y = p[1], z = p[2];
+    double s[10];
+    for (int i = 0; i < 10; i++) {
+        s[i] = q[i] + r[i];
+    }
+    return s[0] * x * x + 2 * s[1] * x * y + 2 * s[2] * x * z + 2 * s[3] * x
+        + s[4] * y * y + 2 * s[5] * y * z + 2 * s[6] * y
+        + s[7] * z * z + 2 * s[8] * z + s[9];
+}
+
+// squared difference of the uvs and normals of two wedges
+float lod_attrdist(lodmesh *m, int wa, int wb) {
+    const float *a = m->vbuffer + 8 * m->wverts[wa], *b = m->vbuffer + 8 * m->wverts[wb];
+    float d = 0;
+    for (int k = 3; k < 8; k++) {
+        d += (a[k] - b[k]) * (a[k] - b[k]);
+    }
+    return d;
+}
+
+// 4-ary heap, half as deep as a binary one with the children in one cache line
+void lod_push(lodmesh *m, lodedge e) {
+    m->heap = reserve(m->heap, &m->capheap, m->nheap + 1, sizeof(lodedge));
+    int i = m->nheap++;
+    while (i && m->heap[(i - 1) / 4].cost > e.cost) {
+        m->heap[i] = m->heap[(i - 1) / 4];
+        i = (i - 1) / 4;
+    }
+    m->heap[i] = e;
+}
+
+lodedge lod_pop(lodmesh *m) {
+    lodedge top = m->heap[0], last = m->heap[--m->nheap];
+    int i = 0;
+    for (;;) {
+        int first = 4 * i + 1, c = first;
+        if (first >= m->nheap) {
+            break;
+        }
+        for (int j = first + 1; j < first + 4 && j < m->nheap; j++) {
+            c = m->heap[j].cost < m->heap[c].cost ? j : c;
+        }
+        if (m->heap[c].cost >= last.cost) {
+            break;
+        }
+        m->heap[i] = m->heap[c];
+        i = c;
+    }
+    m->heap[i] = last;
+    return top;
+}
+
+// corner of live triangle t at position p, or -1
+int lod_corner(lodmesh *m, int t, int p) {
+    for (int k = 0; k < 3; k++) {
+        if (lod_find(m, m->wpos[m->tris[3 * t + k]]) == p) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+// neighbour positions of p with the wedges of the first triangle seen on each edge
+void lod_neighbours(lodmesh *m, int p) {
+    m->nnear = 0;
+    int x = p;
+    do {
+        for (int i = m->tstart[x]; i < m->tstart[x + 1]; i++) {
+            int t = m->tlist[i];
+            if (m->tris[3 * t] < 0) {
+                continue;
+            }
+            int own = m->tris[3 * t + lod_corner(m, t, p)];
+            for (int k = 0; k < 3; k++) {
+                int w = m->tris[3 * t + k];
+                int q = lod_find(m, m->wpos[w]);
+                int seen = q == p;
+                for (int j = 0; j < m->nnear && !seen; j++) {
+                    seen = m->near[3 * j] == q;
+                }
+                if (!seen) {
+                    m->near = reserve(m->near, &m->capnear, m->nnear + 1, 3 * sizeof(int));
+                    m->near[3 * m->nnear] = q;
+                    m->near[3 * m->nnear + 1] = own;
+                    m->near[3 * m->nnear++ + 2] = w;
+                }
+            }
+        }
+        x = m->chain[x];
+    } while (x != p);
+}
+
+float lod_cost(lodmesh *m, int a, int b, int wa, int wb) {
+    return quadric_error(m->quadrics + 10 * a, m->quadrics + 10 * b, m->pos + 3 * b)
+        + lod_attrweight * m->areas[a] * lod_attrdist(m, wa, wb);
+}
+
+// queue the cheaper direction of every edge around p
+void lod_edges(lodmesh *m, int p) {
+    lod_neighbours(m, p);
+    for (int j = 0; j < m->nnear; j++) {
+        int q = m->near[3 * j], wp = m->near[3 * j + 1], wq = m->near[3 * j + 2];
+        float pq = lod_cost(m, p, q, wp, wq), qp = lod_cost(m, q, p, wq, wp);
+        if (pq <= qp) {
+            lod_push(m, (lodedge){ pq, p, q, m->stamps[p], m->stamps[q] });
+        } else {
+            lod_push(m, (lodedge){ qp, q, p, m->stamps[q], m->stamps[p] });
+        }
+    }
+}
+
+void triangle_normal(const float *a, const float *b, const float *c, double *n) {
+    double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+// move position a onto b if every wedge of a has a wedge of b to become
+// and no triangle flips, returns 1 when done
+int lod_collapse(lodmesh *m, int a, int b) {
+    m->nmap = 0;
+    for (int pass = 0; pass < 3; pass++) {
+        int x = a;
+        do {
+            for (int i = m->tstart[x]; i < m->tstart[x + 1]; i++) {
+                int t = m->tlist[i];
+                if (m->tris[3 * t] < 0) {
+                    continue;
+                }
+                int *tri = m->tris + 3 * t;
+                int ka = lod_corner(m, t, a), kb = lod_corner(m, t, b);
+                int wa = tri[ka], j = 0;
+                for (; j < m->nmap && m->map[2 * j] != wa; j++) {
+                }
+                if (pass == 0 && kb >= 0) {         // the triangles on the edge pair up the wedges
+                    if (j < m->nmap && m->map[2 * j + 1] != tri[kb]) {
+                        return 0;
+                    }
+                    if (j == m->nmap) {
+                        m->map = reserve(m->map, &m->capmap, m->nmap + 1, 2 * sizeof(int));
+                        m->map[2 * m->nmap] = wa;
+                        m->map[2 * m->nmap++ + 1] = tri[kb];
+                    }
+                } else if (pass == 1 && kb < 0) {   // the rest must keep their wedges and facing
+                    if (j == m->nmap) {
+                        return 0;
+                    }
+                    const float *p[3];
+                    for (int k = 0; k < 3; k++) {
+                        p[k] = m->pos + 3 * m->wpos[tri[k]];
+                    }
+                    double before[3], after[3];
+                    triangle_normal(p[0], p[1], p[2], before);
+                    p[ka] = m->pos + 3 * b;
+                    triangle_normal(p[0], p[1], p[2], after);
+                    if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0) {
+                        return 0;
+                    }
+                } else if (pass == 2) {
+                    if (kb >= 0) {
+                        tri[0] = -1;
+                        m->live--;
+                    } else {
+                        tri[ka] = m->map[2 * j + 1];
+                    }
+                }
+            }
+            x = m->chain[x];
+        } while (x != a);
+    }
+    m->root[a] = b;
+    int next = m->chain[a];                 // join the two rings
+    m->chain[a] = m->chain[b];
+    m->chain[b] = next;
+    for (int i = 0; i < 10; i++) {
+        m->quadrics[10 * b + i] += m->quadrics[10 * a + i];
+    }
+    m->areas[b] += m->areas[a];
+    m->stamps[b]++;
+    return 1;
+}
+
+// wedges, welded positions, adjacency and quadrics for ntris triangles of unique vertices
+void lod_init(lodmesh *m, const float *vbuffer, const uint32_t *idx, int ntris, int *local) {
+    memset(m, 0, sizeof(*m));
+    m->vbuffer = vbuffer;
+    m->ntris = ntris;
+    m->tris = malloc(3 * ntris * sizeof(int) + 1);
+    m->wverts = malloc(3 * ntris * sizeof(int) + 1);
+    for (int i = 0; i < 3 * ntris; i++) {   // local holds -1 for every unique vertex on entry
+        if (local[idx[i]] < 0) {
+            local[idx[i]] = m->nwedges;
+            m->wverts[m->nwedges++] = idx[i];
+        }
+        m->tris[i] = local[idx[i]];
+    }
+    for (int w = 0; w < m->nwedges; w++) {
+        local[m->wverts[w]] = -1;
+    }
+    int size = 64;
+    while (size < 2 * m->nwedges) {
+        size *= 2;
+    }
+    int *table = malloc(size * sizeof(int));
+    memset(table, -1, size * sizeof(int));
+    m->wpos = malloc(m->nwedges * sizeof(int) + 1);
+    m->pos = malloc(3 * m->nwedges * sizeof(float) + 1);
+    float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (int w = 0; w < m->nwedges; w++) {  // weld the wedges by position bits
+        const float *v = vbuffer + 8 * m->wverts[w];
+        uint32_t bits[3];
+        memcpy(bits, v, sizeof(bits));
+        unsigned h = (bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u) & (size - 1);
+        while (table[h] >= 0 && memcmp(m->pos + 3 * table[h], v, 3 * sizeof(float))) {
+            h = (h + 1) & (size - 1);
+        }
+        if (table[h] < 0) {
+            table[h] = m->npos;
+            memcpy(m->pos + 3 * m->npos++, v, 3 * sizeof(float));
+        }
+        m->wpos[w] = table[h];
+        for (int k = 0; k < 3; k++) {
+            lo[k] = v[k] < lo[k] ? v[k] : lo[k];
+            hi[k] = v[k] > hi[k] ? v[k] : hi[k];
+        }
+    }
+    free(table);
+    float extent = 0;
+    for (int k = 0; k < 3; k++) {
+        extent = hi[k] - lo[k] > extent ? hi[k] - lo[k] : extent;
+    }
+    float scale = extent > 0 ? 1 / extent : 1;
+    for (int p = 0; p < m->npos; p++) {
+        for (int k = 0; k < 3; k++) {
+            m->pos[3 * p + k] = (m->pos[3 * p + k] - lo[k]) * scale;
+        }
+    }
+    m->root = malloc(m->npos * sizeof(int) + 1);
+    m->chain = malloc(m->npos * sizeof(int) + 1);
+    m->stamps = calloc(m->npos + 1, sizeof(int));
+    m->quadrics = calloc(10 * m->npos + 1, sizeof(double));
+    m->areas = calloc(m->npos + 1, sizeof(float));
+    m->tstart = calloc(m->npos + 1, sizeof(int));
+    m->tlist = malloc(3 * ntris * sizeof(int) + 1);
+    for (int p = 0; p < m->npos; p++) {
+        m->root[p] = m->chain[p] = p;
+    }
+    // triangles with a repeated position are dropped up front
+    for (int t = 0; t < ntris; t++) {
+        int *tri = m->tris + 3 * t;
+        int p0 = m->wpos[tri[0]], p1 = m->wpos[tri[1]], p2 = m->wpos[tri[2]];
+        if (p0 == p1 || p1 == p2 || p2 == p0) {
+            tri[0] = -1;
+            continue;
+        }
+        m->live++;
+        m->tstart[p0]++, m->tstart[p1]++, m->tstart[p2]++;
+    }
+    for (int p = 0, sum = 0; p <= m->npos; p++) {
+        int count = p < m->npos ? m->tstart[p] : 0;
+        m->tstart[p] = sum;
+        sum += count;
+    }
+    int *cursor = malloc((m->npos + 1) * sizeof(int));
+    memcpy(cursor, m->tstart, (m->npos + 1) * sizeof(int));
+    for (int t = 0; t < ntris; t++) {
+        for (int k = 0; k < 3 && m->tris[3 * t] >= 0; k++) {
+            m->tlist[cursor[m->wpos[m->tris[3 * t + k]]]++] = t;
+        }
+    }
+    free(cursor);
+    for (int t = 0; t < ntris; t++) {       // area weighted face planes
+        int *tri = m->tris + 3 * t;
+        if (tri[0] < 0) {
+            continue;
+        }
+        const float *p[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = m->pos + 3 * m->wpos[tri[k]];
+        }
+        double n[3];
+        triangle_normal(p[0], p[1], p[2], n);
+        double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0) {
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            n[k] /= length;
+        }
+        double d = -(n[0] * p[0][0] + n[1] * p[0][1] + n[2] * p[0][2]);
+        for (int k = 0; k < 3; k++) {
+            quadric_plane(m->quadrics + 10 * m->wpos[tri[k]], n, d, length / 2);
+            m->areas[m->wpos[tri[k]]] += length / 6;
+        }
+        // edges without a triangle on the other side, or with other wedges
+        // there, get a plane through them at right angles to the face
+        for (int k = 0; k < 3; k++) {
+            int wa = tri[k], wb = tri[(k + 1) % 3];
+            int pa = m->wpos[wa], pb = m->wpos[wb];
+            int open = 1;
+            for (int i = m->tstart[pa]; i < m->tstart[pa + 1] && open; i++) {
+                int o = m->tlist[i];
+                if (o == t) {
+                    continue;
+                }
+                int *other = m->tris + 3 * o;
+                for (int j = 0; j < 3; j++) {
+                    if (m->wpos[other[j]] == pb) {
+                        open = 0;
+                        for (int l = 0; l < 3; l++) {
+                            open |= m->wpos[other[l]] == pa && other[l] != wa;
+                        }
+                        open |= other[j] != wb;
+                    }
+                }
+            }
+            if (open) {
+                const float *ea = m->pos + 3 * pa, *eb = m->pos + 3 * pb;
+                double e[3] = { eb[0] - ea[0], eb[1] - ea[1], eb[2] - ea[2] };
+                double c[3] = { e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0] };
+                double cl = sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+                if (cl > 0) {
+                    for (int j = 0; j < 3; j++) {
+                        c[j] /= cl;
+                    }
+                    double cd = -(c[0] * ea[0] + c[1] * ea[1] + c[2] * ea[2]);
+                    double w = lod_border * (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+                    quadric_plane(m->quadrics + 10 * pa, c, cd, w);
+                    quadric_plane(m->quadrics + 10 * pb, c, cd, w);
+                }
+            }
+        }
+    }
+    for (int p = 0; p < m->npos; p++) {
+        lod_neighbours(m, p);
+        for (int j = 0; j < m->nnear; j++) {
+            int q = m->near[3 * j], wp = m->near[3 * j + 1], wq = m->near[3 * j + 2];
+            if (q < p) {                    // queued from q already
+                continue;
+            }
+            float pq = lod_cost(m, p, q, wp, wq), qp = lod_cost(m, q, p, wq, wp);
+            lod_push(m, pq <= qp ? (lodedge){ pq, p, q, m->stamps[p], m->stamps[q] }
+                : (lodedge){ qp, q, p, m->stamps[q], m->stamps[p] });
+        }
+    }
+}
+
+// collapse the cheapest edges until target triangles are left or none can go
+void lod_simplify(lodmesh *m, int target) {
+    while (m->live > target && m->nheap) {
+        lodedge e = lod_pop(m);
+        if (m->root[e.a] != e.a || m->root[e.b] != e.b
+            || m->stamps[e.a] != e.stampa || m->stamps[e.b] != e.stampb) {
+            continue;
+        }
+        if (lod_collapse(m, e.a, e.b)) {
+            lod_edges(m, e.b);
+        }
+    }
+}
+
+void lod_free(lodmesh *m) {
+    free(m->wverts);
+    free(m->wpos);
+    free(m->pos);
+    free(m->quadrics);
+    free(m->areas);
+    free(m->root);
+    free(m->chain);
+    free(m->stamps);
+    free(m->tstart);
+    free(m->tlist);
+    free(m->tris);
+    free(m->heap);
+    free(m->near);
+    free(m->map);
+}
+
+typedef struct {
+    objctx   *ctx;
+    uint32_t *idx;          // indices widened to 32 bits
+    uint32_t **out;         // indices of each level and mesh range
+    int      *counts;
+} lodpass;
+
+// simplify mesh ranges begin to end, range 0 is the faces before the first o
+void lod_meshes(void *arg, int begin, int end) {
+    lodpass *pass = arg;
+    objctx *ctx = pass->ctx;
+    int nranges = ctx->nmeshes + 1;
+    int *local = malloc(ctx->nunique * sizeof(int) + 1);
+    memset(local, -1, ctx->nunique * sizeof(int));
+    for (int r = begin; r < end; r++) {
+        int first = r ? ctx->meshoffsets[r - 1] : 0;
+        int ntris = (ctx->meshoffsets[r] - first) / 3;
+        lodmesh m;
+        lod_init(&m, ctx->vbuffer, pass->idx + first, ntris, local);
+        for (int level = 0; level < lod_levels; level++) {
+            lod_simplify(&m, (int) (lod_ratios[level] * ntris));
+            uint32_t *out = malloc(3 * m.live * sizeof(uint32_t) + 1);
+            int n = 0;
+            for (int t = 0; t < ntris; t++) {
+                for (int k = 0; k < 3 && m.tris[3 * t] >= 0; k++) {
+                    out[n++] = m.wverts[m.tris[3 * t + k]];
+                }
+            }
+            pass->out[level * nranges + r] = out;
+            pass->counts[level * nranges + r] = n;
+        }
+        lod_free(&m);
+    }
+    free(local);
+}
+
+// build lod_levels simplified index lists of every mesh with nthreads threads,
+// each mesh keeps its vertices and loses edges by quadric error plus attribute change
+void obj_lod(objctx *ctx, int nthreads) {
+    int nranges = ctx->nmeshes + 1;
+    lodpass pass = {
+        .ctx = ctx,
+        .idx = malloc(ctx->nfaceverts * sizeof(uint32_t) + 1),
+        .out = malloc(lod_levels * nranges * sizeof(uint32_t *)),
+        .counts = malloc(lod_levels * nranges * sizeof(int)),
+    };
+    for (int i = 0; i < ctx->nfaceverts; i++) {
+        pass.idx[i] = obj_index(ctx, i);
+    }
+    run_ranges(nranges, nthreads, lod_meshes, &pass);
+    ctx->nlods = lod_levels;
+    ctx->lodoffsets = malloc((lod_levels * nranges + 1) * sizeof(int));
+    int total = 0;
+    for (int i = 0; i < lod_levels * nranges; i++) {
+        ctx->lodoffsets[i] = total;
+        total += pass.counts[i];
+    }
+    ctx->lodoffsets[lod_levels * nranges] = total;
+    ctx->lodindices = malloc(total * sizeof(uint32_t) + 1);
+    for (int i = 0; i < lod_levels * nranges; i++) {
+        memcpy(ctx->lodindices + ctx->lodoffsets[i], pass.out[i], pass.counts[i] * sizeof(uint32_t));
+        free(pass.out[i]);
+    }
+    free(pass.idx);
+    free(pass.out);
+    free(pass.counts);
+}
+
+#define meshlet_vertices 64
+#define meshlet_triangles 124
+
+// vertex of face vertex i in buffer or vbuffer
+int obj_vertexid(objctx *ctx, int i) {
+    return ctx->indexsize ? obj_index(ctx, i) : i;
+}
+
+typedef struct {
+    objctx     *ctx;
+    int        nverts;          // vertices in the buffer meshlets index into
+    objmeshlet **meshlets;      // per mesh range, with vertex and triangle offsets local to it
+    int        *nmeshlets;
+    uint32_t   **vertices;
+    int        *nvertices;
+    uint8_t    **triangles;
+    int        *ntriangles;
+} meshletpass;
+
+// bounding sphere by ritter's method: the two far apart points, then grown
+// to take in every point outside
+void meshlet_sphere(const float *src, const uint32_t *verts, int n, float *center, float *radius) {
+    const float *p0 = src + 8 * verts[0], *p1 = p0, *p2 = p0;
+    float best = 0;
+    for (int i = 0; i < n; i++) {
+        const float *p = src + 8 * verts[i];
+        float d = (p[0] - p0[0]) * (p[0] - p0[0]) + (p[1] - p0[1]) * (p[1] - p0[1]) + (p[2] - p0[2]) * (p[2] - p0[2]);
+        if (d > best) {
+            best = d, p1 = p;
+        }
+    }
+    best = 0;
+    for (int i = 0; i < n; i++) {
+        const float *p = src + 8 * verts[i];
+        float d = (p[0] - p1[0]) * (p[0] - p1[0]) + (p[1] - p1[1]) * (p[1] - p1[1]) + (p[2] - p1[2]) * (p[2] - p1[2]);
+        if (d > best) {
+            best = d, p2 = p;
+        }
+    }
+    float r = sqrtf(best) / 2;
+    for (int k = 0; k < 3; k++) {
+        center[k] = (p1[k] + p2[k]) / 2;
+    }
+    for (int i = 0; i < n; i++) {
+        const float *p = src + 8 * verts[i];
+        float d[3] = { p[0] - center[0], p[1] - center[1], p[2] - center[2] };
+        float length = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        if (length > r) {               // move the center half of the way out
+            float grow = (length - r) / 2;
+            for (int k = 0; k < 3; k++) {
+                center[k] += d[k] / length * grow;
+            }
+            r += grow;
+        }
+    }
+    *radius = r;
+}
+
+// normal cone of the triangles: the mean normal as the axis and the apex behind
+// every triangle plane, cutoff 1 when the normals spread over more than a half space
+void meshlet_cone(const float *src, objmeshlet *meshlet, const uint32_t *verts, const uint8_t *tris) {
+    int n = meshlet->ntriangles;
+    float (*normals)[3] = malloc(n * sizeof(*normals) + 1);
+    float axis[3] = {0};
+    for (int t = 0; t < n; t++) {
+        const float *a = src + 8 * verts[tris[3 * t]];
+        const float *b = src + 8 * verts[tris[3 * t + 1]];
+        const float *c = src + 8 * verts[tris[3 * t + 2]];
+        float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        float *nt = normals[t];
+        nt[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        nt[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        nt[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        float length = sqrtf(nt[0] * nt[0] + nt[1] * nt[1] + nt[2] * nt[2]);
+        for (int k = 0; k < 3; k++) {
+            nt[k] = length > 0 ? nt[k] / length : 0;
+            axis[k] += nt[k];
+        }
+    }
+    float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    float mindot = 1;
+    for (int k = 0; k < 3; k++) {
+        axis[k] = length > 0 ? axis[k] / length : 0;
+    }
+    for (int t = 0; t < n; t++) {
+        float d = normals[t][0] * axis[0] + normals[t][1] * axis[1] + normals[t][2] * axis[2];
+        mindot = normals[t][0] || normals[t][1] || normals[t][2] ? fminf(mindot, d) : mindot;
+    }
+    memcpy(meshlet->axis, axis, sizeof(axis));
+    memcpy(meshlet->apex, meshlet->center, sizeof(meshlet->apex));
+    meshlet->cutoff = 1;
+    if (length > 0 && mindot > 0) {
+        float maxt = 0;
+        for (int t = 0; t < n; t++) {
+            const float *a = src + 8 * verts[tris[3 * t]];
+            const float *nt = normals[t];
+            float dc = (meshlet->center[0] - a[0]) * nt[0] + (meshlet->center[1] - a[1]) * nt[1]
+                + (meshlet->center[2] - a[2]) * nt[2];
+            float dn = axis[0] * nt[0] + axis[1] * nt[1] + axis[2] * nt[2];
+            maxt = dn > 0 && dc / dn > maxt ? dc / dn : maxt;
+        }
+        for (int k = 0; k < 3; k++) {
+            meshlet->apex[k] = meshlet->center[k] - axis[k] * maxt;
+        }
+        meshlet->cutoff = sqrtf(1 - mindot * mindot);
+    }
+    free(normals);
+}
+
+// unused triangles around the given meshlet vertices, the one adding the
+// fewest new vertices without passing the limit and nearest the centroid wins
+int meshlet_next(const int *tris, const int *starts, const int *adjacent, const char *used,
+    const int *slot, const int *verts, int nverts, int room, const float *pos, const float *centroid) {
+    int best = -1, bestnew = 4;
+    float bestdist = INFINITY;
+    for (int i = 0; i < nverts; i++) {
+        for (int j = starts[verts[i]]; j < starts[verts[i] + 1]; j++) {
+            int t = adjacent[j];
+            if (used[t]) {
+                continue;
+            }
+            int new = 0;
+            float d = 0;
+            for (int k = 0; k < 3; k++) {
+                new += slot[tris[3 * t + k]] < 0;
+            }
+            if (new > room || new > bestnew) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                float c = (pos[3 * tris[3 * t] + k] + pos[3 * tris[3 * t + 1] + k] + pos[3 * tris[3 * t + 2] + k]) / 3;
+                d += (c - centroid[k]) * (c - centroid[k]);
+            }
+            if (new < bestnew || d < bestdist) {
+                best = t, bestnew = new, bestdist = d;
+            }
+        }
+    }
+    return best;
+}
+
+// split mesh ranges begin to end into meshlets. each one grows from the first
+// unused triangle, preferring neighbours of the triangle added last, and ends
+// at a limit or when nothing connected is left and the next triangle won't fit
+void meshlet_meshes(void *arg, int begin, int end) {
+    meshletpass *pass = arg;
+    objctx *ctx = pass->ctx;
+    const float *src = ctx->indexsize ? ctx->vbuffer : ctx->buffer;
+    int *local = malloc(pass->nverts * sizeof(int) + 1);     // range vertex of each buffer vertex
+    memset(local, -1, pass->nverts * sizeof(int));
+    for (int r = begin; r < end; r++) {
+        int first = r ? ctx->meshoffsets[r - 1] : 0;
+        int ntris = (ctx->meshoffsets[r] - first) / 3;
+        int *tris = malloc(3 * ntris * sizeof(int) + 1);
+        uint32_t *ids = malloc(3 * ntris * sizeof(uint32_t) + 1);
+        int nlocal = 0;
+        for (int i = 0; i < 3 * ntris; i++) {
+            int id = obj_vertexid(ctx, first + i);
+            if (local[id] < 0) {
+                local[id] = nlocal;
+                ids[nlocal++] = id;
+            }
+            tris[i] = local[id];
+        }
+        float *pos = malloc(3 * nlocal * sizeof(float) + 1);
+        for (int v = 0; v < nlocal; v++) {
+            local[ids[v]] = -1;
+            memcpy(pos + 3 * v, src + 8 * ids[v], 3 * sizeof(float));
+        }
+        int *starts = calloc(nlocal + 2, sizeof(int));  // triangles around each vertex
+        int *adjacent = malloc(3 * ntris * sizeof(int) + 1);
+        for (int i = 0; i < 3 * ntris; i++) {
+            starts[tris[i] + 2]++;
+        }
+        for (int v = 2; v <= nlocal + 1; v++) {
+            starts[v] += starts[v - 1];
+        }
+        for (int i = 0; i < 3 * ntris; i++) {   // starts shifts down by one as it fills
+            adjacent[starts[tris[i] + 1]++] = i / 3;
+        }
+        char *used = calloc(ntris + 1, 1);
+        int *slot = malloc(nlocal * sizeof(int) + 1);   // meshlet vertex of each range vertex
+        memset(slot, -1, nlocal * sizeof(int));
+        int capmeshlets = 0, capvertices = 0, captriangles = 0;
+        objmeshlet *meshlets = NULL;
+        uint32_t *vertices = NULL;
+        uint8_t *triangles = NULL;
+        int nmeshlets = 0, nvertices = 0, ntriangles = 0;
+        int verts[meshlet_vertices];
+        int scan = 0;
+        for (int placed = 0; placed < ntris;) {
+            while (used[scan]) {
+                scan++;
+            }
+            vertices = reserve(vertices, &capvertices, nvertices + meshlet_vertices, sizeof(uint32_t));
+            triangles = reserve(triangles, &captriangles, ntriangles + 3 * meshlet_triangles, 1);
+            int nv = 0, nt = 0;
+            float sum[3] = {0}, centroid[3];
+            for (int t = scan; t >= 0;) {
+                for (int k = 0; k < 3; k++) {
+                    int v = tris[3 * t + k];
+                    if (slot[v] < 0) {
+                        slot[v] = nv;
+                        verts[nv++] = v;
+                        for (int j = 0; j < 3; j++) {
+                            sum[j] += pos[3 * v + j];
+                        }
+                    }
+                    triangles[ntriangles + 3 * nt + k] = slot[v];
+                }
+                used[t] = 1;
+                placed++;
+                if (++nt == meshlet_triangles) {
+                    break;
+                }
+                for (int j = 0; j < 3; j++) {
+                    centroid[j] = sum[j] / nv;
+                }
+                int last[3] = { tris[3 * t], tris[3 * t + 1], tris[3 * t + 2] };
+                int room = meshlet_vertices - nv;
+                t = meshlet_next(tris, starts, adjacent, used, slot, last, 3, room, pos, centroid);
+                if (t < 0) {
+                    t = meshlet_next(tris, starts, adjacent, used, slot, verts, nv, room, pos, centroid);
+                }
+                if (t < 0) {                // nothing connected, take the next triangle if it fits
+                    while (scan < ntris && used[scan]) {
+                        scan++;
+                    }
+                    int new = 0;
+                    for (int k = 0; k < 3 && scan < ntris; k++) {
+                        new += slot[tris[3 * scan + k]] < 0;
+                    }
+                    t = scan < ntris && new <= room ? scan : -1;
+                }
+            }
+            meshlets = reserve(meshlets, &capmeshlets, nmeshlets + 1, sizeof(objmeshlet));
+            objmeshlet *meshlet = meshlets + nmeshlets++;
+            *meshlet = (objmeshlet){
+                .vertexoffset = nvertices, .triangleoffset = ntriangles,
+                .nvertices = nv, .ntriangles = nt, .mesh = r - 1,
+            };
+            for (int i = 0; i < nv; i++) {
+                vertices[nvertices + i] = ids[verts[i]];
+                slot[verts[i]] = -1;
+            }
+            meshlet_sphere(src, vertices + nvertices, nv, meshlet->center, &meshlet->radius);
+            meshlet_cone(src, meshlet, vertices + nvertices, triangles + ntriangles);
+            nvertices += nv;
+            ntriangles += 3 * nt;
+        }
+        pass->meshlets[r] = meshlets;
+        pass->nmeshlets[r] = nmeshlets;
+        pass->vertices[r] = vertices;
+        pass->nvertices[r] = nvertices;
+        pass->triangles[r] = triangles;
+        pass->ntriangles[r] = ntriangles;
+        free(used);
+        free(slot);
+        free(starts);
+        free(adjacent);
+        free(pos);
+        free(tris);
+        free(ids);
+    }
+    free(local);
+}
+
+// partition every mesh into meshlets over the indexed or expanded buffer with nthreads threads
+void obj_meshlets(objctx *ctx, int nthreads) {
+    int nranges = ctx->nmeshes + 1;
+    meshletpass pass = {
+        .ctx = ctx,
+        .nverts = ctx->indexsize ? ctx->nunique : ctx->nfaceverts,
+        .meshlets = malloc(nranges * sizeof(objmeshlet *)),
+        .nmeshlets = malloc(nranges * sizeof(int)),
+        .vertices = malloc(nranges * sizeof(uint32_t *)),
+        .nvertices = malloc(nranges * sizeof(int)),
+        .triangles = malloc(nranges * sizeof(uint8_t *)),
+        .ntriangles = malloc(nranges * sizeof(int)),
+    };
+    run_ranges(nranges, nthreads, meshlet_meshes, &pass);
+    ctx->nmeshlets = ctx->nmeshletvertices = ctx->nmeshlettriangles = 0;
+    for (int r = 0; r < nranges; r++) {
+        ctx->nmeshlets += pass.nmeshlets[r];
+        ctx->nmeshletvertices += pass.nvertices[r];
+        ctx->nmeshlettriangles += pass.ntriangles[r];
+    }
+    ctx->meshlets = malloc(ctx->nmeshlets * sizeof(objmeshlet) + 1);
+    ctx->meshletvertices = malloc(ctx->nmeshletvertices * sizeof(uint32_t) + 1);
+    ctx->meshlettriangles = malloc(ctx->nmeshlettriangles + 1);
+    int nmeshlets = 0, nvertices = 0, ntriangles = 0;
+    for (int r = 0; r < nranges; r++) {     // offsets become global as the ranges are joined
+        for (int i = 0; i < pass.nmeshlets[r]; i++) {
+            objmeshlet *meshlet = ctx->meshlets + nmeshlets + i;
+            *meshlet = pass.meshlets[r][i];
+            meshlet->vertexoffset += nvertices;
+            meshlet->triangleoffset += ntriangles;
+        }
+        memcpy(ctx->meshletvertices + nvertices, pass.vertices[r], pass.nvertices[r] * sizeof(uint32_t));
+        memcpy(ctx->meshlettriangles + ntriangles, pass.triangles[r], pass.ntriangles[r]);
+        nmeshlets += pass.nmeshlets[r];
+        nvertices += pass.nvertices[r];
+        ntriangles += pass.ntriangles[r];
+        free(pass.meshlets[r]);
+        free(pass.vertices[r]);
+        free(pass.triangles[r]);
+    }
+    free(pass.meshlets);
+    free(pass.nmeshlets);
+    free(pass.vertices);
+    free(pass.nvertices);
+    free(pass.triangles);
+    free(pass.ntriangles);
+}
+
+// convert a float to a half with round to nearest even
+uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = x >> 16 & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+    if (abs >= 0x7f800000) {                    // inf and nan
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    }
+    if (abs >= 0x477ff000) {                    // rounds past the largest half
+        return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {                     // subnormal half, let the fpu round
+        float g;
+        memcpy(&g, &abs, sizeof(g));
+        return sign | (uint16_t) (int) lrintf(g * 16777216.0f);
+    }
+    uint32_t h = (abs - 0x38000000) >> 13;
+    uint32_t rest = abs & 0x1fff;
+    h += rest > 0x1000 || (rest == 0x1000 && (h & 1));
+    return sign | h;
+}
+
+float half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = h >> 10 & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    float f;
+    if (!exp) {
+        f = mant / 16777216.0f;
+        return sign ? -f : f;
+    }
+    uint32_t x = sign | (exp == 31 ? 0x7f800000 | mant << 13 : (exp + 112) << 23 | mant << 13);
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// convert n floats to halves, 8 at a time with f16c
+void pack_half(const float *src, uint16_t *dst, int n) {
+    int i = 0;
+#ifdef __F16C__
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *) (dst + i), h);
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = float_to_half(src[i]);
+    }
+}
+
+// scale n floats by s and round them to 16 bit integers, written so the
+// compiler vectorizes it
+void pack_int16(const float *src, int16_t *dst, int n, float s, float lo, float hi) {
+    for (int i = 0; i < n; i++) {
+        float x = src[i] * s;
+        x = x < lo ? lo : x > hi ? hi : x;
+        dst[i] = (int32_t) (x + (x < 0 ? -0.5f : 0.5f));
+    }
+}
+
+// scale n floats in [0, 1 / s] to unsigned 16 bit integers
+void pack_uint16(const float *src, uint16_t *dst, int n, float s) {
+    for (int i = 0; i < n; i++) {
+        float x = src[i] * s;
+        x = x < 0 ? 0 : x > 65535 ? 65535 : x;
+        dst[i] = (uint32_t) (x + 0.5f);
+    }
+}
+
+// octahedral encoding: project onto |x| + |y| + |z| = 1 and fold the lower half over
+void oct_encode(const float *n, float *out) {
+    float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    if (l1 == 0) {
+        out[0] = out[1] = 0;
+        return;
+    }
+    float x = n[0] / l1;
+    float y = n[1] / l1;
+    if (n[2] < 0) {
+        float fx = (1 - fabsf(y)) * (x < 0 ? -1 : 1);
+        y = (1 - fabsf(x)) * (y < 0 ? -1 : 1);
+        x = fx;
+    }
+    out[0] = x;
+    out[1] = y;
+}
+
+void oct_decode(float x, float y, float *n) {
+    float z = 1 - fabsf(x) - fabsf(y);
+    if (z < 0) {
+        float fx = (1 - fabsf(y)) * (x < 0 ? -1 : 1);
+        y = (1 - fabsf(x)) * (y < 0 ? -1 : 1);
+        x = fx;
+    }
+    float length = sqrtf(x * x + y * y + z * z);
+    n[0] = x / length;
+    n[1] = y / length;
+    n[2] = z / length;
+}
+
+// decode vertex i of the quantized buffer into 8 floats
+void dequantize_vertex(objctx *ctx, int i, float *bptr) {
+    uint16_t *q = ctx->qbuffer + 8 * i;
+    for (int k = 0; k < 3; k++) {
+        float x = ctx->qformat == QHALF ? half_to_float(q[k]) : (int16_t) q[k] / 32767.0f;
+        bptr[k] = x * ctx->qscale[k] + ctx->qoffset[k];
+    }
+    for (int k = 0; k < 2; k++) {
+        bptr[3 + k] = q[4 + k] / 65535.0f * ctx->uvscale[k] + ctx->uvoffset[k];
+    }
+    oct_decode((int16_t) q[6] / 32767.0f, (int16_t) q[7] / 32767.0f, bptr + 5);
+}
+
+#define quant_batch 256
+
+// pack the vertex buffer into 16 bytes per vertex: positions as halves or
+// snorm16 relative to the bounding box, unorm16 uvs over their range and
+// octahedral normals in two snorm16, then measure the worst errors
+void obj_quantize(objctx *ctx, int format) {
+    float *src = ctx->indexsize ? ctx->vbuffer : ctx->buffer;
+    int n = ctx->indexsize ? ctx->nunique : ctx->nfaceverts;
+    float lo[5], hi[5];
+    for (int k = 0; k < 5; k++) {
+        lo[k] = n ? src[k] : 0;
+        hi[k] = n ? src[k] : 0;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < 5; k++) {
+            float x = src[8 * i + k];
+            lo[k] = x < lo[k] ? x : lo[k];
+            hi[k] = x > hi[k] ? x : hi[k];
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        ctx->qoffset[k] = (lo[k] + hi[k]) / 2;
+        float half = (hi[k] - lo[k]) / 2;
+        ctx->qscale[k] = format == QHALF ? 1 : half > 0 ? half : 1;
+    }
+    for (int k = 0; k < 2; k++) {
+        ctx->uvoffset[k] = lo[3 + k];
+        ctx->uvscale[k] = hi[3 + k] > lo[3 + k] ? hi[3 + k] - lo[3 + k] : 1;
+    }
+    ctx->qformat = format;
+    ctx->qbuffer = calloc(8 * n + 1, sizeof(uint16_t));
+    // components are gathered into runs so each conversion kernel sees a flat array
+    float column[quant_batch];
+    uint16_t packed[quant_batch];
+    for (int base = 0; base < n; base += quant_batch) {
+        int count = n - base < quant_batch ? n - base : quant_batch;
+        for (int k = 0; k < 5; k++) {
+            float offset = k < 3 ? ctx->qoffset[k] : ctx->uvoffset[k - 3];
+            for (int i = 0; i < count; i++) {
+                column[i] = src[8 * (base + i) + k] - offset;
+            }
+            if (k < 3 && format == QHALF) {
+                pack_half(column, packed, count);
+            } else if (k < 3) {
+                pack_int16(column, (int16_t *) packed, count, 32767 / ctx->qscale[k], -32767, 32767);
+            } else {
+                pack_uint16(column, packed, count, 65535 / ctx->uvscale[k - 3]);
+            }
+            for (int i = 0; i < count; i++) {
+                ctx->qbuffer[8 * (base + i) + (k < 3 ? k : k + 1)] = packed[i];
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            uint16_t *q = ctx->qbuffer + 8 * (base + i);
+            q[3] = format == QHALF ? 0x3c00 : 32767;        // w = 1
+            float oct[2];
+            oct_encode(src + 8 * (base + i) + 5, oct);
+            pack_int16(oct, (int16_t *) q + 6, 2, 32767, -32767, 32767);
+        }
+    }
+    memset(ctx->qerror, 0, sizeof(ctx->qerror));
+    for (int i = 0; i < n; i++) {
+        float *bptr = src + 8 * i;
+        float decoded[8];
+        dequantize_vertex(ctx, i, decoded);
+        for (int k = 0; k < 3; k++) {
+            float e = fabsf(decoded[k] - bptr[k]);
+            ctx->qerror[0] = e > ctx->qerror[0] ? e : ctx->qerror[0];
+        }
+        for (int k = 3; k < 5; k++) {
+            float e = fabsf(decoded[k] - bptr[k]);
+            ctx->qerror[1] = e > ctx->qerror[1] ? e : ctx->qerror[1];
+        }
+        // in double, acosf alone is off by hundredths of a degree near 1
+        double length = sqrt((double) bptr[5] * bptr[5] + (double) bptr[6] * bptr[6]
+            + (double) bptr[7] * bptr[7]);
+        double decodedlength = sqrt((double) decoded[5] * decoded[5]
+            + (double) decoded[6] * decoded[6] + (double) decoded[7] * decoded[7]);
+        if (length > 0) {
+            double dot = ((double) decoded[5] * bptr[5] + (double) decoded[6] * bptr[6]
+                + (double) decoded[7] * bptr[7]) / length / decodedlength;
+            float e = acos(dot < 1 ? dot : 1) * 180 / M_PI;
+            ctx->qerror[2] = e > ctx->qerror[2] ? e : ctx->qerror[2];
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        // half rounds to 11 significant bits, snorm16 to steps of qscale / 32767,
+        // plus the float rounding of moving the value to and from the box centre
+        float extent = fmaxf(fabsf(lo[k] - ctx->qoffset[k]), fabsf(hi[k] - ctx->qoffset[k]));
+        float bound = format == QHALF ? extent / 2048 : ctx->qscale[k] / 32767 / 2;
+        bound += 2 * fmaxf(fabsf(lo[k]), fabsf(hi[k])) * FLT_EPSILON;
+        ctx->qerror[3] = bound > ctx->qerror[3] ? bound : ctx->qerror[3];
+    }
+}
+
+// split n interleaved vertices into planes
+void build_soa(objsoa *soa, const float *src, int n) {
+    soa->count = n;
+    soa->stride = ((size_t) n + 15) & ~(size_t) 15;
+    soa->data = aligned_alloc(64, 8 * sizeof(float) * (soa->stride ? soa->stride : 16));
+    float **planes[] = {
+        &soa->x, &soa->y, &soa->z, &soa->u, &soa->v, &soa->nx, &soa->ny, &soa->nz
+    };
+    for (int k = 0; k < 8; k++) {
+        *planes[k] = soa->data + k * soa->stride;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < 8; k++) {
+            soa->data[k * soa->stride + i] = src[8 * i + k];
+        }
+    }
+}
+
+// vertex i of the expanded, indexed or soa buffer as 8 floats
+void obj_vertex(objctx *ctx, int i, float *bptr) {
+    if (ctx->soa.data) {
+        for (int k = 0; k < 8; k++) {
+            bptr[k] = ctx->soa.data[k * ctx->soa.stride + i];
+        }
+    } else {
+        memcpy(bptr, (ctx->indexsize ? ctx->vbuffer : ctx->buffer) + 8 * i, 8 * sizeof(float));
+    }
+}
+
+// positions through a 3x4 matrix and normals through its 3x3 part, uvs are copied
+void transform_aos(const float *restrict src, float *restrict dst, int n, const float *m) {
+    for (int i = 0; i < n; i++) {
+        const float *s = src + 8 * i;
+        float *d = dst + 8 * i;
+        d[0] = m[0] * s[0] + m[1] * s[1] + m[2] * s[2] + m[3];
+        d[1] = m[4] * s[0] + m[5] * s[1] + m[6] * s[2] + m[7];
+        d[2] = m[8] * s[0] + m[9] * s[1] + m[10] * s[2] + m[11];
+        d[3] = s[3];
+        d[4] = s[4];
+        d[5] = m[0] * s[5] + m[1] * s[6] + m[2] * s[7];
+        d[6] = m[4] * s[5] + m[5] * s[6] + m[6] * s[7];
+        d[7] = m[8] * s[5] + m[9] * s[6] + m[10] * s[7];
+    }
+}
+
+// one 3x4 matrix over three planes, w is 1 for points and 0 for directions
+void transform_planes(
+    const float *restrict x, const float *restrict y, const float *restrict z,
+    float *restrict dx, float *restrict dy, float *restrict dz, int n, const float *m, float w
+) {
+    float m0 = m[0], m1 = m[1], m2 = m[2], m3 = m[3] * w;
+    float m4 = m[4], m5 = m[5], m6 = m[6], m7 = m[7] * w;
+    float m8 = m[8], m9 = m[9], m10 = m[10], m11 = m[11] * w;
+    for (int i = 0; i < n; i++) {
+        dx[i] = m0 * x[i] + m1 * y[i] + m2 * z[i] + m3;
+        dy[i] = m4 * x[i] + m5 * y[i] + m6 * z[i] + m7;
+        dz[i] = m8 * x[i] + m9 * y[i] + m10 * z[i] + m11;
+    }
+}
+
+// the same on planes, every loop is unit stride so it vectorizes without gathers
+void transform_soa(const objsoa *src, objsoa *dst, const float *m) {
+    int n = src->count;
+    transform_planes(src->x, src->y, src->z, dst->x, dst->y, dst->z, n, m, 1);
+    memcpy(dst->u, src->u, n * sizeof(float));
+    memcpy(dst->v, src->v, n * sizeof(float));
+    transform_planes(src->nx, src->ny, src->nz, dst->nx, dst->ny, dst->nz, n, m, 0);
+}
+
+#define bvh_bins 16         // centroid bins per axis when looking for a split
+#define bvh_leaf 2          // ranges this small are never split
+#define bvh_maxleaf 16      // ranges this large are split even when sah says not to
+#define bvh_depth 60        // deeper ranges become leaves, so queries fit a fixed stack
+
+// bvh node in 32 bytes: count 0 is an inner node whose left child follows it
+// and whose right child is at offset, otherwise a leaf of count triangles from offset
+typedef struct {
+    float min[3];
+    int   offset;
+    float max[3];
+    int   count;
+} objnode;
+
+typedef struct {
+    int     nnodes;
+    objnode *nodes;
+    int     ntris;
+    int     *tris;          // triangle index of each leaf triangle
+    float   *verts;         // 9 floats of positions per leaf triangle, in leaf order
+} objbvh;
+
+typedef struct {
+    float min[3];
+    float max[3];
+} objbox;
+
+typedef struct {
+    int     begin;
+    int     end;
+    int     depth;
+    int     nnodes;
+    int     capnodes;
+    objnode *nodes;
+} bvhtask;
+
+// triangle bounds, center and index, partitioned in place while building
+typedef struct {
+    objbox box;
+    float  center[3];
+    int    tri;
+} bvhref;
+
+typedef struct {
+    objctx  *ctx;
+    bvhref  *refs;
+    int     ntasks;         // subtrees left for the worker threads
+    int     captasks;
+    int     nexttask;
+    bvhtask *tasks;
+} bvhbuild;
+
+void box_empty(objbox *box) {
+    for (int k = 0; k < 3; k++) {
+        box->min[k] = INFINITY;
+        box->max[k] = -INFINITY;
+    }
+}
+
+// comparisons rather than fminf and fmaxf, which are library calls unless nans are ruled out
+void box_grow(objbox *box, const float *p) {
+    for (int k = 0; k < 3; k++) {
+        box->min[k] = p[k] < box->min[k] ? p[k] : box->min[k];
+        box->max[k] = p[k] > box->max[k] ? p[k] : box->max[k];
+    }
+}
+
+void box_merge(objbox *box, const objbox *other) {
+    for (int k = 0; k < 3; k++) {
+        box->min[k] = other->min[k] < box->min[k] ? other->min[k] : box->min[k];
+        box->max[k] = other->max[k] > box->max[k] ? other->max[k] : box->max[k];
+    }
+}
+
+float box_area(const objbox *box) {
+    float dx = box->max[0] - box->min[0];
+    float dy = box->max[1] - box->min[1];
+    float dz = box->max[2] - box->min[2];
+    return dx < 0 ? 0 : 2 * (dx * dy + dy * dz + dz * dx);
+}
+
+// bounds of each triangle, empty when one of its vertex indices is out of range
+void bvh_bounds(void *arg, int begin, int end) {
+    bvhbuild *build = arg;
+    objctx *ctx = build->ctx;
+    for (int t = begin; t < end; t++) {
+        bvhref *ref = build->refs + t;
+        objbox *box = &ref->box;
+        ref->tri = t;
+        box_empty(box);
+        for (int k = 0; k < 3; k++) {
+            int vert = ctx->faces[9 * t + 3 * k];
+            if (vert < 1 || vert > ctx->nvertices) {
+                box_empty(box);
+                break;
+            }
+            box_grow(box, ctx->vertices + 3 * (vert - 1));
+        }
+        for (int k = 0; k < 3; k++) {
+            ref->center[k] = (box->min[k] + box->max[k]) / 2;
+        }
+    }
+}
+
+// bounds of tris[begin, end) and the binned sah split of it, or -1 for a leaf
+int bvh_split(bvhbuild *build, int begin, int end, int depth, objbox *bounds) {
+    objbox centroids;
+    box_empty(bounds);
+    box_empty(&centroids);
+    for (int i = begin; i < end; i++) {
+        box_merge(bounds, &build->refs[i].box);
+        box_grow(&centroids, build->refs[i].center);
+    }
+    int n = end - begin;
+    if (n <= bvh_leaf || depth >= bvh_depth) {
+        return -1;
+    }
+    // all three axes are binned in one pass over the references, with fewer
+    // bins for small ranges where setting them up would cost more than binning
+    int nbins = n < bvh_bins ? n : bvh_bins;
+    float lo[3], scale[3];
+    int counts[3][bvh_bins] = {{0}};
+    objbox bins[3][bvh_bins];
+    for (int a = 0; a < 3; a++) {
+        float extent = centroids.max[a] - centroids.min[a];
+        lo[a] = centroids.min[a];
+        scale[a] = extent > 0 ? nbins / extent : 0;
+        for (int b = 0; b < nbins; b++) {
+            box_empty(bins[a] + b);
+        }
+    }
+    for (int i = begin; i < end; i++) {
+        const bvhref *ref = build->refs + i;
+        for (int a = 0; a < 3; a++) {
+            int b = (ref->center[a] - lo[a]) * scale[a];
+            b = b < nbins ? b : nbins - 1;
+            counts[a][b]++;
+            box_merge(bins[a] + b, &ref->box);
+        }
+    }
+    float best = INFINITY;
+    int axis = -1, split = 0;
+    for (int a = 0; a < 3; a++) {
+        if (!scale[a]) {
+            continue;
+        }
+        // sweep from the right for the areas and counts right of each plane
+        float rightarea[bvh_bins];
+        int rightcount[bvh_bins];
+        objbox acc;
+        box_empty(&acc);
+        for (int b = nbins - 1, count = 0; b > 0; b--) {
+            box_merge(&acc, bins[a] + b);
+            count += counts[a][b];
+            rightarea[b] = box_area(&acc);
+            rightcount[b] = count;
+        }
+        box_empty(&acc);
+        for (int b = 0, count = 0; b < nbins - 1; b++) {
+            box_merge(&acc, bins[a] + b);
+            count += counts[a][b];
+            float cost = count * box_area(&acc) + rightcount[b + 1] * rightarea[b + 1];
+            if (count && rightcount[b + 1] && cost < best) {
+                best = cost, axis = a, split = b + 1;
+            }
+        }
+    }
+    // a traversal step and a triangle test cost the same, all relative to the parent area
+    if (axis < 0 || box_area(bounds) + best >= n * box_area(bounds)) {
+        if (n <= bvh_maxleaf) {
+            return -1;
+        }
+        if (axis < 0) {                     // every centroid in one spot
+            return begin + n / 2;
+        }
+    }
+    int i = begin, j = end - 1;
+    while (i <= j) {
+        int b = (build->refs[i].center[axis] - lo[axis]) * scale[axis];
+        if ((b < nbins ? b : nbins - 1) < split) {
+            i++;
+        } else {
+            bvhref ref = build->refs[i];
+            build->refs[i] = build->refs[j];
+            build->refs[j--] = ref;
+        }
+    }
+    return i > begin && i < end ? i : begin + n / 2;
+}
+
+int bvh_node(bvhtask *task, const objbox *bounds, int offset, int count) {
+    task->nodes = reserve(task->nodes, &task->capnodes, task->nnodes + 1, sizeof(objnode));
+    objnode *node = task->nodes + task->nnodes;
+    memcpy(node->min, bounds->min, sizeof(node->min));
+    memcpy(node->max, bounds->max, sizeof(node->max));
+    node->offset = offset;
+    node->count = count;
+    return task->nnodes++;
+}
+
+// build tris[begin, end) into task depth first
+int bvh_subtree(bvhbuild *build, bvhtask *task, int begin, int end, int depth) {
+    objbox bounds;
+    int mid = bvh_split(build, begin, end, depth, &bounds);
+    int node = bvh_node(task, &bounds, begin, end - begin);
+    if (mid >= 0) {
+        task->nodes[node].count = 0;
+        bvh_subtree(build, task, begin, mid, depth + 1);
+        int right = bvh_subtree(build, task, mid, end, depth + 1);
+        task->nodes[node].offset = right;   // the recursion may have moved nodes
+    }
+    return node;
+}
+
+// split the top levels on the calling thread, ranges below levels deep become
+// tasks that are stood in for by nodes with count -1 - task
+int bvh_top(bvhbuild *build, bvhtask *top, int begin, int end, int depth, int levels) {
+    if (depth == levels) {
+        build->tasks = reserve(build->tasks, &build->captasks, build->ntasks + 1, sizeof(bvhtask));
+        build->tasks[build->ntasks] = (bvhtask){ .begin = begin, .end = end, .depth = depth };
+        objbox bounds;
+        box_empty(&bounds);
+        return bvh_node(top, &bounds, 0, -1 - build->ntasks++);
+    }
+    objbox bounds;
+    int mid = bvh_split(build, begin, end, depth, &bounds);
+    int node = bvh_node(top, &bounds, begin, end - begin);
+    if (mid >= 0) {
+        top->nodes[node].count = 0;
+        bvh_top(build, top, begin, mid, depth + 1, levels);
+        int right = bvh_top(build, top, mid, end, depth + 1, levels);
+        top->nodes[node].offset = right;
+    }
+    return node;
+}
+
+void *bvh_worker(void *arg) {
+    bvhbuild *build = arg;
+    int i;
+    while ((i = __atomic_fetch_add(&build->nexttask, 1, __ATOMIC_RELAXED)) < build->ntasks) {
+        bvhtask *task = build->tasks + i;
+        bvh_subtree(build, task, task->begin, task->end, task->depth);
+    }
+    return NULL;
+}
+
+// copy the top nodes depth first into bvh, splicing in the subtrees
+void bvh_flatten(bvhbuild *build, objbvh *bvh, const objnode *top, int i) {
+    if (top[i].count < 0) {
+        bvhtask *task = build->tasks - 1 - top[i].count;
+        int base = bvh->nnodes;
+        for (int j = 0; j < task->nnodes; j++) {
+            objnode *node = bvh->nodes + base + j;
+            *node = task->nodes[j];
+            node->offset += node->count ? 0 : base;
+        }
+        bvh->nnodes += task->nnodes;
+        return;
+    }
+    int node = bvh->nnodes++;
+    bvh->nodes[node] = top[i];
+    if (!top[i].count) {
+        bvh_flatten(build, bvh, top, i + 1);
+        bvh->nodes[node].offset = bvh->nnodes;
+        bvh_flatten(build, bvh, top, top[i].offset);
+    }
+}
+
+// copy the positions of the leaf triangles in leaf order
+void bvh_gather(void *arg, int begin, int end) {
+    objbvh *bvh = ((void **) arg)[0];
+    objctx *ctx = ((void **) arg)[1];
+    for (int i = begin; i < end; i++) {
+        for (int k = 0; k < 3; k++) {
+            memcpy(bvh->verts + 9 * i + 3 * k,
+                ctx->vertices + 3 * (ctx->faces[9 * bvh->tris[i] + 3 * k] - 1), 3 * sizeof(float));
+        }
+    }
+}
+
+// build a bvh over the triangles of ctx with binned sah: the top levels are
+// split on this thread and the subtrees under them by nthreads threads
+void bvh_build(objbvh *bvh, objctx *ctx, int nthreads) {
+    int ntris = ctx->nfaceverts / 3;
+    bvhbuild build = { .ctx = ctx, .refs = malloc(ntris * sizeof(bvhref) + 1) };
+    run_ranges(ntris, nthreads, bvh_bounds, &build);
+    memset(bvh, 0, sizeof(*bvh));
+    for (int t = 0; t < ntris; t++) {       // leave out triangles with bad indices
+        if (build.refs[t].box.min[0] <= build.refs[t].box.max[0]) {
+            build.refs[bvh->ntris++] = build.refs[t];
+        }
+    }
+    if (bvh->ntris) {
+        // about four subtrees per thread so uneven splits still balance
+        nthreads = nthreads < 1 ? 1 : nthreads > 64 ? 64 : nthreads;
+        int levels = 0;
+        while (nthreads > 1 && 1 << levels < 4 * nthreads) {
+            levels++;
+        }
+        bvhtask top = {0};
+        bvh_top(&build, &top, 0, bvh->ntris, 0, levels);
+        pthread_t threads[64];
+        for (int i = 1; i < nthreads; i++) {
+            pthread_create(threads + i, NULL, bvh_worker, &build);
+        }
+        bvh_worker(&build);
+        for (int i = 1; i < nthreads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        int nnodes = top.nnodes - build.ntasks;
+        for (int i = 0; i < build.ntasks; i++) {
+            nnodes += build.tasks[i].nnodes;
+        }
+        bvh->nodes = aligned_alloc(64, (nnodes * sizeof(objnode) + 63) & ~(size_t) 63);
+        bvh_flatten(&build, bvh, top.nodes, 0);
+        for (int i = 0; i < build.ntasks; i++) {
+            free(build.tasks[i].nodes);
+        }
+        free(top.nodes);
+    }
+    bvh->tris = malloc(bvh->ntris * sizeof(int) + 1);
+    for (int i = 0; i < bvh->ntris; i++) {
+        bvh->tris[i] = build.refs[i].tri;
+    }
+    bvh->verts = malloc(9 * bvh->ntris * sizeof(float) + 1);
+    void *args[] = { bvh, ctx };
+    run_ranges(bvh->ntris, nthreads, bvh_gather, args);
+    free(build.tasks);
+    free(build.refs);
+}
+
+void bvh_free(objbvh *bvh) {
+    free(bvh->nodes);
+    free(bvh->tris);
+    free(bvh->verts);
+}
+
+typedef struct {
+    int   tri;              // triangle index in ctx, -1 for a miss
+    float t;                // hit at origin + t * dir
+    float u;                // barycentric coordinates of the second and third corners
+    float v;
+} objhit;
+
+// distance along the ray to the node box, infinity if it's missed or beyond tmax
+float ray_box(const objnode *node, const float *origin, const float *inv, float tmax) {
+    float tmin = 0;
+    for (int k = 0; k < 3; k++) {
+        float t0 = (node->min[k] - origin[k]) * inv[k];
+        float t1 = (node->max[k] - origin[k]) * inv[k];
+        float near = t0 < t1 ? t0 : t1, far = t0 < t1 ? t1 : t0;
+        tmin = near > tmin ? near : tmin;
+        tmax = far < tmax ? far : tmax;
+    }
+    return tmin <= tmax ? tmin : INFINITY;
+}
+
+// moller-trumbore, both sides count, updates hit when closer
+int ray_triangle(const float *tri, const float *origin, const float *dir, objhit *hit) {
+    float e1[3], e2[3], s[3], p[3], q[3];
+    for (int k = 0; k < 3; k++) {
+        e1[k] = tri[3 + k] - tri[k];
+        e2[k] = tri[6 + k] - tri[k];
+        s[k] = origin[k] - tri[k];
+    }
+    p[0] = dir[1] * e2[2] - dir[2] * e2[1];
+    p[1] = dir[2] * e2[0] - dir[0] * e2[2];
+    p[2] = dir[0] * e2[1] - dir[1] * e2[0];
+    float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    if (fabsf(det) < 1e-12f) {
+        return 0;
+    }
+    float inv = 1 / det;
+    float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+    if (u < 0 || u > 1) {
+        return 0;
+    }
+    q[0] = s[1] * e1[2] - s[2] * e1[1];
+    q[1] = s[2] * e1[0] - s[0] * e1[2];
+    q[2] = s[0] * e1[1] - s[1] * e1[0];
+    float v = (dir[0] * q[0] + dir[1] * q[1] + dir[2] * q[2]) * inv;
+    float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+    if (v < 0 || u + v > 1 || t <= 0 || t >= hit->t) {
+        return 0;
+    }
+    hit->t = t, hit->u = u, hit->v = v;
+    return 1;
+}
+
+// nearest triangle hit by origin + t * dir for t in (0, tmax), visiting the nearer child first
+int bvh_ray(const objbvh *bvh, const float *origin, const float *dir, float tmax, objhit *hit) {
+    *hit = (objhit){ .tri = -1, .t = tmax };
+    float inv[3] = { 1 / dir[0], 1 / dir[1], 1 / dir[2] };
+    if (!bvh->nnodes || ray_box(bvh->nodes, origin, inv, tmax) == INFINITY) {
+        return -1;
+    }
+    int stack[bvh_depth + 4];
+    float near[bvh_depth + 4];
+    int n = 0, i = 0;
+    for (;;) {
+        const objnode *node = bvh->nodes + i;
+        if (node->count) {
+            for (int j = node->offset; j < node->offset + node->count; j++) {
+                if (ray_triangle(bvh->verts + 9 * j, origin, dir, hit)) {
+                    hit->tri = j;
+                }
+            }
+        } else {
+            int left = i + 1, right = node->offset;
+            float tl = ray_box(bvh->nodes + left, origin, inv, hit->t);
+            float tr = ray_box(bvh->nodes + right, origin, inv, hit->t);
+            if (tl > tr) {
+                int swap = left;
+                left = right, right = swap;
+                float t = tl;
+                tl = tr, tr = t;
+            }
+            if (tl != INFINITY) {
+                if (tr != INFINITY) {
+                    stack[n] = right;
+                    near[n++] = tr;
+                }
+                i = left;
+                continue;
+            }
+        }
+        while (n && near[n - 1] >= hit->t) {  // skip boxes behind the nearest hit
+            n--;
+        }
+        if (!n) {
+            break;
+        }
+        i = stack[--n];
+    }
+    if (hit->tri >= 0) {
+        hit->tri = bvh->tris[hit->tri];
+    }
+    return hit->tri;
+}
+
+int box_overlap(const float *amin, const float *amax, const float *bmin, const float *bmax) {
+    return amin[0] <= bmax[0] && amax[0] >= bmin[0]
+        && amin[1] <= bmax[1] && amax[1] >= bmin[1]
+        && amin[2] <= bmax[2] && amax[2] >= bmin[2];
+}
+
+// append the triangles whose bounds overlap the box to *out, returns how many
+int bvh_overlap(const objbvh *bvh, const float *min, const float *max, int **out, int *cap) {
+    int count = 0;
+    int stack[bvh_depth + 4];
+    int n = 0;
+    if (bvh->nnodes) {
+        stack[n++] = 0;
+    }
+    while (n) {
+        const objnode *node = bvh->nodes + stack[--n];
+        if (!box_overlap(node->min, node->max, min, max)) {
+            continue;
+        }
+        if (!node->count) {
+            stack[n++] = node->offset;
+            stack[n++] = node - bvh->nodes + 1;
+            continue;
+        }
+        for (int j = node->offset; j < node->offset + node->count; j++) {
+            const float *tri = bvh->verts + 9 * j;
+            objbox box;
+            box_empty(&box);
+            for (int k = 0; k < 3; k++) {
+                box_grow(&box, tri + 3 * k);
+            }
+            if (box_overlap(box.min, box.max, min, max)) {
+                *out = reserve(*out, cap, count + 1, sizeof(int));
+                (*out)[count++] = bvh->tris[j];
+            }
+        }
+    }
+    return count;
+}
+
+// squared distance from p to the node box, 0 inside it
+float box_distance(const objnode *node, const float *p) {
+    float d = 0;
+    for (int k = 0; k < 3; k++) {
+        float e = p[k] < node->min[k] ? node->min[k] - p[k] : p[k] > node->max[k] ? p[k] - node->max[k] : 0;
+        d += e * e;
+    }
+    return d;
+}
+
+float dot3(const float *a, const float *b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// closest point to p on a triangle by the voronoi region p falls in, from ericson
+void closest_triangle(const float *tri, const float *p, float *out) {
+    const float *a = tri, *b = tri + 3, *c = tri + 6;
+    float ab[3], ac[3], ap[3], bp[3], cp[3];
+    for (int k = 0; k < 3; k++) {
+        ab[k] = b[k] - a[k], ac[k] = c[k] - a[k], ap[k] = p[k] - a[k];
+        bp[k] = p[k] - b[k], cp[k] = p[k] - c[k];
+    }
+    float d1 = dot3(ab, ap), d2 = dot3(ac, ap);
+    float d3 = dot3(ab, bp), d4 = dot3(ac, bp);
+    float d5 = dot3(ab, cp), d6 = dot3(ac, cp);
+    float va = d3 * d6 - d5 * d4, vb = d5 * d2 - d1 * d6, vc = d1 * d4 - d3 * d2;
+    float v, w;
+    if (d1 <= 0 && d2 <= 0) {
+        v = 0, w = 0;
+    } else if (d3 >= 0 && d4 <= d3) {
+        v = 1, w = 0;
+    } else if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+        v = d1 / (d1 - d3), w = 0;
+    } else if (d6 >= 0 && d5 <= d6) {
+        v = 0, w = 1;
+    } else if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+        v = 0, w = d2 / (d2 - d6);
+    } else if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+        w = (d4 - d3) / ((d4 - d3) + (d5 - d6)), v = 1 - w;
+    } else {
+        float denom = 1 / (va + vb + vc);
+        v = vb * denom, w = vc * denom;
+    }
+    for (int k = 0; k < 3; k++) {
+        out[k] = a[k] + ab[k] * v + ac[k] * w;
+    }
+}
+
+// closest point to p on the mesh written to out, returns its triangle or -1 if there are none
+int bvh_closest(const objbvh *bvh, const float *p, float *out) {
+    int best = -1;
+    float bestdist = INFINITY;
+    int stack[bvh_depth + 4];
+    float near[bvh_depth + 4];
+    int n = 0;
+    if (bvh->nnodes) {
+        stack[n] = 0;
+        near[n++] = box_distance(bvh->nodes, p);
+    }
+    while (n) {
+        n--;
+        if (near[n] >= bestdist) {
+            continue;
+        }
+        const objnode *node = bvh->nodes + stack[n];
+        if (node->count) {
+            for (int j = node->offset; j < node->offset + node->count; j++) {
+                float q[3];
+                closest_triangle(bvh->verts + 9 * j, p, q);
+                float d[3] = { q[0] - p[0], q[1] - p[1], q[2] - p[2] };
+                float dist = dot3(d, d);
+                if (dist < bestdist) {
+                    bestdist = dist, best = j;
+                    memcpy(out, q, sizeof(q));
+                }
+            }
+            continue;
+        }
+        int left = node - bvh->nodes + 1, right = node->offset;
+        float dl = box_distance(bvh->nodes + left, p);
+        float dr = box_distance(bvh->nodes + right, p);
+        if (dl < dr) {                      // the nearer child is popped first
+            int swap = left;
+            left = right, right = swap;
+            float d = dl;
+            dl = dr, dr = d;
+        }
+        stack[n] = left;
+        near[n++] = dl;
+        stack[n] = right;
+        near[n++] = dr;
+    }
+    return best < 0 ? -1 : bvh->tris[best];
+}
+
+void print_vertex(const float *bptr) {
+    int nd[] = {3, 2, 3};
+    int offs[] = {0, 3, 5};
+    for (int j = 0; j < 3; j++) {
+        printf("[ ");
+        for (int k = 0; k < nd[j]; k++) {
+            printf("%8.4f ", bptr[offs[j] + k]);
+        }
+        printf("] ");
+    }
+    putchar('\n');
+}
+
+void mtl_print(objctx *ctx) {
+    printf("materials:\n");
+    for (int i = 0; i < ctx->materials.nmaterials; i++) {
+        mtl *mtl = ctx->materials.materials + i;
+        printf("name:\t\t%s\n", mtl->name);
+        printf("ambient:\t[ ");
+        for (int j = 0; j < 3; j++) {
+            printf("%8.4f ", mtl->ambient[j]);
+        }
+        printf("]\n");
+        printf("diffuse:\t[ ");
+        for (int j = 0; j < 3; j++) {
+            printf("%8.4f ", mtl->diffuse[j]);
+        }
+        printf("]\n");
+        printf("specular:\t[ ");
+        for (int j = 0; j < 3; j++) {
+            printf("%8.4f ", mtl->specular[j]);
+        }
+        printf("]\n");
+        printf("emissive:\t[ ");
+        for (int j = 0; j < 3; j++) {
+            printf("%8.4f ", mtl->emissive[j]);
+        }
+        printf("]\n");
+        printf("shininess:\t%10.4f\n", mtl->shininess);
+        printf("refraction:\t%10.4f\n", mtl->refraction);
+        printf("transparency:\t%10.4f\n", mtl->transparency);
+        printf("illum:\t\t%5d\n", mtl->illum);
+        if (mtl->map_ambient) {
+            printf("ambient map: %s\n", mtl->map_ambient);
+        }
+        if (mtl->map_diffuse) {
+            printf("diffuse map: %s\n", mtl->map_diffuse);
+        }
+        if (mtl->map_specular) {
+            printf("specular map: %s\n", mtl->map_specular);
+        }
+        if (mtl->map_highlight) {
+            printf("highlight map: %s\n", mtl->map_highlight);
+        }
+        if (mtl->map_alpha) {
+            printf("alpha map: %s\n", mtl->map_alpha);
+        }
+        if (mtl->map_bump) {
+            printf("bump map: %s\n", mtl->map_bump);
+        }
+        for (int j = 0; ctx->materials.textures && j < mtl_nstrings - 1; j++) {
+            int handle = ctx->materials.textures[i * (mtl_nstrings - 1) + j];
+            if (!handle) {
+                continue;
+            }
+            objtexture *tex = texture_wait(handle);
+            if (tex->state == TEXREADY) {
+                printf("texture %d: %s, %dx%d rgba8, %d levels\n",
+                    handle, tex->path, tex->width, tex->height, tex->nlevels);
+            } else {
+                printf("texture %d: %s, %s\n", handle, tex->path, tex->error);
+            }
         }
     }
 }
@@ -436,154 +4142,2377 @@ void objctx_print(objctx *ctx) {
         if (i > 0 && (i % 3) == 0) {
             printf("\n%4d ", i);
         }
-        printf("[ ");
-        for (int j = 0; j < 3; j++) {
-            printf("%8.4f ", ctx->vertices[i * 3 + j]);
+        printf("[ ");
+        for (int j = 0; j < 3; j++) {
+            printf("%8.4f ", ctx->vertices[i * 3 + j]);
+        }
+        printf("] ");
+    }
+    putchar('\n');
+    printf("normals:\n");
+    printf("%4d ", 0);
+    for (int i = 0; i < ctx->nnormals; i++) {
+        if (i > 0 && (i % 3) == 0) {
+            printf("\n%4d ", i);
+        }
+        printf("[ ");
+        for (int j = 0; j < 3; j++) {
+            printf("%8.4f ", ctx->normals[i * 3 + j]);
+        }
+        printf("] ");
+    }
+    putchar('\n');
+    printf("texcoords:\n");
+    printf("%4d ", 0);
+    for (int i = 0; i < ctx->ntexcoords; i++) {
+        if (i > 0 && (i % 3) == 0) {
+            printf("\n%4d ", i);
+        }
+        printf("[ ");
+        for (int j = 0; j < 2; j++) {
+            printf("%8.4f ", ctx->texcoords[i * 2 + j]);
+        }
+        printf("] ");
+    }
+    putchar('\n');
+    printf("mesh offsets:\n");
+    for (int i = 0; i < ctx->nmeshes + 1; i++) {
+        if (i > 0 && (i % 16) == 0) {
+            putchar('\n');
+        }
+        printf("%4d ", ctx->meshoffsets[i]);
+    }
+    putchar('\n');
+    printf("faces:\n");
+    printf("%4d ", 0);
+    for (int i = 0; i < ctx->nfaceverts; i++) {
+        if (i > 0 && (i % 3) == 0) {
+            printf("\n%4d ", i);
+        }
+        printf("[ ");
+        for (int j = 0; j < 3; j++) {
+            printf("%4d ", ctx->faces[i * 3 + j]);
+        }
+        printf("] ");
+    }
+    putchar('\n');
+    if (ctx->indexsize) {
+        size_t expanded = 8 * sizeof(float) * (size_t) ctx->nfaceverts;
+        size_t indexed = 8 * sizeof(float) * (size_t) ctx->nunique
+            + (size_t) ctx->indexsize * ctx->nfaceverts;
+        printf("unique vertices: %d of %d, %d byte indices\n",
+            ctx->nunique, ctx->nfaceverts, ctx->indexsize);
+        printf("buffer size: %zu bytes indexed, %zu bytes expanded\n", indexed, expanded);
+        if (ctx->acmr[0]) {
+            printf("acmr: %.3f -> %.3f, atvr: %.3f -> %.3f (fifo cache of %d)\n",
+                ctx->acmr[0], ctx->acmr[1], ctx->atvr[0], ctx->atvr[1], cache_size);
+        }
+        printf("vertex buffer:\n");
+        for (int i = 0; i < ctx->nunique; i++) {
+            float vertex[8];
+            obj_vertex(ctx, i, vertex);
+            printf("%4d ", i);
+            print_vertex(vertex);
+        }
+        printf("indices:\n");
+        for (int i = 0; i < ctx->nfaceverts; i++) {
+            if (i > 0 && (i % 16) == 0) {
+                putchar('\n');
+            }
+            printf("%4d ", obj_index(ctx, i));
+        }
+        putchar('\n');
+        for (int level = 0; level < ctx->nlods; level++) {
+            const int *offsets = ctx->lodoffsets + level * (ctx->nmeshes + 1);
+            int n = offsets[ctx->nmeshes + 1] - offsets[0];
+            int ntris = ctx->nfaceverts / 3;
+            if (n / 3 < ntris) {
+                printf("lod %d: %d of %d triangles (%.1f%%, target %g%%)\n", level + 1, n / 3, ntris,
+                    n / 3 * 100.0 / ntris, lod_ratios[level] * 100);
+            } else {
+                printf("lod %d: %d of %d triangles (not reduced, target %g%%)\n", level + 1, n / 3, ntris,
+                    lod_ratios[level] * 100);
+            }
+            for (int i = 0; i < n; i++) {
+                if (i > 0 && (i % 16) == 0) {
+                    putchar('\n');
+                }
+                printf("%4u ", ctx->lodindices[offsets[0] + i]);
+            }
+            putchar('\n');
+        }
+    } else {
+        printf("buffer:\n");
+        for (int i = 0; i < ctx->nfaceverts; i++) {
+            float vertex[8];
+            obj_vertex(ctx, i, vertex);
+            printf("%4d ", i);
+            print_vertex(vertex);
+        }
+    }
+    if (ctx->nmeshlets) {
+        printf("meshlets: %d, %.1f vertices and %.1f triangles on average\n", ctx->nmeshlets,
+            (double) ctx->nmeshletvertices / ctx->nmeshlets,
+            (double) ctx->nmeshlettriangles / 3 / ctx->nmeshlets);
+        for (int i = 0; i < ctx->nmeshlets; i++) {
+            objmeshlet *meshlet = ctx->meshlets + i;
+            printf("%4d mesh %d, %u vertices, %u triangles, sphere [ %g %g %g ] %g,"
+                " cone [ %g %g %g ] %g apex [ %g %g %g ]\n", i, meshlet->mesh,
+                meshlet->nvertices, meshlet->ntriangles,
+                meshlet->center[0], meshlet->center[1], meshlet->center[2], meshlet->radius,
+                meshlet->axis[0], meshlet->axis[1], meshlet->axis[2], meshlet->cutoff,
+                meshlet->apex[0], meshlet->apex[1], meshlet->apex[2]);
+            printf("    vertices:");
+            for (uint32_t j = 0; j < meshlet->nvertices; j++) {
+                printf(" %u", ctx->meshletvertices[meshlet->vertexoffset + j]);
+            }
+            printf("\n    triangles:");
+            for (uint32_t j = 0; j < 3 * meshlet->ntriangles; j++) {
+                printf(" %u", ctx->meshlettriangles[meshlet->triangleoffset + j]);
+            }
+            putchar('\n');
+        }
+    }
+    if (ctx->qformat) {
+        int n = ctx->indexsize ? ctx->nunique : ctx->nfaceverts;
+        printf("quantized buffer: %s positions, 16 bytes per vertex, %zu bytes\n",
+            qformats[ctx->qformat], 16 * (size_t) n);
+        printf("position scale: [ %g %g %g ] offset: [ %g %g %g ]\n",
+            ctx->qscale[0], ctx->qscale[1], ctx->qscale[2],
+            ctx->qoffset[0], ctx->qoffset[1], ctx->qoffset[2]);
+        printf("uv scale: [ %g %g ] offset: [ %g %g ]\n",
+            ctx->uvscale[0], ctx->uvscale[1], ctx->uvoffset[0], ctx->uvoffset[1]);
+        printf("max error: position %g (bound %g), uv %g, normal %g degrees\n",
+            ctx->qerror[0], ctx->qerror[3], ctx->qerror[1], ctx->qerror[2]);
+        for (int i = 0; i < n; i++) {
+            uint16_t *q = ctx->qbuffer + 8 * i;
+            printf("%4d [ %6d %6d %6d %6d ] [ %5u %5u ] [ %6d %6d ]\n", i,
+                ctx->qformat == QHALF ? q[0] : (int16_t) q[0],
+                ctx->qformat == QHALF ? q[1] : (int16_t) q[1],
+                ctx->qformat == QHALF ? q[2] : (int16_t) q[2],
+                ctx->qformat == QHALF ? q[3] : (int16_t) q[3],
+                q[4], q[5], (int16_t) q[6], (int16_t) q[7]);
+        }
+    }
+    printf("material indices:\n");
+    for (int i = 0; i < ctx->nmeshes; i++) {
+        if (i > 0 && (i % 16 == 0)) {
+            putchar('\n');
+        }
+        printf("%4d ", ctx->mtlindices[i]);
+    }
+    putchar('\n');
+    if (ctx->ndraws) {
+        printf("draws: %d for %d meshes\n", ctx->ndraws, ctx->nmeshes);
+        for (int i = 0; i < ctx->ndraws; i++) {
+            objdraw *draw = ctx->draws + i;
+            printf("%4d material %d %s, faces %d to %d, meshes %d to %d\n", i, draw->material,
+                draw->material < 0 ? "(none)" : ctx->materials.materials[draw->material].name,
+                draw->offset / 3, (draw->offset + draw->count) / 3,
+                draw->mesh, draw->mesh + draw->nmeshes);
+        }
+    }
+    mtl_print(ctx);
+}
+
+void objctx_free(objctx *ctx) {
+    mtlctx_free(&ctx->materials);
+    free(ctx->qbuffer);
+    free(ctx->draws);
+    free(ctx->lodoffsets);
+    free(ctx->lodindices);
+    free(ctx->soa.data);
+    if (ctx->cache) {           // the arrays live in the mapped cache file
+        munmap(ctx->cache, ctx->cachesize);
+        return;
+    }
+    free(ctx->vertices);
+    free(ctx->normals);
+    free(ctx->texcoords);
+    free(ctx->faces);
+    free(ctx->buffer);
+    free(ctx->vbuffer);
+    free(ctx->indices);
+    free(ctx->meshoffsets);
+    free(ctx->mtlindices);
+    free(ctx->smooth);
+    free(ctx->switches);
+    free(ctx->meshlets);
+    free(ctx->meshletvertices);
+    free(ctx->meshlettriangles);
+}
+
+/* sha-256 functions, see sha256/sha.c */
+#define ROTR(x, n) ((x >> n) | (x << (32 - n)))
+#define CH(x, y, z) ((x & y) ^ (~x & z))
+#define MAJ(x, y, z) ((x & y) ^ (x & z) ^ (y & z))
+#define S0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define s0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ (x >> 3))
+#define s1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ (x >> 10))
+
+// incremental sha-256 context: input is consumed one 64 byte block at a time
+typedef struct {
+    uint32_t H[8];
+    uint8_t block[64];
+    size_t used;
+    uint64_t length;
+} sha256_ctx;
+
+const uint32_t K[] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const uint32_t H0[] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+// initialize context
+void sha256_init(sha256_ctx *ctx) {
+    memcpy(ctx->H, H0, sizeof(H0));
+    ctx->used = 0;
+    ctx->length = 0;
+}
+
+// process one 64 byte block
+void sha256_block(sha256_ctx *ctx, const uint8_t *block) {
+    uint32_t W[64];
+    uint32_t a, b, c, d, e, f, g, h, T1, T2;
+    for (int t = 0; t < 16; t++) {
+        const uint8_t *p = block + 4 * t;
+        W[t] = (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    }
+    for (int t = 16; t < 64; t++) {
+        W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16];
+    }
+    a = ctx->H[0];
+    b = ctx->H[1];
+    c = ctx->H[2];
+    d = ctx->H[3];
+    e = ctx->H[4];
+    f = ctx->H[5];
+    g = ctx->H[6];
+    h = ctx->H[7];
+    for (int t = 0; t < 64; t++) {
+        T1 = h + S1(e) + CH(e, f, g) + K[t] + W[t];
+        T2 = S0(a) + MAJ(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + T1;
+        d = c;
+        c = b;
+        b = a;
+        a = T1 + T2;
+    }
+    ctx->H[0] += a;
+    ctx->H[1] += b;
+    ctx->H[2] += c;
+    ctx->H[3] += d;
+    ctx->H[4] += e;
+    ctx->H[5] += f;
+    ctx->H[6] += g;
+    ctx->H[7] += h;
+}
+
+#ifdef __SHA__
+// process whole blocks with the x86 sha extensions, four rounds per pair of
+// sha256rnds2 and the message schedule four words at a time
+void sha256_blocks(sha256_ctx *ctx, const uint8_t *p, size_t n) {
+    const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) ctx->H), 0xb1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) (ctx->H + 4)), 0x1b);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);      // abef
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);            // cdgh
+    for (; n; n--, p += 64) {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i w[4];
+        for (int i = 0; i < 4; i++) {
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (p + 16 * i)), swap);
+        }
+        for (int i = 0; i < 16; i++) {
+            __m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *) (K + 4 * i)));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+            if (i < 12) {
+                __m128i x = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                x = _mm_add_epi32(x, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(x, w[(i + 3) & 3]);
+            }
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+    tmp = _mm_shuffle_epi32(state0, 0x1b);                  // feba
+    state1 = _mm_shuffle_epi32(state1, 0xb1);               // dchg
+    _mm_storeu_si128((__m128i *) ctx->H, _mm_blend_epi16(tmp, state1, 0xf0));
+    _mm_storeu_si128((__m128i *) (ctx->H + 4), _mm_alignr_epi8(state1, tmp, 8));
+}
+#else
+void sha256_blocks(sha256_ctx *ctx, const uint8_t *p, size_t n) {
+    for (; n; n--, p += 64) {
+        sha256_block(ctx, p);
+    }
+}
+#endif
+
+// feed bytes into the context
+void sha256_update(sha256_ctx *ctx, const void *data, size_t size) {
+    const uint8_t *p = data;
+    ctx->length += size;
+    if (ctx->used) {
+        size_t n = 64 - ctx->used < size ? 64 - ctx->used : size;
+        memcpy(ctx->block + ctx->used, p, n);
+        ctx->used += n;
+        p += n;
+        size -= n;
+        if (ctx->used < 64) {
+            return;
+        }
+        sha256_block(ctx, ctx->block);
+        ctx->used = 0;
+    }
+    sha256_blocks(ctx, p, size / 64);
+    p += size & ~(size_t) 63;
+    size &= 63;
+    memcpy(ctx->block, p, size);
+    ctx->used = size;
+}
+
+// pad the message and copy hash value into digest buffer
+void sha256_final(sha256_ctx *ctx, uint8_t *digest) {
+    uint64_t l = ctx->length * 8;
+    uint8_t pad[72] = { 0x80 };
+    size_t k = (ctx->used < 56 ? 56 : 120) - ctx->used;
+    for (int i = 0; i < 8; i++) {
+        pad[k + i] = l >> (56 - 8 * i);
+    }
+    sha256_update(ctx, pad, k + 8);
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 4; j++) {
+            digest[4 * i + j] = ctx->H[i] >> (24 - 8 * j);
+        }
+    }
+}
+
+#define cache_magic "OBJCACHE"
+#define cache_version 2
+#define cache_align 64
+#define cache_indexed 1
+#define cache_optimized 2
+#define cache_normals 4                 // the crease angle is kept in hundredths of a degree above bit 8
+#define cache_meshlets 8
+#define cache_sorted 16
+
+// size and modification time of a source file, when none of them changed
+// since the cache was written the sources aren't hashed again
+typedef struct {
+    uint64_t size;
+    int64_t  sec;
+    int64_t  nsec;
+} cachestat;
+
+// binary cache layout: this header, then the mtl paths and their stats, the
+// arrays and the materials, each section aligned so the arrays can be used
+// in place. values are stored in native byte order
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t flags;         // build options the arrays were made with
+    uint8_t  digest[32];    // sha-256 of the obj file followed by its mtl files
+    uint64_t size;          // whole file, catches truncated writes
+    cachestat source;       // the obj file
+    int32_t  nmeshes;
+    int32_t  nvertices;
+    int32_t  nnormals;
+    int32_t  ntexcoords;
+    int32_t  nfaces;
+    int32_t  nfaceverts;
+    int32_t  nunique;
+    int32_t  indexsize;
+    int32_t  nmaterials;
+    int32_t  nlibraries;
+    int32_t  nmeshlets;
+    int32_t  nmeshletvertices;
+    int32_t  nmeshlettriangles;
+    float    acmr[2];
+    float    atvr[2];
+} cacheheader;
+
+uint32_t cache_flags(objopts *opts) {
+    return (opts->indexed || opts->optimize ? cache_indexed : 0)
+        | (opts->optimize ? cache_optimized : 0)
+        | (opts->normals ? cache_normals | (uint32_t) lrintf(opts->crease * 100) << 8 : 0)
+        | (opts->meshlets ? cache_meshlets : 0)
+        | (opts->sort ? cache_sorted : 0);
+}
+
+int cache_stat(const char *path, cachestat *out) {
+    struct stat st;
+    if (!path || stat(path, &st)) {
+        return -1;
+    }
+    *out = (cachestat){ st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+    return 0;
+}
+
+// the mapped obj file, its part of the key is hashed at most once per load
+typedef struct {
+    const char *filename;
+    const char *data;
+    size_t     size;
+    int        hashed;
+    sha256_ctx sha;
+} cachesource;
+
+// the cache key: the obj file followed by every mtl file
+int cache_digest(cachesource *source, char **libraries, int nlibraries, uint8_t *digest) {
+    if (!source->hashed) {
+        sha256_init(&source->sha);
+        sha256_update(&source->sha, source->data, source->size);
+        source->hashed = 1;
+    }
+    sha256_ctx sha = source->sha;
+    for (int i = 0; i < nlibraries; i++) {
+        filemap map;
+        if (file_map(&map, libraries[i])) {
+            return -1;
+        }
+        sha256_update(&sha, map.data, map.size);
+        file_unmap(&map);
+    }
+    sha256_final(&sha, digest);
+    return 0;
+}
+
+// write one section padded to the cache alignment
+void cache_write(FILE *file, const void *data, size_t size, uint64_t *offset) {
+    static const char zeros[cache_align];
+    if (size) {
+        fwrite(data, 1, size, file);
+    }
+    *offset += size;
+    size_t pad = -*offset & (cache_align - 1);
+    fwrite(zeros, 1, pad, file);
+    *offset += pad;
+}
+
+// take the next section of the mapped cache, NULL if it runs past the end
+void *cache_read(char *data, uint64_t size, uint64_t *offset, size_t length) {
+    if (length > size - *offset) {
+        return NULL;
+    }
+    void *section = data + *offset;
+    *offset += (length + cache_align - 1) & ~(uint64_t) (cache_align - 1);
+    *offset = *offset < size ? *offset : size;
+    return section;
+}
+
+// take a section of nul terminated strings, copied if copy is set
+int cache_strings(char *data, uint64_t size, uint64_t *offset, char **strings, int n, int copy) {
+    size_t length = 0;
+    for (int i = 0; i < n; i++) {
+        char *end = memchr(data + *offset + length, 0, size - *offset - length);
+        if (!end) {
+            return -1;
+        }
+        char *str = data + *offset + length;
+        strings[i] = !copy ? str : *str ? strdup(str) : NULL;
+        length = end + 1 - (data + *offset);
+    }
+    cache_read(data, size, offset, length);
+    return 0;
+}
+
+// the array sections shared by the writer and the reader, in file order
+int cache_arrays(objctx *ctx, void ***arrays, size_t *sizes) {
+    int n = 0;
+    arrays[n] = (void **) &ctx->vertices;
+    sizes[n++] = 3 * sizeof(float) * (size_t) ctx->nvertices;
+    arrays[n] = (void **) &ctx->normals;
+    sizes[n++] = 3 * sizeof(float) * (size_t) ctx->nnormals;
+    arrays[n] = (void **) &ctx->texcoords;
+    sizes[n++] = 2 * sizeof(float) * (size_t) ctx->ntexcoords;
+    arrays[n] = (void **) &ctx->faces;
+    sizes[n++] = 3 * sizeof(int) * (size_t) ctx->nfaceverts;
+    arrays[n] = (void **) &ctx->meshoffsets;
+    sizes[n++] = sizeof(int) * (size_t) (ctx->nmeshes + 1);
+    arrays[n] = (void **) &ctx->mtlindices;
+    sizes[n++] = sizeof(int) * (size_t) ctx->nmeshes;
+    if (ctx->indexsize) {
+        arrays[n] = (void **) &ctx->vbuffer;
+        sizes[n++] = 8 * sizeof(float) * (size_t) ctx->nunique;
+        arrays[n] = &ctx->indices;
+        sizes[n++] = (size_t) ctx->indexsize * ctx->nfaceverts;
+    } else {
+        arrays[n] = (void **) &ctx->buffer;
+        sizes[n++] = 8 * sizeof(float) * (size_t) ctx->nfaceverts;
+    }
+    arrays[n] = (void **) &ctx->meshlets;
+    sizes[n++] = sizeof(objmeshlet) * (size_t) ctx->nmeshlets;
+    arrays[n] = (void **) &ctx->meshletvertices;
+    sizes[n++] = sizeof(uint32_t) * (size_t) ctx->nmeshletvertices;
+    arrays[n] = (void **) &ctx->meshlettriangles;
+    sizes[n++] = ctx->nmeshlettriangles;
+    return n;
+}
+
+// save the loaded arrays, written to a temporary file and renamed into place
+int cache_save(objctx *ctx, const char *path, uint32_t flags, cachesource *source) {
+    mtlctx *materials = &ctx->materials;
+    cacheheader header = {
+        .magic = cache_magic, .version = cache_version, .flags = flags,
+        .nmeshes = ctx->nmeshes, .nvertices = ctx->nvertices,
+        .nnormals = ctx->nnormals, .ntexcoords = ctx->ntexcoords,
+        .nfaces = ctx->nfaces, .nfaceverts = ctx->nfaceverts,
+        .nunique = ctx->nunique, .indexsize = ctx->indexsize,
+        .nmaterials = materials->nmaterials, .nlibraries = materials->nlibraries,
+        .nmeshlets = ctx->nmeshlets, .nmeshletvertices = ctx->nmeshletvertices,
+        .nmeshlettriangles = ctx->nmeshlettriangles,
+        .acmr = { ctx->acmr[0], ctx->acmr[1] }, .atvr = { ctx->atvr[0], ctx->atvr[1] },
+    };
+    cachestat *stats = calloc(materials->nlibraries + 1, sizeof(cachestat));
+    int failed = cache_stat(source->filename, &header.source);
+    for (int i = 0; i < materials->nlibraries; i++) {
+        failed |= cache_stat(materials->libraries[i], stats + i);
+    }
+    if (failed || cache_digest(source, materials->libraries, materials->nlibraries, header.digest)) {
+        free(stats);
+        return -1;
+    }
+    char *tmp = malloc(strlen(path) + 32);     // per process, loads can race to write it
+    sprintf(tmp, "%s.%d.tmp", path, (int) getpid());
+    FILE *file = fopen(tmp, "wb");
+    if (!file) {
+        free(stats);
+        free(tmp);
+        return -1;
+    }
+    uint64_t offset = 0;
+    cache_write(file, &header, sizeof(header), &offset);
+    size_t length = 0;
+    for (int i = 0; i < materials->nlibraries; i++) {
+        fwrite(materials->libraries[i], 1, strlen(materials->libraries[i]) + 1, file);
+        length += strlen(materials->libraries[i]) + 1;
+    }
+    offset += length;
+    cache_write(file, NULL, 0, &offset);
+    cache_write(file, stats, materials->nlibraries * sizeof(cachestat), &offset);
+    free(stats);
+    void **arrays[12];
+    size_t sizes[12];
+    int narrays = cache_arrays(ctx, arrays, sizes);
+    for (int i = 0; i < narrays; i++) {
+        cache_write(file, *arrays[i], sizes[i], &offset);
+    }
+    mtl *copy = calloc(materials->nmaterials + 1, sizeof(mtl));
+    for (int i = 0; i < materials->nmaterials; i++) {
+        copy[i] = materials->materials[i];
+        for (int j = 0; j < mtl_nstrings; j++) {
+            *mtl_string(copy + i, j) = NULL;        // pointers are stored as strings below
+        }
+    }
+    cache_write(file, copy, materials->nmaterials * sizeof(mtl), &offset);
+    free(copy);
+    length = 0;
+    for (int i = 0; i < materials->nmaterials; i++) {
+        for (int j = 0; j < mtl_nstrings; j++) {
+            char *str = *mtl_string(materials->materials + i, j);
+            str = str ? str : "";
+            fwrite(str, 1, strlen(str) + 1, file);
+            length += strlen(str) + 1;
+        }
+    }
+    offset += length;
+    cache_write(file, NULL, 0, &offset);
+    header.size = offset;
+    rewind(file);
+    fwrite(&header, sizeof(header), 1, file);
+    int status = ferror(file) | fclose(file) ? -1 : 0;
+    if (!status) {
+        status = rename(tmp, path);
+    }
+    if (status) {
+        remove(tmp);
+    }
+    free(tmp);
+    return status;
+}
+
+// use the cache file if it was written with the same options from sources
+// with the same hash, the arrays then point straight into the mapping
+int cache_load(objctx *ctx, const char *path, uint32_t flags, cachesource *source) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(cacheheader)) {
+        close(fd);
+        return -1;
+    }
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    uint64_t size = st.st_size;
+    cacheheader *header = (cacheheader *) data;
+    uint64_t offset = 0;
+    cache_read(data, size, &offset, sizeof(cacheheader));
+    char **libraries = NULL;
+    uint8_t digest[32];
+    if (memcmp(header->magic, cache_magic, 8) || header->version != cache_version
+        || header->flags != flags || header->size != size || header->nlibraries < 0
+        || header->nmaterials < 0) {
+        goto fail;
+    }
+    libraries = malloc((header->nlibraries + 1) * sizeof(char *));
+    if (cache_strings(data, size, &offset, libraries, header->nlibraries, 0)) {
+        goto fail;
+    }
+    cachestat *stats = cache_read(data, size, &offset, header->nlibraries * sizeof(cachestat));
+    cachestat current;
+    int changed = !stats || cache_stat(source->filename, &current)
+        || memcmp(&current, &header->source, sizeof(current));
+    for (int i = 0; i < header->nlibraries && !changed; i++) {
+        changed = cache_stat(libraries[i], &current) || memcmp(&current, stats + i, sizeof(current));
+    }
+    if (!stats || (changed && (cache_digest(source, libraries, header->nlibraries, digest)
+        || memcmp(digest, header->digest, sizeof(digest))))) {
+        goto fail;
+    }
+    objctx loaded = {
+        .nmeshes = header->nmeshes, .nvertices = header->nvertices,
+        .nnormals = header->nnormals, .ntexcoords = header->ntexcoords,
+        .nfaces = header->nfaces, .nfaceverts = header->nfaceverts,
+        .nunique = header->nunique, .indexsize = header->indexsize,
+        .nmeshlets = header->nmeshlets, .nmeshletvertices = header->nmeshletvertices,
+        .nmeshlettriangles = header->nmeshlettriangles,
+        .acmr = { header->acmr[0], header->acmr[1] },
+        .atvr = { header->atvr[0], header->atvr[1] },
+        .filename = ctx->filename, .cache = data, .cachesize = size,
+    };
+    void **arrays[12];
+    size_t sizes[12];
+    int narrays = cache_arrays(&loaded, arrays, sizes);
+    for (int i = 0; i < narrays; i++) {
+        if (!(*arrays[i] = cache_read(data, size, &offset, sizes[i]))) {
+            goto fail;
+        }
+    }
+    int nmaterials = header->nmaterials;
+    mtl *stored = cache_read(data, size, &offset, nmaterials * sizeof(mtl));
+    if (!stored) {
+        goto fail;
+    }
+    mtlctx *materials = &loaded.materials;
+    materials->materials = malloc((nmaterials + 1) * sizeof(mtl));
+    char **strings = malloc((nmaterials * mtl_nstrings + 1) * sizeof(char *));
+    if (cache_strings(data, size, &offset, strings, nmaterials * mtl_nstrings, 1)) {
+        free(strings);
+        free(materials->materials);
+        goto fail;
+    }
+    for (int i = 0; i < nmaterials; i++) {
+        materials->materials[i] = stored[i];
+        for (int j = 0; j < mtl_nstrings; j++) {
+            *mtl_string(materials->materials + i, j) = strings[i * mtl_nstrings + j];
+        }
+    }
+    free(strings);
+    materials->nmaterials = materials->capmaterials = nmaterials;
+    materials->nlibraries = header->nlibraries;
+    materials->libraries = libraries;
+    for (int i = 0; i < materials->nlibraries; i++) {
+        libraries[i] = strdup(libraries[i]);
+    }
+    if (materials->nlibraries) {
+        materials->filename = strdup(libraries[materials->nlibraries - 1]);
+    }
+    *ctx = loaded;
+    return 0;
+fail:
+    free(libraries);
+    munmap(data, size);
+    return -1;
+}
+
+double obj_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the passes after parsing, their results are what the cache holds
+void obj_build(objctx *ctx, objopts *opts) {
+    if (opts->normals) {
+        obj_normals(ctx, opts->crease, opts->nthreads);
+    }
+    if (opts->sort) {
+        obj_batch(ctx);
+    }
+    if (opts->indexed || opts->optimize) {
+        build_indexed(ctx);
+        if (opts->optimize) {
+            obj_optimize(ctx);
+        }
+    } else {
+        build_buffer(ctx);
+    }
+    if (opts->meshlets) {
+        obj_meshlets(ctx, opts->nthreads);
+    }
+}
+
+// the passes run on every load, cached or not
+void obj_finish(objctx *ctx, objopts *opts) {
+    if (opts->quantize) {
+        obj_quantize(ctx, opts->quantize);
+    }
+    if (opts->lod && ctx->indexsize) {
+        obj_lod(ctx, opts->nthreads);
+    }
+    if (opts->soa) {                        // the interleaved buffer is replaced
+        float **aos = ctx->indexsize ? &ctx->vbuffer : &ctx->buffer;
+        build_soa(&ctx->soa, *aos, ctx->indexsize ? ctx->nunique : ctx->nfaceverts);
+        if (!ctx->cache) {
+            free(*aos);
+        }
+        *aos = NULL;
+    }
+}
+
+// load an obj file into ctx: parse it and build the expanded or indexed vertex buffer,
+// or take all of it from filename.cache if that was made from the same sources
+int obj_load(objctx *ctx, const char *filename, objopts *opts) {
+    filemap map;
+    if (file_map(&map, filename)) {         // map the whole file into memory
+        fprintf(stderr, "failed to open file %s\n", filename);
+        return -1;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->filename = (char *) filename;
+    int cache = opts->cache && strcmp(filename, "-");
+    char *path = NULL;
+    cachesource source = { .filename = filename, .data = map.data, .size = map.size };
+    if (cache) {
+        path = malloc(strlen(filename) + 7);
+        sprintf(path, "%s.cache", filename);
+    }
+    if (cache && !cache_load(ctx, path, cache_flags(opts), &source)) {
+        mtl_textures(&ctx->materials, 0);
+        if (opts->sort) {
+            obj_draws(ctx);
+        }
+    } else {
+        if (obj_parse(ctx, map.data, map.size, opts->nthreads)) {
+            objctx_free(ctx);
+            free(path);
+            file_unmap(&map);
+            return -1;
+        }
+        obj_build(ctx, opts);
+        if (cache && cache_save(ctx, path, cache_flags(opts), &source)) {
+            fprintf(stderr, "failed to write cache %s\n", path);
+        }
+    }
+    free(path);
+    file_unmap(&map);                       // release the file
+    obj_finish(ctx, opts);
+    return 0;
+}
+
+// an o block of the watched obj file, the faces before the first o are block
+// 0. the counts are those before the block, all a parse starting there needs
+typedef struct {
+    size_t  start;
+    uint8_t digest[32];
+    int     nvertices;
+    int     nnormals;
+    int     ntexcoords;
+    int     nfaces;
+    int     nsmooth;
+    int     nswitches;
+    int     nlibraries;     // every mtllib line lists one library, readable or not
+} watchblock;
+
+typedef struct {
+    const char *data;
+    size_t     size;
+    int        nblocks;
+    int        capblocks;
+    watchblock *blocks;
+    watchblock counts;  // running counts of the lines so far
+} blockscan;
+
+void scan_blockline(void *arg, const char *p, const char *eol) {
+    blockscan *scan = arg;
+    watchblock *counts = &scan->counts;
+    const char *line = p;
+    switch (objline_key(&p, eol)) {
+    case O:
+        // the last line may be a copy, its offset then follows from the end
+        counts->start = (uintptr_t) line - (uintptr_t) scan->data < scan->size
+            ? (size_t) (line - scan->data) : scan->size - (eol - line);
+        scan->blocks = reserve(scan->blocks, &scan->capblocks, scan->nblocks + 1, sizeof(watchblock));
+        scan->blocks[scan->nblocks++] = *counts;
+        break;
+    case F:
+        counts->nfaces++;
+        break;
+    case MTLLIB:
+        counts->nlibraries++;
+        break;
+    case S:
+        counts->nsmooth++;
+        break;
+    case USEMTL:
+        counts->nswitches++;
+        break;
+    case V:
+        counts->nvertices++;
+        break;
+    case VN:
+        counts->nnormals++;
+        break;
+    case VT:
+        counts->ntexcoords++;
+        break;
+    default:
+        break;
+    }
+}
+
+void hash_blocks(void *arg, int begin, int end) {
+    blockscan *scan = arg;
+    for (int i = begin; i < end; i++) {
+        size_t start = scan->blocks[i].start;
+        size_t stop = i + 1 < scan->nblocks ? scan->blocks[i + 1].start : scan->size;
+        sha256_ctx sha;
+        sha256_init(&sha);
+        sha256_update(&sha, scan->data + start, stop - start);
+        sha256_final(&sha, scan->blocks[i].digest);
+    }
+}
+
+// split obj data into o blocks and hash each of them
+watchblock *watch_blocks(const char *data, size_t size, int nthreads, int *nblocks) {
+    blockscan scan = { .data = data, .size = size, .nblocks = 1 };
+    scan.blocks = reserve(NULL, &scan.capblocks, 1, sizeof(watchblock));
+    scan.blocks[0] = (watchblock){0};
+    parse_lines(data, data + size, scan_blockline, &scan);
+    run_ranges(scan.nblocks, nthreads, hash_blocks, &scan);
+    *nblocks = scan.nblocks;
+    return scan.blocks;
+}
+
+int watch_hash(const char *path, uint8_t *digest) {
+    filemap map;
+    if (file_map(&map, path)) {
+        return -1;
+    }
+    sha256_ctx sha;
+    sha256_init(&sha);
+    sha256_update(&sha, map.data, map.size);
+    sha256_final(&sha, digest);
+    file_unmap(&map);
+    return 0;
+}
+
+void *memdup(const void *p, size_t size) {
+    void *q = malloc(size + 1);
+    memcpy(q, p, size);
+    return q;
+}
+
+// copy the parsed arrays of src, the passes that follow change them in place
+void objctx_copy(objctx *dst, const objctx *src) {
+    *dst = (objctx){
+        .nmeshes = src->nmeshes, .nvertices = src->nvertices, .nnormals = src->nnormals,
+        .ntexcoords = src->ntexcoords, .nfaces = src->nfaces, .nfaceverts = src->nfaceverts,
+        .capmeshes = src->nmeshes + 1, .nsmooth = src->nsmooth, .nswitches = src->nswitches,
+        .filename = src->filename
+    };
+    dst->vertices = memdup(src->vertices, 3 * src->nvertices * sizeof(float));
+    dst->normals = memdup(src->normals, 3 * src->nnormals * sizeof(float));
+    dst->texcoords = memdup(src->texcoords, 2 * src->ntexcoords * sizeof(float));
+    dst->faces = memdup(src->faces, 3 * src->nfaceverts * sizeof(int));
+    dst->meshoffsets = memdup(src->meshoffsets, (src->nmeshes + 1) * sizeof(int));
+    dst->mtlindices = memdup(src->mtlindices, (src->nmeshes + 1) * sizeof(int));
+    dst->smooth = memdup(src->smooth, 2 * src->nsmooth * sizeof(int));
+    dst->switches = memdup(src->switches, 2 * src->nswitches * sizeof(int));
+    mtlctx *materials = &dst->materials;
+    mtl_append(materials, &src->materials);
+    materials->filename = src->materials.filename ? strdup(src->materials.filename) : NULL;
+    materials->nlibraries = src->materials.nlibraries;
+    materials->libraries = malloc(materials->nlibraries * sizeof(char *) + 1);
+    for (int i = 0; i < materials->nlibraries; i++) {
+        materials->libraries[i] = strdup(src->materials.libraries[i]);
+    }
+    mtl_textures(materials, 0);
+}
+
+// a published state of the watched obj, freed when the last reader lets go
+typedef struct {
+    objctx ctx;
+    int    refs;
+    int    generation;
+} objversion;
+
+// a source of the watched obj and the digest of what was last loaded from it
+typedef struct {
+    char    *path;
+    const char *name;   // within path, what inotify reports
+    int     wd;         // watch of the directory
+    int     changed;
+    uint8_t digest[32];
+} watchfile;
+
+typedef struct {
+    pthread_mutex_t lock;
+    objversion *current;
+    int        generation;
+    objopts    opts;
+    objctx     raw;         // parsed but not built, a re-parse keeps a prefix of it
+    int        nblocks;
+    watchblock *blocks;
+    int        nfiles;      // the obj file, then its mtl files
+    watchfile  *files;
+    int        fd;          // inotify
+    int        reparsed;    // first block the last reload parsed, nblocks if none
+    double     seconds;     // the last reload, from hashing to publishing
+} objwatch;
+
+// the current version, it stays valid until released
+objversion *watch_acquire(objwatch *watch) {
+    pthread_mutex_lock(&watch->lock);
+    objversion *version = watch->current;
+    version->refs++;
+    pthread_mutex_unlock(&watch->lock);
+    return version;
+}
+
+void watch_release(objwatch *watch, objversion *version) {
+    pthread_mutex_lock(&watch->lock);
+    int refs = --version->refs;
+    pthread_mutex_unlock(&watch->lock);
+    if (!refs) {
+        objctx_free(&version->ctx);
+        free(version);
+    }
+}
+
+// watch the directory of a file, editors often save by renaming over it
+void watch_add(objwatch *watch, watchfile *file) {
+    const char *slash = strrchr(file->path, '/');
+    file->name = slash ? slash + 1 : file->path;
+    char *directory = slash ? strndup(file->path, slash - file->path + 1) : strdup(".");
+    file->wd = inotify_add_watch(watch->fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+    free(directory);
+}
+
+// the mtl files to watch are those the obj file now refers to
+void watch_libraries(objwatch *watch) {
+    mtlctx *materials = &watch->raw.materials;
+    watchfile *files = calloc(materials->nlibraries + 1, sizeof(watchfile));
+    files[0] = watch->files[0];
+    int nfiles = 1;
+    for (int i = 0; i < materials->nlibraries; i++) {
+        const char *path = materials->libraries[i];
+        int known = 0;
+        for (int j = 1; j < nfiles && !known; j++) {
+            known = !strcmp(files[j].path, path);
+        }
+        for (int j = 1; j < watch->nfiles && !known; j++) {
+            if (watch->files[j].path && !strcmp(watch->files[j].path, path)) {
+                files[nfiles++] = watch->files[j];
+                watch->files[j].path = NULL;
+                known = 1;
+            }
+        }
+        if (!known) {
+            files[nfiles] = (watchfile){ .path = strdup(path) };
+            watch_hash(path, files[nfiles].digest);
+            watch_add(watch, files + nfiles++);
+        }
+    }
+    for (int j = 1; j < watch->nfiles; j++) {
+        free(watch->files[j].path);
+    }
+    free(watch->files);
+    watch->files = files;
+    watch->nfiles = nfiles;
+}
+
+// reload the materials of the first nlibraries mtl files the parse recorded
+// and point the kept mesh and usemtl materials at the new ones by name
+void watch_materials(objwatch *watch, int nlibraries) {
+    objctx *raw = &watch->raw;
+    mtlctx old = raw->materials;
+    raw->materials = (mtlctx){0};
+    if (nlibraries > old.nlibraries) {
+        nlibraries = old.nlibraries;
+    }
+    for (int i = 0; i < nlibraries; i++) {
+        raw->materials.filename = strdup(old.libraries[i]);
+        if (mtl_library(&raw->materials)) {
+            fprintf(stderr, "failed to open %s\n", old.libraries[i]);
+        }
+        if (i < nlibraries - 1) {
+            free(raw->materials.filename);
+        }
+    }
+    int *remap = malloc((old.nmaterials + 1) * sizeof(int));   // old index + 1 to the new one
+    remap[0] = -1;
+    for (int i = 0; i < old.nmaterials; i++) {
+        remap[i + 1] = find_material(&raw->materials, mtl_name(&old, i));
+    }
+    for (int i = 0; i < raw->nmeshes; i++) {
+        raw->mtlindices[i] = remap[raw->mtlindices[i] + 1];
+    }
+    for (int i = 0; i < raw->nswitches; i++) {
+        raw->switches[2 * i + 1] = remap[raw->switches[2 * i + 1] + 1];
+    }
+    free(remap);
+    mtlctx_free(&old);
+}
+
+// parse again from the first o block that changed, keeping everything before
+// it, and publish the result. 1 after a swap, 0 if no source really changed,
+// -1 if the obj file can't be read
+int watch_reload(objwatch *watch) {
+    double start = obj_time();
+    objctx *raw = &watch->raw;
+    int mtlchanged = 0;
+    for (int i = 1; i < watch->nfiles; i++) {
+        watchfile *file = watch->files + i;
+        uint8_t digest[32];
+        if (file->changed && !watch_hash(file->path, digest) && memcmp(digest, file->digest, 32)) {
+            memcpy(file->digest, digest, 32);
+            mtlchanged = 1;
+        }
+        file->changed = 0;
+    }
+    // usemtl of a material that was missing has no name left to look up, the
+    // whole obj file is parsed again
+    int missing = 0;
+    for (int i = 0; mtlchanged && i < raw->nswitches; i++) {
+        missing |= raw->switches[2 * i + 1] < 0;
+    }
+    filemap map = {0};
+    int nblocks = watch->nblocks;
+    watchblock *blocks = NULL;
+    int first = watch->nblocks;
+    if (watch->files[0].changed || missing) {
+        if (file_map(&map, watch->files[0].path)) {
+            return -1;
+        }
+        watch->files[0].changed = 0;
+        blocks = watch_blocks(map.data, map.size, watch->opts.nthreads, &nblocks);
+        for (first = 0; first < nblocks && first < watch->nblocks && !missing
+            && !memcmp(blocks[first].digest, watch->blocks[first].digest, 32); first++) {
+        }
+    }
+    if (first == nblocks && nblocks == watch->nblocks && !mtlchanged) {
+        free(blocks);
+        file_unmap(&map);
+        return 0;
+    }
+    if (first < watch->nblocks) {               // truncate to the blocks before first
+        watchblock *keep = watch->blocks + first;
+        raw->nvertices = keep->nvertices;
+        raw->nnormals = keep->nnormals;
+        raw->ntexcoords = keep->ntexcoords;
+        raw->nfaces = keep->nfaces;
+        raw->nsmooth = keep->nsmooth;
+        raw->nswitches = keep->nswitches;
+        raw->nfaceverts = first ? raw->meshoffsets[first - 1] : 0;
+        raw->nmeshes = first ? first - 1 : 0;
+        watch_materials(watch, keep->nlibraries);
+    } else {
+        watch_materials(watch, raw->materials.nlibraries);
+    }
+    if (blocks) {
+        if (first < nblocks) {
+            size_t offset = blocks[first].start;
+            // an unreadable mtl file is reported and its materials stay missing
+            obj_parse(raw, map.data + offset, map.size - offset, watch->opts.nthreads);
+        }
+        free(watch->blocks);
+        watch->blocks = blocks;
+        watch->nblocks = nblocks;
+        file_unmap(&map);
+    }
+    raw->meshoffsets = reserve(raw->meshoffsets, &raw->capmeshes, raw->nmeshes + 1, sizeof(int));
+    raw->meshoffsets[raw->nmeshes] = raw->nfaceverts;
+    watch_libraries(watch);
+    objversion *version = calloc(1, sizeof(objversion));
+    objctx_copy(&version->ctx, raw);
+    obj_build(&version->ctx, &watch->opts);
+    obj_finish(&version->ctx, &watch->opts);
+    version->refs = 1;                          // held by the watch until replaced
+    pthread_mutex_lock(&watch->lock);
+    objversion *old = watch->current;
+    version->generation = ++watch->generation;
+    watch->current = version;
+    pthread_mutex_unlock(&watch->lock);
+    if (old) {
+        watch_release(watch, old);
+    }
+    watch->reparsed = first;
+    watch->seconds = obj_time() - start;
+    return 1;
+}
+
+// load filename and start watching it and its mtl files
+int watch_open(objwatch *watch, const char *filename, objopts *opts) {
+    *watch = (objwatch){ .opts = *opts };
+    pthread_mutex_init(&watch->lock, NULL);
+    watch->raw.filename = (char *) filename;
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) {
+        return -1;
+    }
+    watch->files = calloc(1, sizeof(watchfile));
+    watch->files[0] = (watchfile){ .path = strdup(filename), .changed = 1 };
+    watch->nfiles = 1;
+    watch_add(watch, watch->files);
+    return watch_reload(watch) < 0 ? -1 : 0;
+}
+
+// wait up to timeout milliseconds, -1 for ever, for a source to be written
+// and reload. returns what watch_reload does, 0 if nothing was written
+int watch_poll(objwatch *watch, int timeout) {
+    struct pollfd pfd = { .fd = watch->fd, .events = POLLIN };
+    if (poll(&pfd, 1, timeout) <= 0) {
+        return 0;
+    }
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int written = 0;
+    ssize_t n;
+    while ((n = read(watch->fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + n; ) {
+            struct inotify_event *event = (struct inotify_event *) p;
+            for (int i = 0; i < watch->nfiles && event->len; i++) {
+                watchfile *file = watch->files + i;
+                if (file->wd == event->wd && !strcmp(file->name, event->name)) {
+                    file->changed = written = 1;
+                }
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return written ? watch_reload(watch) : 0;
+}
+
+void watch_close(objwatch *watch) {
+    if (watch->current) {
+        watch_release(watch, watch->current);
+    }
+    close(watch->fd);
+    objctx_free(&watch->raw);
+    free(watch->blocks);
+    for (int i = 0; i < watch->nfiles; i++) {
+        free(watch->files[i].path);
+    }
+    free(watch->files);
+    pthread_mutex_destroy(&watch->lock);
+}
+
+// print a line for the initial load and every reload until killed
+void watch_obj(const char *filename, objopts *opts) {
+    objwatch watch;
+    if (watch_open(&watch, filename, opts)) {
+        fprintf(stderr, "failed to watch %s\n", filename);
+        exit(1);
+    }
+    for (;;) {
+        objversion *version = watch_acquire(&watch);
+        objctx *ctx = &version->ctx;
+        printf("generation %d: %d meshes, %d triangles, %d materials, ", version->generation,
+            ctx->nmeshes, ctx->nfaceverts / 3, ctx->materials.nmaterials);
+        if (watch.reparsed < watch.nblocks) {
+            printf("parsed from block %d of %d", watch.reparsed, watch.nblocks);
+        } else {
+            printf("materials only");
+        }
+        printf(" in %.2f ms\n", watch.seconds * 1e3);
+        fflush(stdout);
+        watch_release(&watch, version);
+        while (watch_poll(&watch, -1) <= 0) {
+        }
+    }
+}
+
+#define stream_block (1 << 20)
+
+// triangles handed to the stream callback, expanded like build_buffer
+typedef struct {
+    const char   *name;     // object name, NULL before the first o
+    int          object;    // index of the o, -1 before the first
+    int          material;  // index into materials, -1 if none
+    int          first;     // first triangle of the batch within its object
+    int          ntris;
+    int          last;      // no more batches follow for this object
+    const float  *buffer;   // 3 * ntris vertices of 8 floats
+    const mtlctx *materials;
+} objbatch;
+
+typedef void (*objcallback)(void *arg, objbatch *batch);
+
+// a growable v, vt or vn pool, in memory or in an unlinked temporary file
+typedef struct {
+    float *data;
+    int   count;        // elements of width floats
+    int   capacity;
+    int   width;
+    int   fd;           // -1 when the pool lives in memory
+} objpool;
+
+typedef struct {
+    objctx      ctx;        // the file name for mtllib paths and the materials
+    objpool     pools[3];   // in face vertex order: v, vt, vn
+    int         batchtris;  // flush after this many triangles, 0 for whole objects
+    int         ntris;
+    int         captris;
+    float       *batch;
+    int         *face;      // face vertices of the current line
+    int         capface;
+    objscratch  scratch;
+    int         object;
+    int         first;
+    int         material;
+    char        *name;
+    int         nbatches;
+    int         total;
+    objcallback callback;
+    void        *arg;
+} objstream;
+
+int pool_open(objpool *pool, int width, int spill) {
+    *pool = (objpool){ .width = width, .fd = -1 };
+    if (!spill) {
+        return 0;
+    }
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char *path = malloc(strlen(dir) + 16);
+    sprintf(path, "%s/objpoolXXXXXX", dir);
+    pool->fd = mkstemp(path);
+    if (pool->fd >= 0) {
+        unlink(path);                       // gone as soon as the pool is closed
+    }
+    free(path);
+    return pool->fd < 0 ? -1 : 0;
+}
+
+// append an element, spilled pools grow the file and map it again
+float *pool_add(objpool *pool) {
+    if (pool->count == pool->capacity) {
+        int cap = pool->capacity ? 2 * pool->capacity : 4096;
+        size_t size = (size_t) cap * pool->width * sizeof(float);
+        if (pool->fd >= 0) {
+            float *data = MAP_FAILED;
+            if (!ftruncate(pool->fd, size)) {
+                data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pool->fd, 0);
+            }
+            if (data == MAP_FAILED) {
+                perror("spill pool");
+                exit(1);
+            }
+            if (pool->data) {
+                munmap(pool->data, (size_t) pool->capacity * pool->width * sizeof(float));
+            }
+            pool->data = data;
+        } else {
+            pool->data = realloc(pool->data, size);
+        }
+        pool->capacity = cap;
+    }
+    return pool->data + (size_t) pool->width * pool->count++;
+}
+
+void pool_close(objpool *pool) {
+    if (pool->fd < 0) {
+        free(pool->data);
+        return;
+    }
+    if (pool->data) {
+        munmap(pool->data, (size_t) pool->capacity * pool->width * sizeof(float));
+    }
+    close(pool->fd);
+}
+
+// hand the pending triangles to the callback, last ends the object
+void stream_flush(objstream *stream, int last) {
+    if (!stream->ntris && !(last && stream->first)) {
+        return;
+    }
+    objbatch batch = {
+        .name = stream->name, .object = stream->object, .material = stream->material,
+        .first = stream->first, .ntris = stream->ntris, .last = last,
+        .buffer = stream->batch, .materials = &stream->ctx.materials,
+    };
+    stream->callback(stream->arg, &batch);
+    stream->nbatches++;
+    stream->total += stream->ntris;
+    stream->first = last ? 0 : stream->first + stream->ntris;
+    stream->ntris = 0;
+}
+
+// expand one face vertex, indices that aren't in the pools yet read as zero
+void stream_vertex(objstream *stream, const int *fptr, float *bptr) {
+    int offs[] = {0, 3, 5};
+    memset(bptr, 0, 8 * sizeof(float));
+    for (int k = 0; k < 3; k++) {
+        objpool *pool = stream->pools + k;
+        if (fptr[k] > 0 && fptr[k] <= pool->count) {
+            float *src = pool->data + (size_t) pool->width * (fptr[k] - 1);
+            memcpy(bptr + offs[k], src, pool->width * sizeof(float));
+        }
+    }
+}
+
+void stream_line(void *arg, const char *p, const char *eol) {
+    objstream *stream = arg;
+    char s[512];
+    int key = objline_key(&p, eol);
+    switch (key) {
+    case F:
+        int nvert = 0;
+        for (p = skip_space(p); *p != '\n' && *p != '\r'; p = skip_space(p)) {
+            stream->face = reserve(stream->face, &stream->capface, nvert + 1, 3 * sizeof(int));
+            p = parse_face(p, stream->face + 3 * nvert++);
+        }
+        objscratch *scratch = &stream->scratch;
+        int clipped = 0;
+        if (nvert > 3) {
+            scratch_reserve(scratch, nvert);
+            for (int c = 0; c < nvert; c++) {
+                float vertex[8];
+                stream_vertex(stream, stream->face + 3 * c, vertex);
+                memcpy(scratch->pos + 3 * c, vertex, 3 * sizeof(float));
+            }
+            clipped = triangulate(scratch, nvert);
         }
-        printf("] ");
+        for (int i = 0; i < nvert - 2; i++) {
+            if (stream->batchtris && stream->ntris == stream->batchtris) {
+                stream_flush(stream, 0);
+            }
+            stream->batch = reserve(
+                stream->batch, &stream->captris, stream->ntris + 1, 24 * sizeof(float)
+            );
+            float *bptr = stream->batch + 24 * stream->ntris++;
+            for (int k = 0; k < 3; k++) {
+                int corner = clipped ? scratch->tris[3 * i + k] : k ? i + k : 0;
+                stream_vertex(stream, stream->face + 3 * corner, bptr + 8 * k);
+            }
+        }
+        break;
+    case MTLLIB:
+        parse_word(p, eol, s, sizeof(s), 1);
+        if (parse_materials(&stream->ctx, s)) {
+            exit(1);
+        }
+        break;
+    case O:
+        stream_flush(stream, 1);
+        parse_word(p, eol, s, sizeof(s), 1);
+        free(stream->name);
+        stream->name = strdup(s);
+        stream->object++;
+        stream->material = -1;
+        break;
+    case USEMTL:
+        parse_word(p, eol, s, sizeof(s), 0);
+        int material = find_material(&stream->ctx.materials, s);
+        if (material != stream->material) {
+            stream_flush(stream, 0);        // a batch has a single material
+            stream->material = material;
+        }
+        break;
+    case V:
+        parse_floats(p, pool_add(stream->pools), 3);
+        break;
+    case VT:
+        parse_floats(p, pool_add(stream->pools + 1), 2);
+        break;
+    case VN:
+        parse_floats(p, pool_add(stream->pools + 2), 3);
+        break;
+    default:
+        break;
     }
-    putchar('\n');
-    printf("normals:\n");
-    printf("%4d ", 0);
-    for (int i = 0; i < ctx->nnormals; i++) {
-        if (i > 0 && (i % 3) == 0) {
-            printf("\n%4d ", i);
+}
+
+// read an obj file block by block and pass each object, or batches of at most
+// batchtris triangles, to callback as soon as they are complete. only the
+// v, vt and vn pools grow with the file, spill keeps them in temporary files
+int obj_stream(const char *filename, int batchtris, int spill, objcallback callback, void *arg) {
+    int fd = strcmp(filename, "-") ? open(filename, O_RDONLY) : STDIN_FILENO;
+    if (fd < 0) {
+        return -1;
+    }
+    objstream stream = {
+        .batchtris = batchtris, .object = -1, .material = -1,
+        .callback = callback, .arg = arg,
+    };
+    stream.ctx.filename = (char *) filename;
+    int widths[] = {3, 2, 3};
+    for (int k = 0; k < 3; k++) {
+        if (pool_open(stream.pools + k, widths[k], spill)) {
+            perror("spill pool");
+            exit(1);
         }
-        printf("[ ");
-        for (int j = 0; j < 3; j++) {
-            printf("%8.4f ", ctx->normals[i * 3 + j]);
+    }
+    size_t capacity = stream_block;
+    size_t used = 0;
+    char *data = malloc(capacity);
+    ssize_t n;
+    while ((n = read(fd, data + used, capacity - used)) > 0) {
+        used += n;
+        size_t complete = used;             // parse up to the last whole line
+        while (complete && data[complete - 1] != '\n') {
+            complete--;
         }
-        printf("] ");
+        if (!complete) {                    // a line longer than the block
+            if (used == capacity) {
+                capacity *= 2;
+                data = realloc(data, capacity);
+            }
+            continue;
+        }
+        parse_lines(data, data + complete, stream_line, &stream);
+        memmove(data, data + complete, used - complete);
+        used -= complete;
     }
-    putchar('\n');
-    printf("texcoords:\n");
-    printf("%4d ", 0);
-    for (int i = 0; i < ctx->ntexcoords; i++) {
-        if (i > 0 && (i % 3) == 0) {
-            printf("\n%4d ", i);
+    parse_lines(data, data + used, stream_line, &stream);
+    stream_flush(&stream, 1);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    free(data);
+    free(stream.batch);
+    free(stream.face);
+    free(stream.name);
+    scratch_free(&stream.scratch);
+    for (int k = 0; k < 3; k++) {
+        pool_close(stream.pools + k);
+    }
+    mtlctx_free(&stream.ctx.materials);
+    return n < 0 ? -1 : 0;
+}
+
+typedef struct {
+    int    nbatches;
+    int    ntris;
+    size_t largest;
+} streamstats;
+
+// print one line per batch with its bounding box
+void stream_print(void *arg, objbatch *batch) {
+    streamstats *stats = arg;
+    float lo[3] = {0}, hi[3] = {0};
+    for (int i = 0; i < 3 * batch->ntris; i++) {
+        for (int k = 0; k < 3; k++) {
+            float x = batch->buffer[8 * i + k];
+            lo[k] = !i || x < lo[k] ? x : lo[k];
+            hi[k] = !i || x > hi[k] ? x : hi[k];
         }
-        printf("[ ");
-        for (int j = 0; j < 2; j++) {
-            printf("%8.4f ", ctx->texcoords[i * 2 + j]);
+    }
+    const char *material = batch->material >= 0
+        ? batch->materials->materials[batch->material].name : "-";
+    printf("%4d %-12s %8d %8d %-12s [ %8.4f %8.4f %8.4f ] [ %8.4f %8.4f %8.4f ]%s\n",
+        batch->object, batch->name ? batch->name : "-", batch->first, batch->ntris,
+        material, lo[0], lo[1], lo[2], hi[0], hi[1], hi[2], batch->last ? " last" : "");
+    stats->nbatches++;
+    stats->ntris += batch->ntris;
+    size_t size = 3 * 8 * sizeof(float) * (size_t) batch->ntris;
+    stats->largest = size > stats->largest ? size : stats->largest;
+}
+
+void stream_obj(const char *filename, int batchtris, int spill) {
+    streamstats stats = {0};
+    printf("obj  name            first   ntris material     bounds\n");
+    if (obj_stream(filename, batchtris, spill, stream_print, &stats)) {
+        fprintf(stderr, "failed to read %s\n", filename);
+        exit(1);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%d batches, %d triangles, largest batch %zu bytes, max rss %ld kB\n",
+        stats.nbatches, stats.ntris, stats.largest, usage.ru_maxrss);
+}
+
+// time the parsing of a file with 1 to 16 threads
+void obj_scale(const char *filename) {
+    filemap map;
+    if (file_map(&map, filename)) {
+        fprintf(stderr, "failed to open file %s\n", filename);
+        exit(1);
+    }
+    printf("threads      time    MB/s  speedup\n");
+    double base = 0;
+    for (int nthreads = 1; nthreads <= 16; nthreads *= 2) {
+        double best = 0;
+        for (int run = 0; run < 3; run++) {
+            objctx ctx = { .filename = (char *) filename };
+            double start = obj_time();
+            if (obj_parse(&ctx, map.data, map.size, nthreads)) {
+                exit(1);
+            }
+            double elapsed = obj_time() - start;
+            if (!run || elapsed < best) {
+                best = elapsed;
+            }
+            objctx_free(&ctx);
         }
-        printf("] ");
+        if (nthreads == 1) {
+            base = best;
+        }
+        printf("%7d %8.1f ms %7.1f %8.2f\n", nthreads, best * 1e3,
+            map.size / best / (1 << 20), base / best);
     }
-    putchar('\n');
-    printf("mesh offsets:\n");
-    for (int i = 0; i < ctx->nmeshes + 1; i++) {
-        if (i > 0 && (i % 16) == 0) {
-            putchar('\n');
+    file_unmap(&map);
+}
+
+// time a batch transform of every vertex in both layouts
+void obj_transform(const char *filename, objopts *opts) {
+    objctx ctx;
+    opts->soa = 0;
+    if (obj_load(&ctx, filename, opts)) {
+        exit(1);
+    }
+    float *aos = ctx.indexsize ? ctx.vbuffer : ctx.buffer;
+    int n = ctx.indexsize ? ctx.nunique : ctx.nfaceverts;
+    objsoa soa, soaout;
+    build_soa(&soa, aos, n);
+    build_soa(&soaout, aos, n);
+    float *aosout = aligned_alloc(64, 8 * sizeof(float) * (((size_t) n + 15) & ~(size_t) 15) + 64);
+    const float m[12] = {
+        0.36f, 0.48f, -0.8f, 1,
+        -0.8f, 0.6f, 0, 2,
+        0.48f, 0.64f, 0.6f, 3,
+    };
+    printf("layout      time    Mverts/s\n");
+    const char *names[] = { "aos", "soa" };
+    for (int layout = 0; layout < 2; layout++) {
+        double best = 0;
+        for (int run = 0; run < 10; run++) {
+            double start = obj_time();
+            if (layout) {
+                transform_soa(&soa, &soaout, m);
+            } else {
+                transform_aos(aos, aosout, n, m);
+            }
+            double elapsed = obj_time() - start;
+            if (!run || elapsed < best) {
+                best = elapsed;
+            }
         }
-        printf("%4d ", ctx->meshoffsets[i]);
+        printf("%-6s %8.2f ms %10.1f\n", names[layout], best * 1e3, n / best * 1e-6);
     }
-    putchar('\n');
-    printf("faces:\n");
-    printf("%4d ", 0);
-    for (int i = 0; i < ctx->nfaceverts; i++) {
-        if (i > 0 && (i % 3) == 0) {
-            printf("\n%4d ", i);
+    for (int i = 0; i < n; i++) {           // both layouts have to agree
+        for (int k = 0; k < 8; k++) {
+            if (aosout[8 * i + k] != soaout.data[k * soaout.stride + i]) {
+                fprintf(stderr, "layouts differ at vertex %d\n", i);
+                exit(1);
+            }
         }
-        printf("[ ");
-        for (int j = 0; j < 3; j++) {
-            printf("%4d ", ctx->faces[i * 3 + j]);
+    }
+    free(aosout);
+    free(soa.data);
+    free(soaout.data);
+    objctx_free(&ctx);
+}
+
+// deterministic random floats in [0, 1) for the query benchmarks
+float bvh_random(uint32_t *state) {
+    *state = *state * 1664525 + 1013904223;
+    return (*state >> 8) * (1.0f / (1 << 24));
+}
+
+// a point in the box scaled by s around its center
+void bvh_point(const objnode *root, float s, uint32_t *state, float *p) {
+    for (int k = 0; k < 3; k++) {
+        float c = (root->min[k] + root->max[k]) / 2, e = (root->max[k] - root->min[k]) / 2;
+        p[k] = c + s * e * (2 * bvh_random(state) - 1);
+    }
+}
+
+// time the bvh build for 1 to 16 threads, then nqueries ray, box and closest
+// point queries against brute force over every triangle, checking they agree
+void obj_bvh(const char *filename, objopts *opts, int nqueries) {
+    objctx ctx;
+    opts->soa = 0;
+    if (obj_load(&ctx, filename, opts)) {
+        exit(1);
+    }
+    objbvh bvh;
+    printf("threads      time  speedup    nodes\n");
+    double base = 0;
+    int nnodes = 0;
+    for (int nthreads = 1; nthreads <= 16; nthreads *= 2) {
+        double best = 0;
+        for (int run = 0; run < 3; run++) {
+            double start = obj_time();
+            bvh_build(&bvh, &ctx, nthreads);
+            double elapsed = obj_time() - start;
+            if (!run || elapsed < best) {
+                best = elapsed;
+            }
+            nnodes = bvh.nnodes;
+            bvh_free(&bvh);
         }
-        printf("] ");
+        if (nthreads == 1) {
+            base = best;
+        }
+        printf("%7d %8.1f ms %8.2f %8d\n", nthreads, best * 1e3, base / best, nnodes);
     }
-    putchar('\n');
-    printf("buffer:\n");
-    for (int i = 0; i < ctx->nfaceverts; i++) {
-        printf("%4d ", i);
-        int nd[] = {3, 2, 3};
-        int offs[] = {0, 3, 5};
-        for (int j = 0; j < 3; j++) {
-            printf("[ ");
-            for (int k = 0; k < nd[j]; k++) {
-                printf("%8.4f ", ctx->buffer[8 * i + offs[j] + k]);
+    bvh_build(&bvh, &ctx, opts->nthreads);
+    if (!bvh.nnodes) {
+        bvh_free(&bvh);
+        objctx_free(&ctx);
+        return;
+    }
+    // the brute force versions run on the first few queries only
+    objbvh flat = bvh;
+    objnode root = bvh.nodes[0];
+    flat.nnodes = 1;
+    flat.nodes = &root;
+    root.offset = 0;
+    root.count = bvh.ntris;
+    int nbrute = nqueries < 100 ? nqueries : 100;
+    float *queries = malloc(6 * (size_t) nqueries * sizeof(float) + 1);
+    uint32_t state = 1;
+    int *out = NULL, cap = 0;
+    printf("query         bvh/s    brute/s  speedup     hits\n");
+    for (int query = 0; query < 3; query++) {
+        for (int i = 0; i < nqueries; i++) {
+            float *q = queries + 6 * i;
+            if (query == 0) {               // rays from around the mesh towards a point in it
+                bvh_point(&root, 1.5f, &state, q);
+                bvh_point(&root, 1, &state, q + 3);
+                for (int k = 0; k < 3; k++) {
+                    q[3 + k] -= q[k];
+                }
+            } else if (query == 1) {        // boxes a fiftieth of the bounds across
+                bvh_point(&root, 1, &state, q);
+                for (int k = 0; k < 3; k++) {
+                    float e = (root.max[k] - root.min[k]) / 100;
+                    q[3 + k] = q[k] + e, q[k] -= e;
+                }
+            } else {
+                bvh_point(&root, 1.5f, &state, q);
             }
-            printf("] ");
         }
-        putchar('\n');
+        double rate[2];
+        long hits[2] = {0};
+        float results[2][100];              // hit distance, box count or squared distance
+        for (int brute = 0; brute < 2; brute++) {
+            objbvh *tree = brute ? &flat : &bvh;
+            int n = brute ? nbrute : nqueries;
+            double start = obj_time();
+            for (int i = 0; i < n; i++) {
+                float *q = queries + 6 * i, p[3], d[3];
+                objhit hit;
+                int result = query == 0 ? bvh_ray(tree, q, q + 3, INFINITY, &hit)
+                    : query == 1 ? bvh_overlap(tree, q, q + 3, &out, &cap)
+                    : bvh_closest(tree, q, p);
+                hits[brute] += query == 1 ? result : result >= 0;
+                if (i < nbrute) {
+                    for (int k = 0; k < 3 && query == 2; k++) {
+                        d[k] = p[k] - q[k];
+                    }
+                    results[brute][i] = query == 0 ? (result < 0 ? -1 : hit.t)
+                        : query == 1 ? result : dot3(d, d);
+                }
+            }
+            rate[brute] = n / (obj_time() - start);
+        }
+        // a tie on a shared edge can pick another triangle, but not another distance
+        for (int i = 0; i < nbrute; i++) {
+            if (fabsf(results[0][i] - results[1][i]) > 1e-5f * fmaxf(1, fabsf(results[1][i]))) {
+                fprintf(stderr, "bvh and brute force differ at query %d\n", i);
+                exit(1);
+            }
+        }
+        const char *names[] = { "ray", "box", "closest" };
+        printf("%-8s %10.0f %10.0f %8.1f %8.2f\n", names[query], rate[0], rate[1],
+            rate[0] / rate[1], (double) hits[0] / nqueries);
     }
-    printf("material indices:\n");
-    for (int i = 0; i < ctx->nmeshes; i++) {
-        if (i > 0 && (i % 16 == 0)) {
-            putchar('\n');
+    free(out);
+    free(queries);
+    bvh_free(&bvh);
+    objctx_free(&ctx);
+}
+
+// a file of a batch conversion and what converting it took
+typedef struct {
+    char   *path;
+    char   *name;       // file name without the .obj
+    size_t size;
+    int    ntris;
+    size_t outsize;
+    double seconds;
+    int    failed;
+} convertfile;
+
+// files of one worker in ascending size, the owner takes the largest from the
+// bottom and idle workers steal the smallest from the top
+typedef struct {
+    pthread_mutex_t lock;
+    int top;
+    int bottom;
+    int *files;
+} convertdeque;
+
+typedef struct {
+    objopts      opts;
+    const char   *outdir;
+    int          format;
+    int          nfiles;
+    convertfile  *files;
+    int          nworkers;
+    convertdeque *deques;
+    size_t       bigfile;   // files this big are parsed with every thread
+    int          steals;
+    double       start;
+} convertpool;
+
+typedef struct {
+    convertpool *pool;
+    int         index;
+    pthread_t   thread;
+} convertworker;
+
+// indexed binary mesh: this header, the interleaved vertices of 8 floats,
+// the indices and the draw ranges as first index, index count and material
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t indexsize;
+    uint32_t nvertices;
+    uint32_t nindices;
+    uint32_t nranges;
+    uint32_t nmaterials;
+    float    min[3];
+    float    max[3];
+} meshheader;
+
+#define mesh_magic "objmesh"
+#define mesh_version 1
+
+// draw ranges of ctx: the material batches when sorted, else the meshes
+int convert_ranges(objctx *ctx, int *ranges) {
+    if (ctx->ndraws) {
+        for (int i = 0; i < ctx->ndraws; i++) {
+            ranges[3 * i] = ctx->draws[i].offset;
+            ranges[3 * i + 1] = ctx->draws[i].count;
+            ranges[3 * i + 2] = ctx->draws[i].material;
         }
-        printf("%4d ", ctx->mtlindices[i]);
+        return ctx->ndraws;
     }
-    putchar('\n');
-    mtl_print(ctx);
+    int n = 0;
+    for (int m = -1; m < ctx->nmeshes; m++) {
+        int begin = m < 0 ? 0 : ctx->meshoffsets[m];
+        int end = ctx->meshoffsets[m + 1];
+        if (end > begin) {
+            ranges[3 * n] = begin;
+            ranges[3 * n + 1] = end - begin;
+            ranges[3 * n++ + 2] = m < 0 ? -1 : ctx->mtlindices[m];
+        }
+    }
+    return n;
 }
 
-void mtlctx_free(mtlctx *ctx) {
-    free(ctx->filename);
-    for (int i = 0; i < ctx->nmaterials; i++) {
-        mtl *mtl = ctx->materials + i;
-        if (mtl->map_ambient) {
-            free(mtl->map_ambient);
+void convert_bounds(objctx *ctx, float *min, float *max) {
+    for (int j = 0; j < 3; j++) {
+        min[j] = ctx->nunique ? FLT_MAX : 0;
+        max[j] = ctx->nunique ? -FLT_MAX : 0;
+    }
+    for (int i = 0; i < ctx->nunique; i++) {
+        const float *v = ctx->vbuffer + 8 * i;
+        for (int j = 0; j < 3; j++) {
+            min[j] = v[j] < min[j] ? v[j] : min[j];
+            max[j] = v[j] > max[j] ? v[j] : max[j];
         }
-        if (mtl->map_diffuse) {
-            free(mtl->map_diffuse);
+    }
+}
+
+FILE *convert_open(convertpool *pool, const char *name, const char *extension) {
+    char *path = malloc(strlen(pool->outdir) + strlen(name) + strlen(extension) + 2);
+    sprintf(path, "%s/%s%s", pool->outdir, name, extension);
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "failed to write %s\n", path);
+    }
+    free(path);
+    return file;
+}
+
+size_t convert_bin(convertpool *pool, convertfile *cf, objctx *ctx, int *ranges, int nranges) {
+    FILE *file = convert_open(pool, cf->name, ".objmesh");
+    if (!file) {
+        return 0;
+    }
+    meshheader header = {
+        .magic = mesh_magic, .version = mesh_version, .indexsize = ctx->indexsize,
+        .nvertices = ctx->nunique, .nindices = ctx->nfaceverts, .nranges = nranges,
+        .nmaterials = ctx->materials.nmaterials
+    };
+    convert_bounds(ctx, header.min, header.max);
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(ctx->vbuffer, 8 * sizeof(float), ctx->nunique, file);
+    fwrite(ctx->indices, ctx->indexsize, ctx->nfaceverts, file);
+    fwrite(ranges, 3 * sizeof(int), nranges, file);
+    size_t size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+// a json string, quotes and control characters escaped
+void json_string(FILE *file, const char *s) {
+    fputc('"', file);
+    for (; s && *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(file, "\\%c", *s);
+        } else if ((unsigned char) *s < 0x20) {
+            fprintf(file, "\\u%04x", *s);
+        } else {
+            fputc(*s, file);
         }
-        if (mtl->map_specular) {
-            free(mtl->map_specular);
+    }
+    fputc('"', file);
+}
+
+// gltf 2.0 with one interleaved vertex buffer view, one index buffer view
+// and a primitive per draw range. texcoords are flipped to the top left origin
+size_t convert_gltf(convertpool *pool, convertfile *cf, objctx *ctx, int *ranges, int nranges) {
+    FILE *bin = convert_open(pool, cf->name, ".bin");
+    FILE *file = bin ? convert_open(pool, cf->name, ".gltf") : NULL;
+    if (!file) {
+        if (bin) {
+            fclose(bin);
         }
-        if (mtl->map_highlight) {
-            free(mtl->map_highlight);
+        return 0;
+    }
+    size_t vbytes = 8 * sizeof(float) * (size_t) ctx->nunique;
+    size_t ibytes = (size_t) ctx->indexsize * ctx->nfaceverts;
+    float *vertices = memdup(ctx->vbuffer, vbytes);
+    for (int i = 0; i < ctx->nunique; i++) {
+        vertices[8 * i + 4] = 1 - vertices[8 * i + 4];
+    }
+    fwrite(vertices, 1, vbytes, bin);
+    fwrite(ctx->indices, 1, ibytes, bin);
+    free(vertices);
+    size_t padding = (4 - ibytes % 4) % 4;
+    fwrite("\0\0\0", 1, padding, bin);
+    size_t size = ftell(bin);
+    fclose(bin);
+    float min[3], max[3];
+    convert_bounds(ctx, min, max);
+    fprintf(file, "{\"asset\":{\"version\":\"2.0\",\"generator\":\"obj3\"},\n");
+    fprintf(file, "\"buffers\":[{\"uri\":");
+    char *uri = malloc(strlen(cf->name) + 5);
+    sprintf(uri, "%s.bin", cf->name);
+    json_string(file, uri);
+    free(uri);
+    fprintf(file, ",\"byteLength\":%zu}],\n", size);
+    fprintf(file, "\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":%zu,"
+        "\"byteStride\":32,\"target\":34962},\n", vbytes);
+    fprintf(file, "{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"target\":34963}],\n",
+        vbytes, ibytes);
+    fprintf(file, "\"accessors\":[{\"bufferView\":0,\"byteOffset\":0,\"componentType\":5126,"
+        "\"count\":%d,\"type\":\"VEC3\",\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]},\n",
+        ctx->nunique, min[0], min[1], min[2], max[0], max[1], max[2]);
+    fprintf(file, "{\"bufferView\":0,\"byteOffset\":12,\"componentType\":5126,"
+        "\"count\":%d,\"type\":\"VEC2\"},\n", ctx->nunique);
+    fprintf(file, "{\"bufferView\":0,\"byteOffset\":20,\"componentType\":5126,"
+        "\"count\":%d,\"type\":\"VEC3\"}", ctx->nunique);
+    for (int i = 0; i < nranges; i++) {
+        fprintf(file, ",\n{\"bufferView\":1,\"byteOffset\":%zu,\"componentType\":%d,"
+            "\"count\":%d,\"type\":\"SCALAR\"}", (size_t) ranges[3 * i] * ctx->indexsize,
+            ctx->indexsize == 2 ? 5123 : 5125, ranges[3 * i + 1]);
+    }
+    fprintf(file, "],\n\"materials\":[");
+    for (int i = 0; i < ctx->materials.nmaterials; i++) {
+        mtl *mtl = ctx->materials.materials + i;
+        fprintf(file, "%s{\"name\":", i ? ",\n" : "");
+        json_string(file, mtl->name);
+        // d of 0 is taken as unset rather than invisible
+        fprintf(file, ",\"pbrMetallicRoughness\":{\"baseColorFactor\":[%g,%g,%g,%g],"
+            "\"metallicFactor\":0}}", mtl->diffuse[0], mtl->diffuse[1], mtl->diffuse[2],
+            mtl->transparency > 0 ? mtl->transparency : 1);
+    }
+    fprintf(file, "],\n\"meshes\":[{\"name\":");
+    json_string(file, cf->name);
+    fprintf(file, ",\"primitives\":[");
+    for (int i = 0; i < nranges; i++) {
+        // without any vn there are no normals worth writing
+        fprintf(file, "%s{\"attributes\":{\"POSITION\":0,\"TEXCOORD_0\":1%s},\"indices\":%d",
+            i ? ",\n" : "", ctx->nnormals ? ",\"NORMAL\":2" : "", 3 + i);
+        if (ranges[3 * i + 2] >= 0) {
+            fprintf(file, ",\"material\":%d", ranges[3 * i + 2]);
         }
-        if (mtl->map_alpha) {
-            free(mtl->map_alpha);
+        fputc('}', file);
+    }
+    fprintf(file, "]}],\n\"nodes\":[{\"mesh\":0}],\"scenes\":[{\"nodes\":[0]}],\"scene\":0}\n");
+    size += ftell(file);
+    fclose(file);
+    return size;
+}
+
+void convert_one(convertpool *pool, convertfile *cf) {
+    objopts opts = pool->opts;
+    opts.nthreads = cf->size >= pool->bigfile ? pool->opts.nthreads : 1;
+    double start = obj_time();
+    objctx ctx;
+    if (obj_load(&ctx, cf->path, &opts)) {
+        cf->failed = 1;
+        return;
+    }
+    int *ranges = malloc(3 * (ctx.nmeshes + 1) * sizeof(int));
+    int nranges = convert_ranges(&ctx, ranges);
+    cf->outsize = pool->format == FGLTF
+        ? convert_gltf(pool, cf, &ctx, ranges, nranges)
+        : convert_bin(pool, cf, &ctx, ranges, nranges);
+    cf->failed = !cf->outsize;
+    cf->ntris = ctx.nfaceverts / 3;
+    free(ranges);
+    objctx_free(&ctx);
+    cf->seconds = obj_time() - start;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // one printf per file, lines of different workers don't mix
+    printf("%-24s %9.2f MB %10d tris %9.1f ms %8.1f MB/s %12.0f tris/s peak %7.1f MB%s\n",
+        cf->name, cf->size / 1048576.0, cf->ntris, cf->seconds * 1e3,
+        cf->size / 1048576.0 / cf->seconds, cf->ntris / cf->seconds,
+        usage.ru_maxrss / 1024.0, cf->failed ? " failed" : "");
+}
+
+// next file of a worker: its own largest, else the smallest of another
+int convert_next(convertpool *pool, int index) {
+    convertdeque *own = pool->deques + index;
+    int file = -1;
+    pthread_mutex_lock(&own->lock);
+    if (own->bottom > own->top) {
+        file = own->files[--own->bottom];
+    }
+    pthread_mutex_unlock(&own->lock);
+    for (int i = 1; i < pool->nworkers && file < 0; i++) {
+        convertdeque *victim = pool->deques + (index + i) % pool->nworkers;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->bottom > victim->top) {
+            file = victim->files[victim->top++];
+            __atomic_fetch_add(&pool->steals, 1, __ATOMIC_RELAXED);
         }
-        if (mtl->map_bump) {
-            free(mtl->map_bump);
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return file;
+}
+
+void *convert_worker(void *arg) {
+    convertworker *worker = arg;
+    convertpool *pool = worker->pool;
+    for (int file; (file = convert_next(pool, worker->index)) >= 0; ) {
+        convert_one(pool, pool->files + file);
+    }
+    return NULL;
+}
+
+int convert_larger(const void *a, const void *b) {
+    const convertfile *fa = a;
+    const convertfile *fb = b;
+    return fa->size < fb->size ? 1 : fa->size > fb->size ? -1 : strcmp(fa->name, fb->name);
+}
+
+// convert every obj file of a directory to indexed meshes in outdir, one
+// file per task on -j workers
+void convert_obj(const char *directory, const char *outdir, int format, objopts *opts) {
+    DIR *dir = opendir(directory);
+    if (!dir) {
+        fprintf(stderr, "failed to open directory %s\n", directory);
+        exit(1);
+    }
+    convertpool pool = { .opts = *opts, .outdir = outdir, .format = format };
+    pool.opts.indexed = 1;                  // float vertices in one interleaved buffer
+    pool.opts.quantize = QNONE;
+    pool.opts.soa = 0;
+    pool.opts.lod = 0;
+    int capfiles = 0;
+    size_t total = 0;
+    for (struct dirent *entry; (entry = readdir(dir)); ) {
+        size_t length = strlen(entry->d_name);
+        struct stat st;
+        if (length < 5 || strcasecmp(entry->d_name + length - 4, ".obj")) {
+            continue;
         }
-        free(mtl->name);
+        char *path = malloc(strlen(directory) + length + 2);
+        sprintf(path, "%s/%s", directory, entry->d_name);
+        if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        pool.files = reserve(pool.files, &capfiles, pool.nfiles + 1, sizeof(convertfile));
+        pool.files[pool.nfiles++] = (convertfile){
+            .path = path, .name = strndup(entry->d_name, length - 4), .size = st.st_size
+        };
+        total += st.st_size;
     }
-    free(ctx->materials);
+    closedir(dir);
+    qsort(pool.files, pool.nfiles, sizeof(convertfile), convert_larger);
+    pool.nworkers = opts->nthreads < 1 ? 1 : opts->nthreads > 64 ? 64 : opts->nthreads;
+    pool.bigfile = pool.nworkers > 1 ? total / pool.nworkers : (size_t) -1;
+    pool.deques = calloc(pool.nworkers, sizeof(convertdeque));
+    for (int w = 0; w < pool.nworkers; w++) {
+        convertdeque *deque = pool.deques + w;
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->files = malloc((pool.nfiles / pool.nworkers + 1) * sizeof(int));
+        // dealt largest first, stored smallest first
+        int n = (pool.nfiles - w + pool.nworkers - 1) / pool.nworkers;
+        for (int i = 0; i < n; i++) {
+            deque->files[n - 1 - i] = w + i * pool.nworkers;
+        }
+        deque->bottom = n;
+    }
+    printf("%d files, %.2f MB, %d workers\n", pool.nfiles, total / 1048576.0, pool.nworkers);
+    convertworker workers[64];
+    double start = obj_time();
+    for (int w = 0; w < pool.nworkers; w++) {
+        workers[w] = (convertworker){ .pool = &pool, .index = w };
+        if (w > 0) {
+            pthread_create(&workers[w].thread, NULL, convert_worker, workers + w);
+        }
+    }
+    convert_worker(workers);
+    for (int w = 1; w < pool.nworkers; w++) {
+        pthread_join(workers[w].thread, NULL);
+    }
+    double elapsed = obj_time() - start;
+    long long ntris = 0;
+    size_t outsize = 0;
+    double busy = 0;
+    int failed = 0;
+    for (int i = 0; i < pool.nfiles; i++) {
+        ntris += pool.files[i].ntris;
+        outsize += pool.files[i].outsize;
+        busy += pool.files[i].seconds;
+        failed += pool.files[i].failed;
+        free(pool.files[i].path);
+        free(pool.files[i].name);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("total: %d files (%d failed), %.2f MB in, %.2f MB out, %lld tris in %.1f ms\n",
+        pool.nfiles, failed, total / 1048576.0, outsize / 1048576.0, ntris, elapsed * 1e3);
+    printf("rate: %.1f MB/s, %.0f tris/s, %d steals, %.0f%% busy, peak %.1f MB\n",
+        total / 1048576.0 / elapsed, ntris / elapsed, pool.steals,
+        100 * busy / elapsed / pool.nworkers, usage.ru_maxrss / 1024.0);
+    for (int w = 0; w < pool.nworkers; w++) {
+        pthread_mutex_destroy(&pool.deques[w].lock);
+        free(pool.deques[w].files);
+    }
+    free(pool.deques);
+    free(pool.files);
 }
 
-void objctx_free(objctx *ctx) {
-    free(ctx->vertices);
-    free(ctx->normals);
-    free(ctx->texcoords);
-    free(ctx->faces);
-    free(ctx->buffer);
-    free(ctx->meshoffsets);
-    free(ctx->mtlindices);
-    mtlctx_free(&ctx->materials);
+#define bench_phases 11
+
+const char *bench_names[bench_phases] = {
+    "read", "scan", "materials", "parse", "normals", "sort",
+    "build", "optimize", "meshlets", "quantize", "lod"
+};
+
+// lines of each key and the mtl files found by the key dispatch alone, the
+// work the old count_key pass did before parsing
+typedef struct {
+    int  counts[VT + 1];
+    int  nlibraries;
+    char **libraries;
+} benchscan;
+
+void bench_scanline(void *arg, const char *p, const char *eol) {
+    benchscan *scan = arg;
+    int key = objline_key(&p, eol);
+    if (key < 0) {
+        return;
+    }
+    scan->counts[key]++;
+    if (key == MTLLIB) {
+        char s[512];
+        parse_word(p, eol, s, sizeof(s), 1);
+        scan->libraries = realloc(scan->libraries, (scan->nlibraries + 1) * sizeof(char *));
+        scan->libraries[scan->nlibraries++] = strdup(s);
+    }
 }
 
-void parse_obj(const char *filename) {
-    FILE *f = fopen(filename, "r");         // open the file
-    if (!f) {                               // check if file exists
-        fprintf(stderr, "failed to open file %s\n", filename);
+int bench_compare(const void *a, const void *b) {
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+    return da < db ? -1 : da > db;
+}
+
+// time every load phase on its own over runs runs and print json lines: one
+// for the scene, then the best and median seconds of each phase that ran.
+// the mtl files are cached before parsing, so parse leaves them out
+void obj_bench(const char *filename, objopts *opts, int runs) {
+    double *times = calloc(bench_phases * runs, sizeof(double));
+    int ran[bench_phases] = {0};
+    objctx last = {0};
+    size_t bytes = 0;
+    int nlibraries = 0;
+    for (int run = 0; run < runs; run++) {
+        double *t = times + run;
+        double start = obj_time();
+        filemap map;
+        if (file_map(&map, filename)) {
+            fprintf(stderr, "failed to open file %s\n", filename);
+            exit(1);
+        }
+        volatile char sink = 0;
+        for (size_t i = 0; i < map.size; i += 4096) {  // fault every page in
+            sink += map.data[i];
+        }
+        bytes = map.size;
+        t[0] = obj_time() - start;
+        start = obj_time();
+        benchscan scan = {0};
+        parse_lines(map.data, map.data + map.size, bench_scanline, &scan);
+        t[runs] = obj_time() - start;
+        objctx ctx = { .filename = (char *) filename };
+        start = obj_time();
+        for (int i = 0; i < scan.nlibraries; i++) {
+            mtl_filename(&ctx, scan.libraries[i]);
+            filemap mtlmap;
+            if (!file_map(&mtlmap, ctx.materials.filename)) {
+                objctx tmp = {0};
+                parse_lines(mtlmap.data, mtlmap.data + mtlmap.size, parse_mtlline, &tmp);
+                file_unmap(&mtlmap);
+                mtlctx_free(&tmp.materials);
+            }
+        }
+        t[2 * runs] = obj_time() - start;
+        for (int i = 0; i < scan.nlibraries; i++) {
+            mtlctx warm = {0};
+            mtl_filename(&ctx, scan.libraries[i]);
+            mtlcache_load(&warm, ctx.materials.filename);
+            mtlctx_free(&warm);
+            free(scan.libraries[i]);
+        }
+        nlibraries = scan.nlibraries;
+        free(scan.libraries);
+        mtlctx_free(&ctx.materials);
+        ctx.materials = (mtlctx){0};
+        ran[0] = ran[1] = ran[2] = ran[3] = ran[6] = 1;
+        start = obj_time();
+        if (obj_parse(&ctx, map.data, map.size, opts->nthreads)) {
+            exit(1);
+        }
+        t[3 * runs] = obj_time() - start;
+        file_unmap(&map);
+        if (opts->normals) {
+            start = obj_time();
+            obj_normals(&ctx, opts->crease, opts->nthreads);
+            t[4 * runs] = obj_time() - start;
+            ran[4] = 1;
+        }
+        if (opts->sort) {
+            start = obj_time();
+            obj_batch(&ctx);
+            t[5 * runs] = obj_time() - start;
+            ran[5] = 1;
+        }
+        start = obj_time();
+        if (opts->indexed || opts->optimize || opts->lod) {
+            build_indexed(&ctx);
+        } else {
+            build_buffer(&ctx);
+        }
+        t[6 * runs] = obj_time() - start;
+        if (opts->optimize) {
+            start = obj_time();
+            obj_optimize(&ctx);
+            t[7 * runs] = obj_time() - start;
+            ran[7] = 1;
+        }
+        if (opts->meshlets) {
+            start = obj_time();
+            obj_meshlets(&ctx, opts->nthreads);
+            t[8 * runs] = obj_time() - start;
+            ran[8] = 1;
+        }
+        if (opts->quantize) {
+            start = obj_time();
+            obj_quantize(&ctx, opts->quantize);
+            t[9 * runs] = obj_time() - start;
+            ran[9] = 1;
+        }
+        if (opts->lod) {
+            start = obj_time();
+            obj_lod(&ctx, opts->nthreads);
+            t[10 * runs] = obj_time() - start;
+            ran[10] = 1;
+        }
+        objctx_free(&last);
+        last = ctx;
+    }
+    printf("{\"file\":");
+    json_string(stdout, filename);
+    printf(",\"bytes\":%zu,\"threads\":%d,\"runs\":%d,\"vertices\":%d,\"normals\":%d,"
+        "\"texcoords\":%d,\"faces\":%d,\"triangles\":%d,\"meshes\":%d,\"materials\":%d,"
+        "\"libraries\":%d}\n", bytes, opts->nthreads, runs, last.nvertices, last.nnormals,
+        last.ntexcoords, last.nfaces, last.nfaceverts / 3, last.nmeshes,
+        last.materials.nmaterials, nlibraries);
+    double *total = calloc(runs, sizeof(double));
+    for (int phase = 0; phase <= bench_phases; phase++) {
+        double *t = phase < bench_phases ? times + phase * runs : total;
+        if (phase < bench_phases && !ran[phase]) {
+            continue;
+        }
+        for (int run = 0; phase < bench_phases && run < runs; run++) {
+            total[run] += t[run];
+        }
+        qsort(t, runs, sizeof(double), bench_compare);
+        double best = t[0];
+        double median = runs % 2 ? t[runs / 2] : (t[runs / 2 - 1] + t[runs / 2]) / 2;
+        printf("{\"file\":");
+        json_string(stdout, filename);
+        printf(",\"phase\":\"%s\",\"best\":%.6f,\"median\":%.6f,\"mbps\":%.1f,\"mtris\":%.3f}\n",
+            phase < bench_phases ? bench_names[phase] : "total", best, median,
+            best > 0 ? bytes / best / (1 << 20) : 0,
+            best > 0 ? last.nfaceverts / 3 / best * 1e-6 : 0);
+    }
+    objctx_free(&last);
+    free(total);
+    free(times);
+}
+
+void parse_obj(const char *filename, objopts *opts) {
+    objctx ctx;
+    if (obj_load(&ctx, filename, opts)) {
         exit(1);
     }
-    char s[512];                            // char buffer to store lines from the file
-    objctx ctx = {0};                       // context instance initialized on stack to zero
-    ctx.filename = (char *) filename;
-    while (fgets(s, 512, f)) {              // read file line by line
-        count_key(&ctx, s);                 // count keys in our file
-    }
-    objctx_malloc(&ctx);                    // allocate memory to hold values from file
-    objctx_reset(&ctx);                     // reset all counters to zero
-    parse_materials(&ctx);
-    rewind(f);                              // rewind file to the start
-    while (fgets(s, 512, f)) {              // read file line by line
-        parse_objline(&ctx, s);             // update context values
-    }
-    ctx.meshoffsets[ctx.nmeshes] = ctx.nfaceverts;
-    build_buffer(&ctx);
     objctx_print(&ctx);                     // print values from context
     objctx_free(&ctx);                      // free context data
-    fclose(f);                              // close the file
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("usage: %s filename.obj\n", argv[0]);
+    objopts opts = { .nthreads = 1, .stream = -1, .crease = 180 };
+    atexit(mtlcache_free);
+    int i = 1;
+    for (; i < argc - 1 && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (!strcmp(argv[i], "-j") && i < argc - 2) {
+            opts.nthreads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-scale")) {
+            opts.scale = 1;
+        } else if (!strcmp(argv[i], "-i")) {
+            opts.indexed = 1;
+        } else if (!strcmp(argv[i], "-o")) {
+            opts.optimize = 1;
+        } else if (!strcmp(argv[i], "-c")) {
+            opts.cache = 1;
+        } else if (!strcmp(argv[i], "-q") && i < argc - 2) {
+            i++;
+            opts.quantize = !strcmp(argv[i], "half") ? QHALF : !strcmp(argv[i], "snorm16") ? QSNORM : -1;
+            if (opts.quantize < 0) {
+                break;
+            }
+        } else if (!strcmp(argv[i], "-soa")) {
+            opts.soa = 1;
+        } else if (!strcmp(argv[i], "-transform")) {
+            opts.transform = 1;
+        } else if (!strcmp(argv[i], "-stream") && i < argc - 2) {
+            opts.stream = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-spill")) {
+            opts.spill = 1;
+        } else if (!strcmp(argv[i], "-n")) {
+            opts.normals = 1;
+        } else if (!strcmp(argv[i], "-crease") && i < argc - 2) {
+            opts.normals = 1;
+            opts.crease = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-tex") && i < argc - 2) {
+            opts.textures = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-meshlets")) {
+            opts.meshlets = 1;
+        } else if (!strcmp(argv[i], "-lod")) {
+            opts.lod = 1;
+            opts.indexed = 1;
+        } else if (!strcmp(argv[i], "-sort")) {
+            opts.sort = 1;
+        } else if (!strcmp(argv[i], "-bench") && i < argc - 2) {
+            opts.bench = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-watch")) {
+            opts.watch = 1;
+        } else if (!strcmp(argv[i], "-convert") && i < argc - 2) {
+            opts.convert = argv[++i];
+        } else if (!strcmp(argv[i], "-format") && i < argc - 2) {
+            i++;
+            opts.format = !strcmp(argv[i], "bin") ? FBIN : !strcmp(argv[i], "gltf") ? FGLTF : -1;
+            if (opts.format < 0) {
+                break;
+            }
+        } else if (!strcmp(argv[i], "-bvh") && i < argc - 2) {
+            opts.bvh = atoi(argv[++i]);
+        } else {
+            break;
+        }
+    }
+    if (i != argc - 1) {
+        printf("usage: %s [-j threads] [-scale] [-i] [-o] [-c] [-q half|snorm16] [-soa] [-transform]"
+            " [-stream triangles] [-spill] [-n] [-crease degrees] [-bvh queries] [-lod] [-meshlets] [-tex threads] [-sort] [-watch] [-bench runs] filename.obj\n"
+            "       %s [-j threads] [options] -convert outdir [-format bin|gltf] directory\n", argv[0], argv[0]);
         return 1;
     }
-    parse_obj(argv[1]);
+    if (opts.textures > 0) {
+        texpool_start(opts.textures);
+        atexit(texpool_free);
+    }
+    if (opts.scale) {
+        obj_scale(argv[i]);
+        return 0;
+    }
+    if (opts.transform) {
+        obj_transform(argv[i], &opts);
+        return 0;
+    }
+    if (opts.bvh > 0) {
+        obj_bvh(argv[i], &opts, opts.bvh);
+        return 0;
+    }
+    if (opts.stream >= 0) {
+        stream_obj(argv[i], opts.stream, opts.spill);
+        return 0;
+    }
+    if (opts.bench > 0) {
+        obj_bench(argv[i], &opts, opts.bench);
+        return 0;
+    }
+    if (opts.watch) {
+        watch_obj(argv[i], &opts);
+        return 0;
+    }
+    if (opts.convert) {
+        convert_obj(argv[i], opts.convert, opts.format, &opts);
+        return 0;
+    }
+    parse_obj(argv[i], &opts);
     return 0;
-}
\ No newline at end of file
+}
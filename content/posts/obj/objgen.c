@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// synthetic scenes for benchmarking obj3.c: a grid of uv spheres, each
+// switching material halfway, with optional n-gon caps and no normals
+
+typedef struct {
+    int objects;        // spheres in the scene
+    int segments;       // rings per sphere, twice as many sectors
+    int materials;
+    int ngons;          // poles as one polygon, plus a concave star per sphere
+    int normals;
+    unsigned seed;
+} genopts;
+
+unsigned gen_random(unsigned *state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+float gen_float(unsigned *state) {
+    return gen_random(state) / 16777216.0f;
+}
+
+void write_mtl(FILE *f, genopts *opts) {
+    unsigned state = opts->seed;
+    for (int i = 0; i < opts->materials; i++) {
+        fprintf(f, "newmtl material%d\n", i);
+        fprintf(f, "Ka 0.1 0.1 0.1\n");
+        fprintf(f, "Kd %.3f %.3f %.3f\n", gen_float(&state), gen_float(&state), gen_float(&state));
+        fprintf(f, "Ks 0.5 0.5 0.5\n");
+        fprintf(f, "Ns %d\n", 10 + (int) (gen_float(&state) * 90));
+        fprintf(f, "d 1\n");
+        fprintf(f, "illum 2\n\n");
+    }
+}
+
+// vertices of the sphere are its rings from pole to pole, each ring
+// has sectors + 1 of them so the seam gets its own texcoords
+void write_sphere(FILE *f, genopts *opts, int index, int *base, unsigned *state) {
+    int rings = opts->segments;
+    int sectors = 2 * opts->segments;
+    int side = (int) ceil(sqrt(opts->objects));
+    float cx = 3.0f * (index % side);
+    float cz = 3.0f * (index / side);
+    float radius = 0.5f + 0.5f * gen_float(state);
+    fprintf(f, "o sphere%d\n", index);
+    for (int r = 0; r <= rings; r++) {
+        float theta = M_PI * r / rings;
+        for (int s = 0; s <= sectors; s++) {
+            float phi = 2 * M_PI * s / sectors;
+            float n[3] = { sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi) };
+            fprintf(f, "v %.6f %.6f %.6f\n", cx + radius * n[0], radius * n[1], cz + radius * n[2]);
+            fprintf(f, "vt %.6f %.6f\n", (float) s / sectors, 1 - (float) r / rings);
+            if (opts->normals) {
+                fprintf(f, "vn %.6f %.6f %.6f\n", n[0], n[1], n[2]);
+            }
+        }
+    }
+    int material = opts->materials ? gen_random(state) % opts->materials : 0;
+    #define vertex(r, s) (*base + (r) * (sectors + 1) + (s) + 1)
+    for (int r = 0; r < rings; r++) {
+        if (opts->materials && r == 0) {
+            fprintf(f, "usemtl material%d\n", material);
+        } else if (opts->materials > 1 && r == rings / 2) {
+            fprintf(f, "usemtl material%d\n", (material + 1) % opts->materials);
+        }
+        if (r == rings / 2) {
+            fprintf(f, "s %d\n", 2);
+        } else if (r == 0) {
+            fprintf(f, "s %d\n", 1);
+        }
+        int pole = r == 0 || r == rings - 1;
+        if (pole && opts->ngons) {
+            int ring = r == 0 ? 1 : rings - 1;
+            fprintf(f, "f");
+            for (int s = 0; s < sectors; s++) {
+                int v = vertex(ring, r == 0 ? sectors - s : s);
+                fprintf(f, opts->normals ? " %d/%d/%d" : " %d/%d", v, v, v);
+            }
+            fputc('\n', f);
+            continue;
+        }
+        for (int s = 0; s < sectors; s++) {
+            // counterclockwise seen from outside, like the normals
+            int corners[4] = { vertex(r, s), vertex(r, s + 1), vertex(r + 1, s + 1), vertex(r + 1, s) };
+            int skip = !pole ? -1 : r == 0 ? 0 : 2;  // the corner on a pole is dropped
+            fprintf(f, "f");
+            for (int c = 0; c < 4; c++) {
+                if (c == skip) {
+                    continue;
+                }
+                int v = corners[c];
+                fprintf(f, opts->normals ? " %d/%d/%d" : " %d/%d", v, v, v);
+            }
+            fputc('\n', f);
+        }
+    }
+    #undef vertex
+    int nverts = (rings + 1) * (sectors + 1);
+    if (opts->ngons) {
+        // a flat concave star below the sphere, which a fan gets wrong. it
+        // gets texcoords and normals too so the indices stay in step
+        if (opts->materials) {
+            fprintf(f, "usemtl material0\n");
+        }
+        for (int i = 0; i < 10; i++) {
+            float a = M_PI * i / 5;
+            float l = i % 2 ? 0.4f : 1.0f;
+            fprintf(f, "v %.6f %.6f %.6f\n", cx + l * cosf(a), -1.5f, cz + l * sinf(a));
+            fprintf(f, "vt %.6f %.6f\n", 0.5f + 0.5f * l * cosf(a), 0.5f + 0.5f * l * sinf(a));
+            if (opts->normals) {
+                fprintf(f, "vn 0 -1 0\n");
+            }
+        }
+        fprintf(f, "f");
+        for (int i = 0; i < 10; i++) {
+            int v = *base + nverts + i + 1;
+            fprintf(f, opts->normals ? " %d/%d/%d" : " %d/%d", v, v, v);
+        }
+        fputc('\n', f);
+        nverts += 10;
+    }
+    *base += nverts;
+}
+
+int main(int argc, char *argv[]) {
+    genopts opts = { .objects = 16, .segments = 32, .materials = 4, .normals = 1, .seed = 1 };
+    int i = 1;
+    for (; i < argc - 1 && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-objects") && i < argc - 2) {
+            opts.objects = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-segments") && i < argc - 2) {
+            opts.segments = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-materials") && i < argc - 2) {
+            opts.materials = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-seed") && i < argc - 2) {
+            opts.seed = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-ngons")) {
+            opts.ngons = 1;
+        } else if (!strcmp(argv[i], "-nonormals")) {
+            opts.normals = 0;
+        } else {
+            break;
+        }
+    }
+    if (i != argc - 1 || opts.objects < 1 || opts.segments < 3 || opts.materials < 0) {
+        printf("usage: %s [-objects n] [-segments n] [-materials n] [-seed n] [-ngons] [-nonormals]"
+            " scene.obj\n", argv[0]);
+        exit(1);
+    }
+    char *name = argv[i];
+    size_t length = strlen(name);
+    char *mtlname = malloc(length + 5);
+    strcpy(mtlname, name);
+    if (length > 4 && !strcmp(name + length - 4, ".obj")) {
+        mtlname[length - 4] = 0;
+    }
+    strcat(mtlname, ".mtl");
+    FILE *f = fopen(name, "w");
+    FILE *m = opts.materials ? fopen(mtlname, "w") : NULL;
+    if (!f || (opts.materials && !m)) {
+        printf("failed to open %s\n", f ? mtlname : name);
+        exit(1);
+    }
+    static char buffer[1 << 20];
+    setvbuf(f, buffer, _IOFBF, sizeof(buffer));
+    if (m) {
+        write_mtl(m, &opts);
+        fclose(m);
+        const char *slash = strrchr(mtlname, '/');
+        fprintf(f, "mtllib %s\n", slash ? slash + 1 : mtlname);
+    }
+    unsigned state = opts.seed;
+    int base = 0;
+    for (int o = 0; o < opts.objects; o++) {
+        write_sphere(f, &opts, o, &base, &state);
+    }
+    fclose(f);
+    free(mtlname);
+    return 0;
+}